@@ -33,8 +33,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 cvar_t		cl_warncmd = {"cl_warncmd", "0"};
 
 cmd_alias_t	*cmd_alias;
+int		cmd_alias_generation;
 qboolean	cmd_wait;
 
+#define	CMD_HASHPOOL_SIZE	256
+static	cmd_function_t	*cmd_hash[CMD_HASHPOOL_SIZE];
+static	cmd_alias_t	*alias_hash[CMD_HASHPOOL_SIZE];
+
 //=============================================================================
 
 /*
@@ -346,6 +351,7 @@ void Cmd_Alias_f (void)
 	cmd_alias_t	*a;
 	char		*s, cmd[1024];
 	int		i, c;
+	unsigned int	key;
 
 	if (Cmd_Argc() == 1)
 	{
@@ -363,7 +369,8 @@ void Cmd_Alias_f (void)
 	}
 
 // if the alias already exists, reuse it
-	for (a = cmd_alias ; a ; a = a->next)
+	key = Q_strhash (s, CMD_HASHPOOL_SIZE);
+	for (a = alias_hash[key] ; a ; a = a->hash_next)
 	{
 		if (!strcmp(s, a->name))
 		{
@@ -377,6 +384,9 @@ void Cmd_Alias_f (void)
 		a = Z_Malloc (sizeof(cmd_alias_t));
 		a->next = cmd_alias;
 		cmd_alias = a;
+		a->hash_next = alias_hash[key];
+		alias_hash[key] = a;
+		cmd_alias_generation++;
 	}
 	strcpy (a->name, s);
 
@@ -403,7 +413,7 @@ cmd_alias_t *Cmd_FindAlias (char *name)
 {
 	cmd_alias_t	*alias;
 
-	for (alias = cmd_alias ; alias ; alias = alias->next)
+	for (alias = alias_hash[Q_strhash(name, CMD_HASHPOOL_SIZE)] ; alias ; alias = alias->hash_next)
 		if (!Q_strcasecmp(name, alias->name))
 			return alias;
 
@@ -574,6 +584,7 @@ Cmd_AddCommand
 void Cmd_AddCommand (char *cmd_name, xcommand_t function)
 {
 	cmd_function_t	*cmd;
+	unsigned int	key;
 
 	if (host_initialized)	// because hunk allocation would get stomped
 		Sys_Error ("Cmd_AddCommand after host_initialized");
@@ -597,6 +608,10 @@ void Cmd_AddCommand (char *cmd_name, xcommand_t function)
 	cmd->function = function;
 	cmd->next = cmd_functions;
 	cmd_functions = cmd;
+
+	key = Q_strhash (cmd_name, CMD_HASHPOOL_SIZE);
+	cmd->hash_next = cmd_hash[key];
+	cmd_hash[key] = cmd;
 }
 
 /*
@@ -608,7 +623,7 @@ cmd_function_t *Cmd_FindCommand (char *cmd_name)
 {
 	cmd_function_t	*cmd;
 
-	for (cmd = cmd_functions ; cmd ; cmd = cmd->next)
+	for (cmd = cmd_hash[Q_strhash(cmd_name, CMD_HASHPOOL_SIZE)] ; cmd ; cmd = cmd->hash_next)
 		if (!Q_strcasecmp(cmd_name, cmd->name))
 			return cmd;
 
@@ -834,7 +849,6 @@ void Cmd_CompleteParameter (char *partial, char *attachment)
 Cmd_ExecuteString
 
 A complete command line has been parsed, so try to execute it
-FIXME: lookupnoadd the token to speed search?
 ============
 */
 void Cmd_ExecuteString (char *text, cmd_source_t src)
@@ -853,23 +867,17 @@ void Cmd_ExecuteString (char *text, cmd_source_t src)
 		return; // eaten by the TAS module
 
 // check functions
-	for (cmd = cmd_functions ; cmd ; cmd = cmd->next)
+	if ((cmd = Cmd_FindCommand(cmd_argv[0])))
 	{
-		if (!Q_strcasecmp(cmd_argv[0], cmd->name))
-		{
-			cmd->function ();
-			return;
-		}
+		cmd->function ();
+		return;
 	}
 
 // check alias
-	for (a = cmd_alias ; a ; a = a->next)
+	if ((a = Cmd_FindAlias(cmd_argv[0])))
 	{
-		if (!Q_strcasecmp(cmd_argv[0], a->name))
-		{
-			Cbuf_InsertText (a->value);
-			return;
-		}
+		Cbuf_InsertText (a->value);
+		return;
 	}
 
 // check cvars
@@ -117,6 +117,7 @@ typedef struct cmd_function_s
 	struct cmd_function_s	*next;
 	char			*name;
 	xcommand_t		function;
+	struct cmd_function_s	*hash_next;	// next command in the same Cmd_FindCommand bucket
 } cmd_function_t;
 
 extern cmd_function_t	*cmd_functions;
@@ -180,6 +181,10 @@ typedef struct cmd_alias_s
 	struct cmd_alias_s *next;
 	char		name[MAX_ALIAS_NAME];
 	char		*value;
+	struct cmd_alias_s *hash_next;	// next alias in the same Cmd_FindAlias bucket
 } cmd_alias_t;
 
 cmd_alias_t *Cmd_FindAlias (char *name);
+
+// bumped whenever a new alias is created, an alias runs instead of a cvar with the same name
+extern	int		cmd_alias_generation;
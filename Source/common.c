@@ -276,6 +276,28 @@ void Q_snprintfz (char *dest, size_t size, char *fmt, ...)
 	dest[size-1] = 0;
 }
 
+/*
+============
+Q_strhash
+
+Case-insensitive string hash, consistent with Q_strcasecmp
+============
+*/
+unsigned int Q_strhash (char *str, unsigned int size)
+{
+	unsigned int	hash = 0;
+	int		c;
+
+	while ((c = (unsigned char)*str++))
+	{
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = hash * 31 + c;
+	}
+
+	return hash % size;
+}
+
 /*
 ============================================================================
 
@@ -1081,6 +1103,7 @@ typedef struct
 } dpackheader_t;
 
 #define MAX_FILES_IN_PACK	2048
+#define MAX_MAPPED_PACK		(256 * 1024 * 1024)	// larger paks are read through stdio to spare address space
 
 char	com_gamedir[MAX_OSPATH];
 char	com_basedir[MAX_OSPATH];
@@ -1124,6 +1147,25 @@ int COM_FileOpenRead (char *path, FILE **hndl)
 	return COM_FileLength (f);
 }
 
+/*
+=================
+COM_FindPackFile
+
+Returns the index of filename in the pak or -1, the first of several
+entries with the same name wins like in a linear scan
+=================
+*/
+static int COM_FindPackFile (pack_t *pak, char *filename)
+{
+	int	i;
+
+	for (i = pak->hashheads[Q_strhash(filename, pak->hashsize)] ; i != -1 ; i = pak->hashnext[i])
+		if (!strcmp(pak->files[i].name, filename))
+			return i;
+
+	return -1;
+}
+
 /*
 =================
 COM_FindFile
@@ -1133,19 +1175,15 @@ finds files in given path including inside paks as well
 */
 qboolean COM_FindFile (char *filename)
 {
-	int		i;
 	char		netpath[MAX_OSPATH];
 	searchpath_t	*search;
-	pack_t		*pak;
 
 	for (search = com_searchpaths ; search ; search = search->next)
 	{
 		if (search->pack)
 		{
-			pak = search->pack;
-			for (i=0 ; i<pak->numfiles ; i++)
-				if (!strcmp(pak->files[i].name, filename))
-					return true;
+			if (COM_FindPackFile(search->pack, filename) != -1)
+				return true;
 		}
 		else
 		{
@@ -1265,20 +1303,25 @@ void COM_CopyFile (char *netpath, char *cachepath)
 
 /*
 =================
-COM_FOpenFile
+COM_OpenFile
 
 Finds the file in the search path.
-Sets com_filesize and one of handle or file
+Sets com_filesize and either file or, when mapped is given and the file is
+in a mapped pak, mapped to the file data inside the pak
 =================
 */
-int COM_FOpenFile (char *filename, FILE **file)
+static int COM_OpenFile (char *filename, FILE **file, byte **mapped)
 {
 	searchpath_t	*search;
 	pack_t		*pak;
+	packfile_t	*packfile;
 	int		i;
 
 	com_filesize = -1;
 	com_netpath[0] = 0;
+	*file = NULL;
+	if (mapped)
+		*mapped = NULL;
 
 	// search through the path, one element at a time
 	for (search = com_searchpaths ; search ; search = search->next)
@@ -1286,24 +1329,31 @@ int COM_FOpenFile (char *filename, FILE **file)
 		// is the element a pak file?
 		if (search->pack)
 		{
-			// look through all the pak file elements
 			pak = search->pack;
-			for (i=0 ; i<pak->numfiles ; i++)
+			if ((i = COM_FindPackFile(pak, filename)) == -1)
+				continue;
+
+			// found it!
+			packfile = &pak->files[i];
+			if (developer.value)
+				Sys_Printf ("PackFile: %s : %s\n", pak->filename, filename);
+
+			if (mapped && pak->mapped && packfile->filepos >= 0 && packfile->filelen >= 0
+				&& packfile->filelen <= pak->mappedsize - packfile->filepos)
+			{
+				*mapped = pak->mapped + packfile->filepos;
+			}
+			else
 			{
-				if (!strcmp(pak->files[i].name, filename))	// found it!
-				{
-					if (developer.value)
-						Sys_Printf ("PackFile: %s : %s\n", pak->filename, filename);
-					// open a new file on the pakfile
-					if (!(*file = fopen(pak->filename, "rb")))
-						Sys_Error ("Couldn't reopen %s", pak->filename);
-					fseek (*file, pak->files[i].filepos, SEEK_SET);
-					com_filesize = pak->files[i].filelen;
-
-					Q_snprintfz (com_netpath, sizeof(com_netpath), "%s#%i", pak->filename, i);
-					return com_filesize;
-				}
+				// open a new file on the pakfile
+				if (!(*file = fopen(pak->filename, "rb")))
+					Sys_Error ("Couldn't reopen %s", pak->filename);
+				fseek (*file, packfile->filepos, SEEK_SET);
 			}
+			com_filesize = packfile->filelen;
+
+			Q_snprintfz (com_netpath, sizeof(com_netpath), "%s#%i", pak->filename, i);
+			return com_filesize;
 		}
 		else
 		{               
@@ -1331,6 +1381,19 @@ int COM_FOpenFile (char *filename, FILE **file)
 	return -1;
 }
 
+/*
+=================
+COM_FOpenFile
+
+Finds the file in the search path.
+Sets com_filesize and one of handle or file
+=================
+*/
+int COM_FOpenFile (char *filename, FILE **file)
+{
+	return COM_OpenFile (filename, file, NULL);
+}
+
 /*
 =================
 COM_LoadFile
@@ -1346,15 +1409,15 @@ int             loadsize;
 byte *COM_LoadFile (char *path, int usehunk)
 {
 	FILE	*h;
-	byte	*buf;
+	byte	*buf, *mapped;
 	char	base[32];
 	int	len;
 
 	buf = NULL;     // quiet compiler warning
 
 	// look for it in the filesystem or pack files
-	len = COM_FOpenFile (path, &h);
-	if (!h)
+	len = COM_OpenFile (path, &h, &mapped);
+	if (!h && !mapped)
 		return NULL;
 
 	// extract the filename base name for hunk tag
@@ -1393,6 +1456,13 @@ byte *COM_LoadFile (char *path, int usehunk)
 		
 	((byte *)buf)[len] = 0;
 
+	// a mapped pak needs no disc icon, the copy only touches pages that are already cached
+	if (mapped)
+	{
+		memcpy (buf, mapped, len);
+		return buf;
+	}
+
 	Draw_BeginDisc ();
 	fread (buf, 1, len, h);
 	fclose (h);
@@ -1443,12 +1513,12 @@ pack_t *COM_LoadPackFile (char *packfile)
 {
 	dpackheader_t	header;
 	packfile_t	*newfiles;
-	int		i, numpackfiles;
+	int		i, key, numpackfiles, packsize;
 	pack_t		*pack;
 	FILE		*packhandle;
 	dpackfile_t	info[MAX_FILES_IN_PACK];
 
-	if (COM_FileOpenRead(packfile, &packhandle) == -1)
+	if ((packsize = COM_FileOpenRead(packfile, &packhandle)) == -1)
 		return NULL;
 
 	fread (&header, 1, sizeof(header), packhandle);
@@ -1480,6 +1550,23 @@ pack_t *COM_LoadPackFile (char *packfile)
 	pack->handle = packhandle;
 	pack->numfiles = numpackfiles;
 	pack->files = newfiles;
+
+	// hash the names, inserting backwards so each chain is in directory order
+	for (pack->hashsize = 1 ; pack->hashsize < numpackfiles ; pack->hashsize <<= 1)
+		;
+	pack->hashheads = Q_malloc ((pack->hashsize + numpackfiles) * sizeof(int));
+	pack->hashnext = pack->hashheads + pack->hashsize;
+	for (i=0 ; i<pack->hashsize ; i++)
+		pack->hashheads[i] = -1;
+	for (i=numpackfiles-1 ; i>=0 ; i--)
+	{
+		key = Q_strhash (newfiles[i].name, pack->hashsize);
+		pack->hashnext[i] = pack->hashheads[key];
+		pack->hashheads[key] = i;
+	}
+
+	pack->mapped = packsize <= MAX_MAPPED_PACK ? Sys_MapFile(packhandle, packsize) : NULL;
+	pack->mappedsize = pack->mapped ? packsize : 0;
 	
 	Con_Printf ("Added packfile %s (%i files)\n", packfile, numpackfiles);
 
@@ -1560,7 +1647,9 @@ void COM_SetGameDir (char *dir)
 	{
 		if (com_searchpaths->pack)
 		{
+			Sys_UnmapFile (com_searchpaths->pack->mapped, com_searchpaths->pack->mappedsize);
 			fclose (com_searchpaths->pack->handle);
+			free (com_searchpaths->pack->hashheads);
 			free (com_searchpaths->pack->files);
 			free (com_searchpaths->pack);
 		}
@@ -1725,6 +1814,24 @@ int Get_RNG_Index(void)
 	return rng_index;
 }
 
+void Get_RNG_State(rng_state_t *state)
+{
+	state->next = next;
+	state->frame_seed = frame_seed;
+	state->prev_index = prev_index;
+	state->rng_index = rng_index;
+	state->count = count;
+}
+
+void Set_RNG_State(const rng_state_t *state)
+{
+	next = state->next;
+	frame_seed = state->frame_seed;
+	prev_index = state->prev_index;
+	rng_index = state->rng_index;
+	count = state->count;
+}
+
 int tas_rand(void) // RAND_MAX assumed to be 32767
 {
 	++rng_index;
@@ -141,6 +141,12 @@ float MSG_ReadAngle16 (void);
 
 //============================================================================
 
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 #ifdef _WIN32
 
 #define	vsnprintf _vsnprintf
@@ -162,6 +168,7 @@ float Q_atof (char *str);
 
 void Q_strncpyz (char *dest, char *src, size_t size);
 void Q_snprintfz (char *dest, size_t size, char *fmt, ...);
+unsigned int Q_strhash (char *str, unsigned int size);
 
 //============================================================================
 
@@ -212,6 +219,11 @@ typedef struct pack_s
 	FILE	*handle;
 	int	numfiles;
 	packfile_t *files;
+	int	hashsize;
+	int	*hashheads;	// first file of each hash chain, -1 if empty
+	int	*hashnext;	// next file in the same chain, in directory order
+	byte	*mapped;	// read only view of the whole pak, NULL if it isn't mapped
+	int	mappedsize;
 } pack_t;
 
 typedef struct searchpath_s
@@ -241,7 +253,18 @@ extern	struct	cvar_s	registered;
 extern	int	rogue, hipnotic, nehahra, runequake;
 
 #ifndef DISABLE_CUSTOM_RAND
+typedef struct
+{
+	unsigned int	next;
+	unsigned int	frame_seed;
+	int		prev_index;
+	int		rng_index;
+	int		count;
+} rng_state_t;
+
 void Frame_RNG_Seed(void);
+void Get_RNG_State(rng_state_t *state);
+void Set_RNG_State(const rng_state_t *state);
 unsigned int Get_RNG_Seed(void);
 int Get_RNG_Count(void);
 int Get_RNG_Index(void);
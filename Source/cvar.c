@@ -23,9 +23,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 cvar_t	*cvar_vars;
 char	*cvar_null_string = "";
+int		cvar_generation;
 
 cvar_t	cvar_savevars = {"cvar_savevars", "0"};
 
+#define	CVAR_HASHPOOL_SIZE	256
+static	cvar_t	*cvar_hash[CVAR_HASHPOOL_SIZE];
+
 qboolean Cvar_Delete (char *name);
 
 /*
@@ -35,36 +39,31 @@ Cvar_FindVar
 */
 cvar_t *Cvar_FindVar (char *var_name)
 {
-	enum {CACHE_SIZE = 16};
-	static cvar_t* cached_vars[CACHE_SIZE] = {0};
-	static size_t next_cache_index = 0;
-	size_t i;
-	cvar_t	*var = NULL;
-
-	for(i=0; i < CACHE_SIZE; ++i) {
-		if(cached_vars[i] && !Q_strcasecmp(var_name, cached_vars[i]->name)) {
-			var = cached_vars[i];
-			break;
-		}
-	}
+	cvar_t	*var;
 
-	if(var == NULL) {
-		var = cvar_vars;
-		for (; var ; var = var->next)
-			if (!Q_strcasecmp(var_name, var->name))
-				goto end;
-		var = NULL;
-	}
+	for (var = cvar_hash[Q_strhash(var_name, CVAR_HASHPOOL_SIZE)] ; var ; var = var->hash_next)
+		if (!Q_strcasecmp(var_name, var->name))
+			return var;
 
-end:
-	if(var != NULL) {
-		cached_vars[next_cache_index] = var;
-		++next_cache_index;
-		if(next_cache_index == CACHE_SIZE)
-			next_cache_index = 0;
-	}
+	return NULL;
+}
+
+/*
+============
+Cvar_Link
+
+Adds a variable to the head of the variable list and its hash bucket, so
+lookups keep preferring the most recently linked variable
+============
+*/
+static void Cvar_Link (cvar_t *var)
+{
+	unsigned int	key = Q_strhash (var->name, CVAR_HASHPOOL_SIZE);
 
-	return var;
+	var->next = cvar_vars;
+	cvar_vars = var;
+	var->hash_next = cvar_hash[key];
+	cvar_hash[key] = var;
 }
 
 /*
@@ -337,8 +336,8 @@ void Cvar_Register (cvar_t *var)
 	var->value = Q_atof (var->string);
 
 // link the variable in
-	var->next = cvar_vars;
-	cvar_vars = var;
+	Cvar_Link (var);
+	cvar_generation++;
 }
 
 /*
@@ -424,14 +423,12 @@ cvar_t *Cvar_Create (char *name, char *string, int cvarflags)
 	v = (cvar_t *)Z_Malloc (sizeof(cvar_t));
 
 	// Cvar doesn't exist, so we create it
-	v->next = cvar_vars;
-	cvar_vars = v;
-
 	v->name = CopyString (name);
 	v->string = CopyString (string);
 	v->defaultvalue = CopyString (string);	
 	v->flags = cvarflags;
 	v->value = Q_atof (v->string);
+	Cvar_Link (v);
 
 	return v;
 }
@@ -445,33 +442,29 @@ returns true if the cvar was found (and deleted)
 */
 qboolean Cvar_Delete (char *name)
 {
-	cvar_t	*var, *prev;
+	cvar_t	*var, **link;
 
 	if (!(var = Cvar_FindVar(name)))
 		return false;
 
-	prev = NULL;
-	for (var = cvar_vars ; var ; var = var->next)
-	{
-		if (!Q_strcasecmp(var->name, name))
-		{
-			// unlink from cvar list
-			if (prev)
-				prev->next = var->next;
-			else
-				cvar_vars = var->next;
-
-			// free
-			Z_Free (var->defaultvalue);  
-			Z_Free (var->string);
-			Z_Free (var->name);
-			Z_Free (var);
-			return true;
-		}
-		prev = var;
-	}
+	// unlink from hash bucket
+	for (link = &cvar_hash[Q_strhash(name, CVAR_HASHPOOL_SIZE)] ; *link != var ; link = &(*link)->hash_next)
+		;
+	*link = var->hash_next;
+
+	// unlink from cvar list
+	for (link = &cvar_vars ; *link != var ; link = &(*link)->next)
+		;
+	*link = var->next;
 
-	return false;
+	// free
+	Z_Free (var->defaultvalue);
+	Z_Free (var->string);
+	Z_Free (var->name);
+	Z_Free (var);
+	cvar_generation++;
+
+	return true;
 }
 
 void Cvar_Set_f (void)
@@ -70,6 +70,7 @@ typedef struct cvar_s
 	float	value;
 	char	*defaultvalue;
 	struct cvar_s *next;
+	struct cvar_s *hash_next;	// next cvar in the same Cvar_FindVar bucket
 } cvar_t;
 
 // registers a cvar that allready has the name, string, and optionally the
@@ -113,3 +114,6 @@ cvar_t *Cvar_FindVar (char *var_name);
 void Cvar_Init (void);
 
 extern cvar_t	*cvar_vars;
+
+// bumped whenever a cvar is registered or deleted, so cached cvar_t pointers can be dropped
+extern int		cvar_generation;
@@ -143,6 +143,7 @@ typedef struct
 
 gltexture_t	gltextures[MAX_GLTEXTURES];
 int		numgltextures;
+int		gl_texturegeneration;		// bumped whenever a slot gets new contents
 
 int		currenttexture = -1;		// to avoid unnecessary texture sets
 
@@ -1650,6 +1651,7 @@ int GL_LoadTexture (char *identifier, int width, int height, byte *data, int mod
 				}
 				else
 				{
+					gl_texturegeneration++;
 					goto GL_LoadTexture_setup;	// reload the texture into the same slot
 				}
 			}
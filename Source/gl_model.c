@@ -31,6 +31,7 @@ void Mod_LoadAliasModel (model_t *mod, void *buffer);
 void Mod_LoadQ3Model (model_t *mod, void *buffer);
 void Mod_LoadSpriteModel (model_t *mod, void *buffer);
 void Mod_LoadBrushModel (model_t *mod, void *buffer);
+static void Mod_LoadBrushModelCached (model_t *mod, void *buffer);
 model_t *Mod_LoadModel (model_t *mod, qboolean crash);
 
 byte	mod_novis[MAX_MAP_LEAFS/8];
@@ -40,6 +41,9 @@ model_t	mod_known[MAX_MOD_KNOWN];
 int	mod_numknown;
 
 cvar_t	gl_subdivide_size = {"gl_subdivide_size", "128", CVAR_ARCHIVE};
+cvar_t	mod_bspcache = {"mod_bspcache", "1"};
+
+void Mod_BspCacheStats_f (void);
 
 qboolean OnChange_gl_picmip (cvar_t *var, char *string)
 {
@@ -87,6 +91,8 @@ Mod_Init
 void Mod_Init (void)
 {
 	Cvar_Register (&gl_subdivide_size);
+	Cvar_Register (&mod_bspcache);
+	Cmd_AddCommand ("mod_bspcache_stats", Mod_BspCacheStats_f);
 	memset (mod_novis, 0xff, sizeof(mod_novis));
 }
 
@@ -319,7 +325,7 @@ model_t *Mod_LoadModel (model_t *mod, qboolean crash)
 			break;
 
 		default:
-			Mod_LoadBrushModel (mod, buf);
+			Mod_LoadBrushModelCached (mod, buf);
 			break;
 	}
 
@@ -1104,6 +1110,90 @@ void Mod_LoadLeafs (lump_t *l)
 	}	
 }
 
+/*
+=================
+Mod_ClipnodeDepth
+
+Levels in the tree below num, more than MAX_FLAT_HULL_DEPTH if it is too
+deep or loops back on itself
+=================
+*/
+static int Mod_ClipnodeDepth (dclipnode_t *clipnodes, int count, int num, int level, short *depths)
+{
+	int	i, depth, deepest;
+
+	if (num < 0 || num >= count)
+		return 0;	// contents, or a bad node that the trace will complain about
+	if (level > MAX_FLAT_HULL_DEPTH || depths[num] == -1)
+		return MAX_FLAT_HULL_DEPTH + 1;
+	if (depths[num])
+		return depths[num];
+
+	depths[num] = -1;
+	deepest = 0;
+	for (i=0 ; i<2 ; i++)
+	{
+		depth = Mod_ClipnodeDepth (clipnodes, count, clipnodes[num].children[i], level + 1, depths);
+		deepest = max(deepest, depth);
+	}
+	depths[num] = min(deepest + 1, MAX_FLAT_HULL_DEPTH + 1);
+
+	return depths[num];
+}
+
+/*
+=================
+Mod_FlattenClipnodes
+
+Copies the planes into the clipnodes for SV_RecursiveHullCheck. Returns NULL
+if the tree can't be walked with a fixed size stack or FLAT_HULLS is off,
+those hulls keep using the clipnodes and planes directly
+=================
+*/
+static mclipnode_t *Mod_FlattenClipnodes (dclipnode_t *clipnodes, int count)
+{
+	int		i, deepest;
+	short		*depths;
+	mplane_t	*plane;
+	mclipnode_t	*out;
+
+	if (!FLAT_HULLS)
+		return NULL;
+
+	for (i=0 ; i<count ; i++)
+	{
+		if (clipnodes[i].planenum < 0 || clipnodes[i].planenum >= loadmodel->numplanes)
+			return NULL;
+	}
+
+	depths = Q_calloc (count, sizeof(*depths));
+	deepest = 0;
+	for (i=0 ; i<count ; i++)
+		deepest = max(deepest, Mod_ClipnodeDepth(clipnodes, count, i, 1, depths));
+	free (depths);
+
+	if (deepest > MAX_FLAT_HULL_DEPTH)
+	{
+		Con_DPrintf ("%s: clipnodes are too deep to flatten\n", loadmodel->name);
+		return NULL;
+	}
+
+	out = Hunk_AllocName (count * sizeof(*out), loadname);
+
+	for (i=0 ; i<count ; i++)
+	{
+		plane = loadmodel->planes + clipnodes[i].planenum;
+		VectorCopy (plane->normal, out[i].normal);
+		out[i].dist = plane->dist;
+		out[i].type = plane->type;
+		out[i].children[0] = clipnodes[i].children[0];
+		out[i].children[1] = clipnodes[i].children[1];
+		out[i].pad = 0;
+	}
+
+	return out;
+}
+
 /*
 =================
 Mod_LoadClipnodes
@@ -1155,6 +1245,8 @@ void Mod_LoadClipnodes (lump_t *l)
 		out->children[0] = LittleShort(in->children[0]);
 		out->children[1] = LittleShort(in->children[1]);
 	}
+
+	loadmodel->hulls[1].flatnodes = loadmodel->hulls[2].flatnodes = Mod_FlattenClipnodes (loadmodel->clipnodes, count);
 }
 
 /*
@@ -1194,6 +1286,8 @@ void Mod_MakeHull0 (void)
 				out->children[j] = child - loadmodel->nodes;
 		}
 	}
+
+	hull->flatnodes = Mod_FlattenClipnodes (hull->clipnodes, count);
 }
 
 /*
@@ -1386,6 +1480,268 @@ void Mod_LoadBrushModel (model_t *mod, void *buffer)
 	}
 }
 
+/*
+==============================================================================
+
+								BRUSH MODEL CACHE
+
+Reconnecting to the same map loads the same world bsp into the same place in
+the hunk, so the loaded blocks are kept and copied back instead of loading
+the lumps again. The pointers inside are absolute, so a copy is only used
+when the hunk low mark is where it was. Only world models are kept, the
+small bsp items would just push them out
+==============================================================================
+*/
+
+#define	MAX_CACHED_BSPS	4
+
+typedef struct
+{
+	char		name[MAX_QPATH];
+	int		filesize;
+	unsigned int	checksum;
+	int		texturegeneration;	// texture numbers are only valid while no slot was reloaded
+	float		subdivide_size;		// warp polygons are cut up at load time
+	int		hunkmark;
+	int		hunksize;
+	byte		*hunkdata;
+	int		nummodels;
+	model_t		*models;		// the model followed by its submodels *1 to *n
+	int		lastused;
+} bspcache_t;
+
+static	bspcache_t	mod_bspcache_entries[MAX_CACHED_BSPS];
+static	int		mod_bspcache_sequence;
+
+static	int		mod_bspload_count, mod_bsprestore_count;
+static	double		mod_bspload_time, mod_bsprestore_time;
+
+/*
+=================
+Mod_BspChecksum
+=================
+*/
+static unsigned int Mod_BspChecksum (byte *data, int size)
+{
+	int		i;
+	unsigned int	hash = 2166136261u;
+
+	for (i = 0 ; i < size ; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+=================
+Mod_FreeCachedBsp
+=================
+*/
+static void Mod_FreeCachedBsp (bspcache_t *entry)
+{
+	free (entry->hunkdata);
+	free (entry->models);
+	memset (entry, 0, sizeof(*entry));
+}
+
+/*
+=================
+Mod_RestoreCachedBsp
+
+Copies the blocks back to the hunk and the model_t of the model and its
+submodels back to mod_known
+=================
+*/
+static qboolean Mod_RestoreCachedBsp (model_t *mod, bspcache_t *entry)
+{
+	int		i;
+	model_t	*sub;
+
+	if (entry->texturegeneration != gl_texturegeneration || entry->subdivide_size != gl_subdivide_size.value)
+		return false;
+	if (!Hunk_RestoreLow(entry->hunkmark, entry->hunkdata, entry->hunksize))
+		return false;
+
+	*mod = entry->models[0];
+	for (i = 1 ; i < entry->nummodels ; i++)
+	{
+		sub = Mod_FindName (va("*%i", i));
+		*sub = entry->models[i];
+	}
+
+	entry->lastused = ++mod_bspcache_sequence;
+
+	return true;
+}
+
+/*
+=================
+Mod_StoreCachedBsp
+
+Keeps the blocks the load put on the hunk since mark, replacing the least
+recently used entry
+=================
+*/
+static void Mod_StoreCachedBsp (model_t *mod, int mark, int filesize, unsigned int checksum)
+{
+	int		i;
+	bspcache_t	*entry;
+
+	entry = &mod_bspcache_entries[0];
+	for (i = 0 ; i < MAX_CACHED_BSPS ; i++)
+	{
+		if (!strcmp(mod_bspcache_entries[i].name, mod->name))
+		{
+			entry = &mod_bspcache_entries[i];
+			break;
+		}
+		if (mod_bspcache_entries[i].lastused < entry->lastused)
+			entry = &mod_bspcache_entries[i];
+	}
+	Mod_FreeCachedBsp (entry);
+
+	entry->hunksize = Hunk_LowMark () - mark;
+	entry->nummodels = max(mod->numsubmodels, 1);
+	if (!(entry->hunkdata = malloc(entry->hunksize)) || !(entry->models = malloc(entry->nummodels * sizeof(model_t))))
+	{
+		Mod_FreeCachedBsp (entry);
+		return;
+	}
+
+	Q_strncpyz (entry->name, mod->name, sizeof(entry->name));
+	entry->filesize = filesize;
+	entry->checksum = checksum;
+	entry->texturegeneration = gl_texturegeneration;
+	entry->subdivide_size = gl_subdivide_size.value;
+	entry->hunkmark = mark;
+	Hunk_SaveLow (mark, entry->hunkdata, entry->hunksize);
+	entry->lastused = ++mod_bspcache_sequence;
+
+	entry->models[0] = *mod;
+	for (i = 1 ; i < entry->nummodels ; i++)
+		entry->models[i] = *Mod_FindName (va("*%i", i));
+}
+
+/*
+=================
+Mod_InitCachedSky
+
+The sky textures are global, so a restored model sets them up again from
+the file
+=================
+*/
+static void Mod_InitCachedSky (void *buffer)
+{
+	int		i, j, nummiptex, dataofs;
+	dheader_t	*header;
+	dmiptexlump_t	*m;
+	miptex_t	*mt;
+
+	header = (dheader_t *)buffer;
+	if (!LittleLong(header->lumps[LUMP_TEXTURES].filelen))
+		return;
+
+	m = (dmiptexlump_t *)((byte *)buffer + LittleLong(header->lumps[LUMP_TEXTURES].fileofs));
+	nummiptex = LittleLong (m->nummiptex);
+
+	for (i = 0 ; i < nummiptex ; i++)
+	{
+		if ((dataofs = LittleLong(m->dataofs[i])) == -1)
+			continue;
+
+		mt = (miptex_t *)((byte *)m + dataofs);
+		if (!ISSKYTEX(mt->name))
+			continue;
+
+		mt->width = LittleLong (mt->width);
+		mt->height = LittleLong (mt->height);
+		for (j = 0 ; j < MIPLEVELS ; j++)
+			mt->offsets[j] = LittleLong (mt->offsets[j]);
+		R_InitSky (mt);
+	}
+}
+
+/*
+=================
+Mod_LoadBrushModelCached
+=================
+*/
+static void Mod_LoadBrushModelCached (model_t *mod, void *buffer)
+{
+	int		i, mark, filesize;
+	unsigned int	checksum;
+	double		start;
+	bspcache_t	*entry;
+
+	if (strcmp(mod->name, va("maps/%s.bsp", cl_mapname.string)))
+	{
+		Mod_LoadBrushModel (mod, buffer);
+		return;
+	}
+
+	start = Sys_DoubleTime ();
+	filesize = com_filesize;
+	checksum = 0;
+
+	if (mod_bspcache.value)
+	{
+		checksum = Mod_BspChecksum (buffer, filesize);
+
+		for (i = 0, entry = mod_bspcache_entries ; i < MAX_CACHED_BSPS ; i++, entry++)
+		{
+			if (!entry->hunkdata || strcmp(entry->name, mod->name) || entry->filesize != filesize || entry->checksum != checksum)
+				continue;
+
+			if (!Mod_RestoreCachedBsp(mod, entry))
+				break;
+
+			Mod_InitCachedSky (buffer);
+			mod_bsprestore_time += Sys_DoubleTime () - start;
+			mod_bsprestore_count++;
+			return;
+		}
+	}
+
+	mark = Hunk_LowMark ();
+	Mod_LoadBrushModel (mod, buffer);
+	if (mod_bspcache.value)
+		Mod_StoreCachedBsp (mod, mark, filesize, checksum);
+	mod_bspload_time += Sys_DoubleTime () - start;
+	mod_bspload_count++;
+}
+
+/*
+=================
+Mod_BspCacheStats_f
+
+Average world model load times with and without the cache, compare a few
+reconnects with mod_bspcache 0 and 1
+=================
+*/
+void Mod_BspCacheStats_f (void)
+{
+	int	i;
+
+	if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset"))
+	{
+		mod_bspload_count = mod_bsprestore_count = 0;
+		mod_bspload_time = mod_bsprestore_time = 0;
+		return;
+	}
+
+	Con_Printf ("%i loaded from file, %.2f ms average\n", mod_bspload_count,
+		mod_bspload_count ? mod_bspload_time * 1000 / mod_bspload_count : 0);
+	Con_Printf ("%i restored from cache, %.2f ms average\n", mod_bsprestore_count,
+		mod_bsprestore_count ? mod_bsprestore_time * 1000 / mod_bsprestore_count : 0);
+
+	for (i = 0 ; i < MAX_CACHED_BSPS ; i++)
+		if (mod_bspcache_entries[i].hunkdata)
+			Con_Printf ("%s: %i kb\n", mod_bspcache_entries[i].name, mod_bspcache_entries[i].hunksize / 1024);
+}
+
 /*
 ==============================================================================
 
@@ -180,6 +180,28 @@ typedef struct mleaf_s
 	byte		ambient_sound_level[NUM_AMBIENTS];
 } mleaf_t;
 
+// clipnode with its plane copied in, so each step of a trace reads one node
+typedef struct
+{
+	vec3_t		normal;
+	float		dist;
+	int			type;
+	int			children[2];	// same values as the dclipnode_t, negative numbers are contents
+	int			pad;
+} mclipnode_t;
+
+// deepest clipnode tree that gets a flattened copy, traces keep one stack entry per level
+#define	MAX_FLAT_HULL_DEPTH	256
+
+// optimized x87 builds round intermediates wherever the register allocator
+// spills them, so a second walk can't follow the original bit for bit. Those
+// builds keep tracing through the clipnodes and planes.
+#if defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ != 0 && defined(__OPTIMIZE__)
+#define	FLAT_HULLS	0
+#else
+#define	FLAT_HULLS	1
+#endif
+
 // !!! if this is changed, it must be changed in asm_i386.h too !!!
 typedef struct
 {
@@ -189,6 +211,7 @@ typedef struct
 	int			lastclipnode;
 	vec3_t		clip_mins;
 	vec3_t		clip_maxs;
+	mclipnode_t	*flatnodes;		// NULL if the hull is traced through clipnodes and planes
 } hull_t;
 
 /*
@@ -39,6 +39,7 @@ void GL_BeginRendering (int *x, int *y, int *width, int *height);
 void GL_EndRendering (void);
 
 extern	int	texture_extension_number;
+extern	int	gl_texturegeneration;
 extern	float	gldepthmin, gldepthmax;
 extern	byte	color_white[4], color_black[4];
 
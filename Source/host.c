@@ -54,7 +54,7 @@ int		host_hunklevel;
 
 int		minimum_memory;
 
-client_t	*host_client;			// current client
+THREAD_LOCAL client_t	*host_client;	// current client
 
 jmp_buf 	host_abortserver;
 
@@ -649,6 +649,7 @@ void Host_ServerFrame (double time)
 }
 
 qboolean physframe;
+qboolean host_fastforward;	// a TAS script is skipping, output is left out
 double	physframetime;
 
 /*
@@ -703,16 +704,22 @@ void _Host_Frame (double time)
 		}	
 	}
 
+	host_fastforward = TAS_Fast_Forward();
+
 #ifdef INDEPENDENTPHYSICS
 	if (!cl_independentphysics.value)
 	{
 #endif
 
-		// get new key events
-		Sys_SendKeyEvents ();
+		// only poll input occasionally while a script is fast-forwarding
+		if (!host_fastforward || !(host_framecount & 63))
+		{
+			// get new key events
+			Sys_SendKeyEvents ();
 
-		// allow mice or other external controllers to add commands
-		IN_Commands ();
+			// allow mice or other external controllers to add commands
+			IN_Commands ();
+		}
 
 		// process console commands
 		Cbuf_Execute ();
@@ -811,18 +818,25 @@ void _Host_Frame (double time)
 	}
 #endif
 
+	_Host_Frame_Before_Render_Hook();
+
 	if (host_speeds.value)
 		time1 = Sys_DoubleTime ();
 
 	// update video
-	SCR_UpdateScreen ();
+	if (!host_fastforward)
+		SCR_UpdateScreen ();
 
 	if (host_speeds.value)
 		time2 = Sys_DoubleTime ();
 
 	if (tas_gamestate == unpaused)
 	{
-		if (cls.signon == SIGNONS)
+		if (host_fastforward)
+		{
+			// skipped frames are never seen or heard
+		}
+		else if (cls.signon == SIGNONS)
 		{
 			// update audio
 			S_Update (r_origin, vpn, vright, vup);
@@ -833,7 +847,8 @@ void _Host_Frame (double time)
 			S_Update (vec3_origin, vec3_origin, vec3_origin, vec3_origin);
 		}
 
-		CDAudio_Update ();
+		if (!host_fastforward)
+			CDAudio_Update ();
 
 		if (host_speeds.value)
 		{
@@ -474,6 +474,101 @@ void Host_SavegameComment (char *text)
 	text[SAVEGAME_COMMENT_LENGTH] = '\0';
 }
 
+#define	SAVEGAME_SNAPSHOT_IDENT	(('1'<<24) + ('P'<<16) + ('N'<<8) + 'S')
+
+typedef struct
+{
+	int	textsize;		// the text part of the save before the snapshot
+	int	textcrc;
+	int	size;
+	int	ident;
+} savesnapshot_t;
+
+/*
+===============
+Host_WriteSavegameSnapshot
+
+Appends a binary snapshot of the edicts and globals to the text save. It
+starts with a 0 byte, which ends the edict parsing of loaders that don't
+know about it, and the footer ties it to the text it was written with
+===============
+*/
+static void Host_WriteSavegameSnapshot (char *name)
+{
+	FILE		*f;
+	byte		*buf;
+	savesnapshot_t	footer;
+
+	if (!(f = fopen(name, "rb")))
+		return;
+
+	footer.textsize = COM_FileLength (f);
+	footer.size = ED_SaveSnapshot (NULL, 0);
+	footer.ident = SAVEGAME_SNAPSHOT_IDENT;
+	buf = Q_malloc (max(footer.textsize, footer.size));
+	if (fread(buf, 1, footer.textsize, f) != footer.textsize)
+	{
+		fclose (f);
+		free (buf);
+		return;
+	}
+	fclose (f);
+
+	footer.textcrc = CRC_Block (buf, footer.textsize);
+	ED_SaveSnapshot (buf, footer.size);
+
+	if ((f = fopen(name, "ab")))
+	{
+		fputc (0, f);
+		fwrite (buf, 1, footer.size, f);
+		fwrite (&footer, 1, sizeof(footer), f);
+		fclose (f);
+	}
+	free (buf);
+}
+
+/*
+===============
+Host_LoadSavegameSnapshot
+
+Restores the edicts and globals from the snapshot after the text, false if
+there is none or it doesn't match the text or the progs
+===============
+*/
+static qboolean Host_LoadSavegameSnapshot (char *name)
+{
+	FILE		*f;
+	byte		*buf;
+	int		len;
+	qboolean	loaded;
+	savesnapshot_t	footer;
+
+	if (!(f = fopen(name, "rb")))
+		return false;
+
+	loaded = false;
+	len = COM_FileLength (f);
+	if (len < sizeof(footer))
+	{
+		fclose (f);
+		return false;
+	}
+
+	buf = Q_malloc (len);
+	if (fread(buf, 1, len, f) == len)
+	{
+		memcpy (&footer, buf + len - sizeof(footer), sizeof(footer));
+		if (footer.ident == SAVEGAME_SNAPSHOT_IDENT && footer.textsize >= 0 && footer.size >= 0
+			&& footer.textsize + 1 + footer.size + sizeof(footer) == len && !buf[footer.textsize]
+			&& CRC_Block(buf, footer.textsize) == footer.textcrc)
+			loaded = ED_LoadSnapshot (buf + footer.textsize + 1, footer.size);
+	}
+	fclose (f);
+	free (buf);
+
+	return loaded;
+}
+
 /*
 ===============
 Host_Savegame_f
@@ -565,6 +660,7 @@ void Host_Savegame_f (void)
 		fflush (f);
 	}
 	fclose (f);
+	Host_WriteSavegameSnapshot (name);
 	Con_Printf ("done.\n");
 }
 
@@ -579,6 +675,7 @@ void Host_Loadgame_f (void)
 	float	tfloat, spawn_parms[NUM_SPAWN_PARMS];
 	double time;
 	int	i, r, entnum, version;
+	qboolean	snapshot;
 	edict_t	*ent;
 	FILE	*f;
 
@@ -647,9 +744,12 @@ void Host_Loadgame_f (void)
 		strcpy (sv.lightstyles[i], str);
 	}
 
+// the binary snapshot is exact, the text is for saves without one
+	snapshot = Host_LoadSavegameSnapshot (name);
+
 // load the edicts out of the savegame file
 	entnum = -1;		// -1 is the globals
-	while (!feof(f))
+	while (!snapshot && !feof(f))
 	{
 		for (i=0 ; i<sizeof(str)-1 ; i++)
 		{
@@ -692,7 +792,8 @@ void Host_Loadgame_f (void)
 		entnum++;
 	}
 
-	sv.num_edicts = entnum;
+	if (!snapshot)
+		sv.num_edicts = entnum;
 	sv.time = time;
 
 	fclose (f);
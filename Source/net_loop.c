@@ -236,6 +236,29 @@ qboolean Loop_CanSendUnreliableMessage (qsocket_t *sock)
 }
 
 
+/*
+==================
+Loop_Flush
+
+Drops the messages in flight in both directions, used when the game state
+is swapped out from under the connection
+==================
+*/
+void Loop_Flush (void)
+{
+	if (loop_client)
+	{
+		loop_client->receiveMessageLength = 0;
+		loop_client->canSend = true;
+	}
+	if (loop_server)
+	{
+		loop_server->receiveMessageLength = 0;
+		loop_server->canSend = true;
+	}
+}
+
+
 void Loop_Close (qsocket_t *sock)
 {
 	if (sock->driverdata)
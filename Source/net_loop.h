@@ -30,4 +30,5 @@ int			Loop_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data);
 qboolean	Loop_CanSendMessage (qsocket_t *sock);
 qboolean	Loop_CanSendUnreliableMessage (qsocket_t *sock);
 void		Loop_Close (qsocket_t *sock);
+void		Loop_Flush (void);
 void		Loop_Shutdown (void);
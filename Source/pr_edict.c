@@ -697,6 +697,333 @@ void ED_ParseGlobals (char *data)
 	}
 }
 
+/*
+==============================================================================
+
+BINARY SNAPSHOTS
+
+The edicts and globals are copied as they are. Strings that are not in the
+progs string table were allocated at run time and their offsets are only
+valid in this server instance, so they are written out with the snapshot
+and string values refer to them by -(index + 1)
+==============================================================================
+*/
+
+#define	EDSNAPSHOT_IDENT	(('1'<<24) + ('S'<<16) + ('D'<<8) + 'E')
+
+typedef struct
+{
+	int	ident;
+	int	crc;			// of the progs the values belong to
+	int	numglobals;
+	int	entityfields;
+	int	num_edicts;
+	int	numstrings;		// run time strings after the edicts
+	int	stringsize;
+} edsnapshot_t;
+
+typedef struct
+{
+	int	*globalstrings, numglobalstrings;	// offsets of the string globals
+	int	*fieldstrings, numfieldstrings;		// offsets of the string fields
+	int	*hash, hashsize;			// run time string offset -> index + 1
+	int	*offsets, numstrings;			// run time string offsets in snapshot order
+	int	stringsize;
+} edsnapshotstrings_t;
+
+/*
+=============
+ED_StringOffsets
+=============
+*/
+static int ED_StringOffsets (ddef_t *defs, int numdefs, int *ofs)
+{
+	int	i, count;
+
+	for (i = count = 0 ; i < numdefs ; i++)
+		if ((defs[i].type & ~DEF_SAVEGLOBAL) == ev_string)
+			ofs[count++] = defs[i].ofs;
+
+	return count;
+}
+
+/*
+=============
+ED_InitSnapshotStrings
+=============
+*/
+static void ED_InitSnapshotStrings (edsnapshotstrings_t *strings, int num_edicts)
+{
+	int	maxstrings;
+
+	memset (strings, 0, sizeof(*strings));
+	strings->globalstrings = Q_malloc ((progs->numglobaldefs + 1) * sizeof(int));
+	strings->fieldstrings = Q_malloc ((progs->numfielddefs + 1) * sizeof(int));
+	strings->numglobalstrings = ED_StringOffsets (pr_globaldefs, progs->numglobaldefs, strings->globalstrings);
+	strings->numfieldstrings = ED_StringOffsets (pr_fielddefs, progs->numfielddefs, strings->fieldstrings);
+
+	maxstrings = strings->numglobalstrings + strings->numfieldstrings * num_edicts;
+	for (strings->hashsize = 16 ; strings->hashsize < maxstrings * 2 ; strings->hashsize <<= 1)
+		;
+	strings->hash = Q_malloc (strings->hashsize * sizeof(int));
+	memset (strings->hash, 0, strings->hashsize * sizeof(int));
+	strings->offsets = Q_malloc ((maxstrings + 1) * sizeof(int));
+}
+
+/*
+=============
+ED_FreeSnapshotStrings
+=============
+*/
+static void ED_FreeSnapshotStrings (edsnapshotstrings_t *strings)
+{
+	free (strings->globalstrings);
+	free (strings->fieldstrings);
+	free (strings->hash);
+	free (strings->offsets);
+}
+
+/*
+=============
+ED_SnapshotString
+
+Returns the value a string is stored with, run time strings get an index
+the first time they are seen
+=============
+*/
+static int ED_SnapshotString (edsnapshotstrings_t *strings, int s)
+{
+	unsigned int	key;
+
+	if (s >= 0 && s < progs->numstrings)
+		return s;
+
+	for (key = ((unsigned int)s * 2654435761u) & (strings->hashsize - 1) ; strings->hash[key] ; key = (key + 1) & (strings->hashsize - 1))
+		if (strings->offsets[strings->hash[key] - 1] == s)
+			return -strings->hash[key];
+
+	strings->offsets[strings->numstrings] = s;
+	strings->stringsize += strlen (pr_strings + s) + 1;
+	strings->hash[key] = ++strings->numstrings;
+
+	return -strings->numstrings;
+}
+
+/*
+=============
+ED_SaveSnapshot
+
+Returns the size of the snapshot. Nothing is written when it is larger
+than maxsize, so a call with maxsize 0 tells how much to allocate
+=============
+*/
+int ED_SaveSnapshot (byte *dest, int maxsize)
+{
+	int			i, j, size, *v;
+	edict_t			*ent;
+	edsnapshot_t		header;
+	edsnapshotstrings_t	strings;
+
+	ED_InitSnapshotStrings (&strings, sv.num_edicts);
+
+	// number the run time strings in the order they are written
+	for (i = 0 ; i < strings.numglobalstrings ; i++)
+		ED_SnapshotString (&strings, ((int *)pr_globals)[strings.globalstrings[i]]);
+	for (i = 0 ; i < sv.num_edicts ; i++)
+	{
+		v = (int *)&EDICT_NUM(i)->v;
+		for (j = 0 ; j < strings.numfieldstrings ; j++)
+			ED_SnapshotString (&strings, v[strings.fieldstrings[j]]);
+	}
+
+	size = sizeof(header) + progs->numglobals * 4 + sv.num_edicts * (8 + progs->entityfields * 4) + strings.stringsize;
+	if (size > maxsize)
+	{
+		ED_FreeSnapshotStrings (&strings);
+		return size;
+	}
+
+	header.ident = EDSNAPSHOT_IDENT;
+	header.crc = pr_crc;
+	header.numglobals = progs->numglobals;
+	header.entityfields = progs->entityfields;
+	header.num_edicts = sv.num_edicts;
+	header.numstrings = strings.numstrings;
+	header.stringsize = strings.stringsize;
+	memcpy (dest, &header, sizeof(header));
+	dest += sizeof(header);
+
+	memcpy (dest, pr_globals, progs->numglobals * 4);
+	for (i = 0 ; i < strings.numglobalstrings ; i++)
+		((int *)dest)[strings.globalstrings[i]] = ED_SnapshotString (&strings, ((int *)pr_globals)[strings.globalstrings[i]]);
+	dest += progs->numglobals * 4;
+
+	for (i = 0 ; i < sv.num_edicts ; i++)
+	{
+		ent = EDICT_NUM(i);
+		((int *)dest)[0] = ent->free;
+		((float *)dest)[1] = ent->freetime;
+		v = (int *)(dest + 8);
+		memcpy (v, &ent->v, progs->entityfields * 4);
+		for (j = 0 ; j < strings.numfieldstrings ; j++)
+			v[strings.fieldstrings[j]] = ED_SnapshotString (&strings, v[strings.fieldstrings[j]]);
+		dest += 8 + progs->entityfields * 4;
+	}
+
+	for (i = 0 ; i < strings.numstrings ; i++)
+	{
+		j = strlen (pr_strings + strings.offsets[i]) + 1;
+		memcpy (dest, pr_strings + strings.offsets[i], j);
+		dest += j;
+	}
+
+	ED_FreeSnapshotStrings (&strings);
+
+	return size;
+}
+
+/*
+=============
+ED_CheckSnapshotStrings
+=============
+*/
+static qboolean ED_CheckSnapshotStrings (int *v, int *ofs, int count, int numstrings)
+{
+	int	i, s;
+
+	for (i = 0 ; i < count ; i++)
+	{
+		s = v[ofs[i]];
+		if (s >= progs->numstrings || s < -numstrings)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+=============
+ED_RemapSnapshotStrings
+=============
+*/
+static void ED_RemapSnapshotStrings (int *dest, int *src, int *ofs, int count, int *offsets)
+{
+	int	i, s;
+
+	for (i = 0 ; i < count ; i++)
+	{
+		s = src[ofs[i]];
+		dest[ofs[i]] = (s < 0) ? offsets[-s - 1] : s;
+	}
+}
+
+/*
+=============
+ED_LoadSnapshot
+
+Replaces the edicts and globals with a snapshot from ED_SaveSnapshot and
+links the edicts again. Returns false without changing anything if the
+snapshot is damaged or was made with other progs. The run time strings are
+copied to the hunk like ED_NewString does
+=============
+*/
+qboolean ED_LoadSnapshot (byte *src, int size)
+{
+	int			i, pos, count, num_edicts, edictsize, *v, *offsets;
+	char			*text;
+	edict_t			*ent;
+	edsnapshot_t		header;
+	edsnapshotstrings_t	strings;
+	byte			*globals, *edicts, *table;
+
+	if (size < sizeof(header))
+		return false;
+	memcpy (&header, src, sizeof(header));
+
+	edictsize = 8 + progs->entityfields * 4;
+	if (header.ident != EDSNAPSHOT_IDENT || header.crc != pr_crc || header.numglobals != progs->numglobals
+		|| header.entityfields != progs->entityfields || header.num_edicts < 1 || header.num_edicts > sv.max_edicts
+		|| header.numstrings < 0 || header.stringsize < header.numstrings
+		|| size != sizeof(header) + header.numglobals * 4 + header.num_edicts * edictsize + header.stringsize)
+		return false;
+
+	globals = src + sizeof(header);
+	edicts = globals + header.numglobals * 4;
+	table = edicts + header.num_edicts * edictsize;
+
+	// the strings have to end where the snapshot does
+	for (pos = count = 0 ; pos < header.stringsize ; pos++)
+		if (!table[pos])
+			count++;
+	if (count != header.numstrings || (header.stringsize && table[header.stringsize - 1]))
+		return false;
+
+	ED_InitSnapshotStrings (&strings, 0);
+	if (!ED_CheckSnapshotStrings((int *)globals, strings.globalstrings, strings.numglobalstrings, header.numstrings))
+	{
+		ED_FreeSnapshotStrings (&strings);
+		return false;
+	}
+	for (i = 0 ; i < header.num_edicts ; i++)
+	{
+		if (!ED_CheckSnapshotStrings((int *)(edicts + i * edictsize + 8), strings.fieldstrings, strings.numfieldstrings, header.numstrings))
+		{
+			ED_FreeSnapshotStrings (&strings);
+			return false;
+		}
+	}
+
+	offsets = Q_malloc ((header.numstrings + 1) * sizeof(int));
+	if (header.stringsize)
+	{
+		text = Hunk_AllocName (header.stringsize, "snapshot");
+		memcpy (text, table, header.stringsize);
+		for (i = pos = 0 ; i < header.numstrings ; i++)
+		{
+			offsets[i] = text + pos - pr_strings;
+			pos += strlen (text + pos) + 1;
+		}
+	}
+
+	num_edicts = max(sv.num_edicts, header.num_edicts);
+	for (i = 0 ; i < num_edicts ; i++)
+		SV_UnlinkEdict (EDICT_NUM(i));
+
+	memcpy (pr_globals, globals, header.numglobals * 4);
+	ED_RemapSnapshotStrings ((int *)pr_globals, (int *)globals, strings.globalstrings, strings.numglobalstrings, offsets);
+
+	for (i = 0 ; i < num_edicts ; i++)
+	{
+		ent = EDICT_NUM(i);
+		if (i >= header.num_edicts)
+		{
+			memset (&ent->v, 0, progs->entityfields * 4);
+			ent->free = true;
+			ent->freetime = 0;
+			continue;
+		}
+
+		v = (int *)(edicts + i * edictsize);
+		ent->free = v[0];
+		ent->freetime = ((float *)v)[1];
+		memcpy (&ent->v, v + 2, progs->entityfields * 4);
+		ED_RemapSnapshotStrings ((int *)&ent->v, v + 2, strings.fieldstrings, strings.numfieldstrings, offsets);
+	}
+
+	sv.num_edicts = header.num_edicts;
+	for (i = 0 ; i < sv.num_edicts ; i++)
+	{
+		ent = EDICT_NUM(i);
+		if (!ent->free)
+			SV_LinkEdict (ent, false);
+	}
+
+	free (offsets);
+	ED_FreeSnapshotStrings (&strings);
+
+	return true;
+}
+
 //============================================================================
 
 
@@ -92,6 +92,10 @@ char *ED_ParseEdict (char *data, edict_t *ent);
 void ED_WriteGlobals (FILE *f);
 void ED_ParseGlobals (char *data);
 
+int ED_SaveSnapshot (byte *dest, int maxsize);
+qboolean ED_LoadSnapshot (byte *src, int size);
+// binary copy of the edicts and globals, the load fails if the progs differ
+
 void ED_LoadFromFile (char *data);
 
 //define EDICT_NUM(n) ((edict_t *)(sv.edicts + (n)*pr_edict_size))
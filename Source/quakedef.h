@@ -262,6 +262,7 @@ extern	double	host_frametime;
 extern	byte	*host_basepal;
 extern	byte	*host_colormap;
 extern	int	host_framecount;	// incremented every frame, never reset
+extern	qboolean	host_fastforward;	// a TAS script is skipping to its pause frame
 extern	double	realtime;		// not bounded in any way, changed at
 					// start of every frame, never reset
 
@@ -200,15 +200,15 @@ extern	cvar_t	sv_aim;
 extern	server_static_t	svs;			// persistant server info
 extern	server_t	sv;			// local server
 
-extern	client_t	*host_client;
+extern	THREAD_LOCAL client_t	*host_client;
 
 extern	jmp_buf 	host_abortserver;
 
 extern	double		host_time;
 
-extern	edict_t		*sv_player;
+extern	THREAD_LOCAL edict_t	*sv_player;
 extern tas_state tas_gamestate;
-extern qboolean simulating;
+extern THREAD_LOCAL qboolean simulating;
 
 //===========================================================
 
@@ -229,6 +229,7 @@ void SV_SetIdealPitch (void);
 void SV_AddUpdates (void);
 
 void SV_ClientThink (void);
+void SV_ClientThinkTime (double time);
 void SV_AddClientToServer (struct qsocket_s *ret);
 
 void SV_ClientPrintf (char *fmt, ...);
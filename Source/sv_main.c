@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // sv_main.c -- server main program
 
 #include "quakedef.h"
+#include "tas/hooks.h"
 
 server_t	sv;
 server_static_t	svs;
@@ -712,7 +713,10 @@ qboolean SV_SendClientDatagram (client_t *client)
 // add the client specific data to the datagram
 	SV_WriteClientdataToMessage (client->edict, &msg);
 
-	SV_WriteEntitiesToClient (client->edict, &msg, client->nomap);
+// nobody sees the entities while a TAS script skips; the frame before the
+// pause sends them all again, so the client is in sync when it stops
+	if (!host_fastforward)
+		SV_WriteEntitiesToClient (client->edict, &msg, client->nomap);
 
 // copy the server datagram if there is space
 	if (msg.cursize + sv.datagram.cursize < msg.maxsize)
@@ -1179,5 +1183,7 @@ void SV_SpawnServer (char *server)
 // an "empty" frame in which temporary entity updates gets screwed up
 	CL_ClearTEnts ();
 
+	SV_SpawnServer_Hook ();
+
 	Con_DPrintf ("Server spawned\n");
 }
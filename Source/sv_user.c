@@ -21,25 +21,28 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
-edict_t	*sv_player;
+// the TAS optimizer simulates moves on worker threads, so the move state is per thread
+THREAD_LOCAL edict_t	*sv_player;
 tas_state tas_gamestate;
-qboolean simulating = false;
+THREAD_LOCAL qboolean simulating = false;
 
 cvar_t	sv_edgefriction = {"edgefriction", "2"};
 
-static	vec3_t	forward, right, up;
+static	THREAD_LOCAL vec3_t	forward, right, up;
 
-vec3_t	wishdir;
-float	wishspeed;
+THREAD_LOCAL vec3_t	wishdir;
+THREAD_LOCAL float	wishspeed;
 
 // world
-float	*angles;
-float	*origin;
-float	*velocity;
+THREAD_LOCAL float	*angles;
+THREAD_LOCAL float	*origin;
+THREAD_LOCAL float	*velocity;
 
-qboolean	onground;
+THREAD_LOCAL qboolean	onground;
 
-usercmd_t	cmd;
+THREAD_LOCAL usercmd_t	cmd;
+
+static	THREAD_LOCAL double	thinktime;	// sv.time, or the simulated time
 
 cvar_t	sv_idealpitchscale = {"sv_idealpitchscale", "0.8"};
 
@@ -278,7 +281,7 @@ void SV_WaterMove (void)
 
 void SV_WaterJump (void)
 {
-	if (sv.time > sv_player->v.teleport_time || !sv_player->v.waterlevel)
+	if (thinktime > sv_player->v.teleport_time || !sv_player->v.waterlevel)
 	{
 		sv_player->v.flags = (int)sv_player->v.flags & ~FL_WATERJUMP;
 		sv_player->v.teleport_time = 0;
@@ -304,7 +307,7 @@ void SV_AirMove (void)
 	smove = cmd.sidemove;
 	
 // hack to not let you back into teleporter
-	if (sv.time < sv_player->v.teleport_time && fmove < 0)
+	if (thinktime < sv_player->v.teleport_time && fmove < 0)
 		fmove = 0;
 		
 	for (i=0 ; i<3 ; i++)
@@ -347,11 +350,26 @@ the angle fields specify an exact angular motion in degrees
 ===================
 */
 void SV_ClientThink (void)
+{
+	SV_ClientThinkTime (sv.time);
+}
+
+/*
+===================
+SV_ClientThinkTime
+
+SV_ClientThink at the given time, the TAS simulator uses this so that
+it never has to write to sv
+===================
+*/
+void SV_ClientThinkTime (double time)
 {
 	vec3_t	v_angle;
 
 	if (sv_player->v.movetype == MOVETYPE_NONE || (tas_gamestate != unpaused && !simulating))
 		return;
+
+	thinktime = time;
 	
 	onground = (int)sv_player->v.flags & FL_ONGROUND;
 
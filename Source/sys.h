@@ -26,6 +26,9 @@ void Sys_ReleaseLock (void);
 
 int Sys_FileTime (char *path);
 void Sys_mkdir (char *path);
+void *Sys_MapFile (FILE *f, int size);
+void Sys_UnmapFile (void *view, int size);
+// read only view of the first size bytes of an open file, NULL if it can't be mapped
 
 // memory protection
 void Sys_MakeCodeWriteable (unsigned long startaddr, unsigned long length);
@@ -189,6 +189,26 @@ void Sys_mkdir (char *path)
 	mkdir (path, 0777);
 }
 
+void *Sys_MapFile (FILE *f, int size)
+{
+	void	*view;
+
+	if (size <= 0)
+		return NULL;
+
+	view = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	if (view == MAP_FAILED)
+		return NULL;
+
+	return view;
+}
+
+void Sys_UnmapFile (void *view, int size)
+{
+	if (view)
+		munmap (view, size);
+}
+
 double Sys_DoubleTime (void)
 {
 	struct	timeval		tp;
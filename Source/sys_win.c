@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <errno.h>
 #include <direct.h>		// _mkdir
 #include <conio.h>		// _putch
+#include <io.h>			// _get_osfhandle
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -144,6 +145,34 @@ void Sys_mkdir (char *path)
 	_mkdir (path);
 }
 
+void *Sys_MapFile (FILE *f, int size)
+{
+	HANDLE	file, mapping;
+	void	*view;
+
+	if (size <= 0)
+		return NULL;
+
+	file = (HANDLE)_get_osfhandle (_fileno(f));
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (!(mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL)))
+		return NULL;
+
+	// the view keeps the mapping alive
+	view = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, size);
+	CloseHandle (mapping);
+
+	return view;
+}
+
+void Sys_UnmapFile (void *view, int size)
+{
+	if (view)
+		UnmapViewOfFile (view);
+}
+
 /*
 ===============================================================================
 
@@ -23,6 +23,7 @@
 #include "ipc_main.hpp"
 #include "rewards.hpp"
 #include "bookmark.hpp"
+#include "trace_cache.hpp"
 #include "libtasquake/utils.hpp"
 
 // desc: When set to 1, pauses the game on load
@@ -128,6 +129,7 @@ void TAS_Init()
 	Cmd_AddCommand("tas_script_stop", Cmd_TAS_Script_Stop);
 	Cmd_AddCommand("tas_script_play", Cmd_TAS_Script_Play);
 	Cmd_AddCommand("tas_script_load", Cmd_TAS_Script_Load);
+	Cmd_AddCommand("tas_script_convert", Cmd_TAS_Script_Convert);
 	Cmd_AddCommand("tas_script_skip", Cmd_TAS_Script_Skip);
 	Cmd_AddCommand("tas_script_skip_block", Cmd_TAS_Script_Skip_Block);
 	Cmd_AddCommand("tas_script_advance", Cmd_TAS_Script_Advance);
@@ -191,6 +193,7 @@ void TAS_Init()
 	Cmd_AddCommand("-tas_lgagst", IN_TAS_Lgagst_Up);
 
 	Cmd_AddCommand("tas_optimizer_accept", Cmd_TAS_Optimizer_Accept);
+	Cmd_AddCommand("tas_optimizer_batch", TASQuake::Cmd_TAS_Optimizer_Batch);
 	Cmd_AddCommand("tas_optimizer_run", TASQuake::Cmd_TAS_Optimizer_Run);
 
 	Cmd_AddCommand("tas_reward_delete_all", Cmd_TAS_Reward_Delete_All);
@@ -208,12 +211,20 @@ void TAS_Init()
 	Cmd_AddCommand("tas_ls", Cmd_TAS_LS);
 	Cmd_AddCommand("tas_ss_clear", Cmd_TAS_SS_Clear);
 	Cmd_AddCommand("tas_savestate", Cmd_TAS_Savestate);
+	Cmd_AddCommand("tas_snapshot_verify", Cmd_TAS_Snapshot_Verify);
 	Cmd_AddCommand("tas_trace_edict", Cmd_TAS_Trace_Edict);
+	Cmd_AddCommand("tas_trace_verify", Cmd_TAS_Trace_Verify);
+	Cmd_AddCommand("tas_trace_cache_stats", Cmd_TAS_Trace_Cache_Stats);
+	Cvar_Register(&tas_ipc_compact);
 	Cvar_Register(&tas_optimizer_algs);
 	Cvar_Register(&tas_optimizer_casper);
+	Cvar_Register(&tas_optimizer_checkpoints);
 	Cvar_Register(&tas_optimizer_goal);
 	Cvar_Register(&tas_optimizer_multigame);
+	Cvar_Register(&tas_optimizer_multigame_batch);
+	Cvar_Register(&tas_optimizer_multigame_inflight);
 	Cvar_Register(&tas_optimizer_secondarygoals);
+	Cvar_Register(&tas_optimizer_threads);
 	Cvar_Register(&tas_optimizer);
 	Cvar_Register(&tas_playing);
 	Cvar_Register(&tas_pause_onload);
@@ -265,11 +276,17 @@ void TAS_Init()
 	Cvar_Register(&tas_predict_grenade);
 	Cvar_Register(&tas_predict_per_frame);
 	Cvar_Register(&tas_predict_maxlength);
+	Cvar_Register(&tas_predict_thread);
 	Cvar_Register(&tas_predict_real);
+	Cvar_Register(&tas_trace_cache);
+	Cvar_Register(&tas_trace_record);
 	Cvar_Register(&tas_reward_display);
 	Cvar_Register(&tas_reward_size);
 	Cvar_Register(&tas_savestate_auto);
 	Cvar_Register(&tas_savestate_enabled);
+	Cvar_Register(&tas_savestate_memory);
+	Cvar_Register(&tas_savestate_max);
+	Cvar_Register(&tas_savestate_budget);
 	Cvar_Register(&tas_savestate_prefix);
 
 	IPC_Init();
@@ -310,6 +327,14 @@ void Draw_Lines_Hook(void)
 	Draw_Elements();
 }
 
+qboolean TAS_Fast_Forward(void)
+{
+	if (cls.demoplayback)
+		return qfalse;
+
+	return Script_Playback_Fast_Forward() ? qtrue : qfalse;
+}
+
 void Host_Connect_f_Hook()
 {
 	if (cls.demoplayback)
@@ -332,6 +357,11 @@ void CL_SignonReply_Hook()
 		unpause_countdown = 4;
 }
 
+void SV_SpawnServer_Hook()
+{
+	Savestate_SpawnServer_Hook();
+}
+
 void IN_MouseMove_Hook(int mousex, int mousey)
 {
 	Camera_MouseMove_Hook(mousex, mousey);
@@ -348,6 +378,7 @@ void _Host_Frame_Hook()
 		--unpause_countdown;
 		if (unpause_countdown == 0)
 		{
+			Prediction_Thread_Hold();
 			tas_gamestate = unpaused;
 			unpause_countdown = -1;
 			key_dest = key_game;
@@ -376,6 +407,7 @@ bool PF_player_setorigin_called()
 
 void _Host_Frame_After_FilterTime_Hook()
 {
+	Prediction_Thread_Hold();
 	Test_Host_Frame_Hook();
 	Test_Runner_Frame_Hook();
 	IPC_Prediction_Frame_Hook();
@@ -395,3 +427,8 @@ void _Host_Frame_After_FilterTime_Hook()
 
 	player_setorigin_prev_frame = false;
 }
+
+void _Host_Frame_Before_Render_Hook()
+{
+	Prediction_Thread_Release();
+}
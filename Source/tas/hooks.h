@@ -9,6 +9,8 @@ extern "C"
 #endif
 	extern cvar_t tas_playing;
 	extern cvar_t tas_timescale;
+	extern cvar_t tas_trace_cache;
+	extern cvar_t tas_trace_record;
 
 	void SV_Physics_Client_Hook();
 	void CL_SendMove_Hook(usercmd_t* cmd);
@@ -16,8 +18,10 @@ extern "C"
 	void IN_MouseMove_Hook(int mousex, int mousey);
 	void _Host_Frame_Hook();
 	void _Host_Frame_After_FilterTime_Hook();
+	void _Host_Frame_Before_Render_Hook();
 	void Host_Connect_f_Hook();
 	void CL_SignonReply_Hook();
+	void SV_SpawnServer_Hook();
 	void TAS_Init();
 	void TAS_Set_Seed(unsigned int seed);
 	qboolean Cmd_ExecuteString_Hook(const char* text);
@@ -26,6 +30,11 @@ extern "C"
 	void SCR_CenterPrint_Hook(void);
 	void PF_player_setorigin_hook(void);
 	void Draw_Lines_Hook(void);
+	qboolean TAS_Fast_Forward(void);
+	qboolean TraceCache_Lookup(const void* world, const float* start, const float* mins, const float* end, int hullnum, trace_t* trace);
+	void TraceCache_Store(const void* world, const float* start, const float* mins, const float* end, int hullnum, const trace_t* trace);
+	void TraceCache_Clear(void);
+	void TraceRecord_Store(const hull_t* hull, const float* start, const float* end, const float* endpos, qboolean result, const trace_t* trace);
 #ifdef __cplusplus
 	bool PF_player_setorigin_called();
 }
@@ -80,6 +80,7 @@ static void DrawOptimizerState(int& y, const PlaybackInfo* info) {
 	Draw(y, &tas_hud_optimizer, "Original: %f", TASQuake::OriginalEfficacy());
 	Draw(y, &tas_hud_optimizer, "Optimized: %f", TASQuake::OptimizedEfficacy());
 	Draw(y, &tas_hud_optimizer, "Iterations: %lu", TASQuake::OptimizerIterations());
+	Draw(y, &tas_hud_optimizer, "Iterations/s: %.1f", TASQuake::OptimizerIterationsPerSecond());
 }
 
 void DrawFrameState(int& y, const PlaybackInfo* info)
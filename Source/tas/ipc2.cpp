@@ -1,14 +1,22 @@
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+#include "cpp_quakedef.hpp"
 #include "ipc2.hpp"
 #include "libtasquake/boost_ipc.hpp"
 #include "libtasquake/io.hpp"
-#include "cpp_quakedef.hpp"
 #include "ipc_prediction.hpp"
 #include "optimizer_quake.hpp"
 #include "real_prediction.hpp"
 
+cvar_t tas_ipc_compact = {"tas_ipc_compact", "1"};
+
 static ipc::server server;
 static ipc::client client;
 static double ping_interval = 5;
+static std::unordered_map<size_t, TASScript> sent_scripts; // Last script sent to each client
+static std::vector<size_t> known_sessions; // Sessions seen last frame, used to notice disconnects
+static TASScript received_script; // Last script received from the server, patches are made against it
 
 void TASQuake::Cmd_IPC2_Init() {
     server.start(1996);
@@ -16,6 +24,8 @@ void TASQuake::Cmd_IPC2_Init() {
 
 void TASQuake::Cmd_IPC2_Stop() {
     server.stop();
+    sent_scripts.clear();
+    known_sessions.clear();
 }
 
 void TASQuake::Cmd_IPC2_Cl_Connect() {
@@ -24,6 +34,7 @@ void TASQuake::Cmd_IPC2_Cl_Connect() {
 
 void TASQuake::Cmd_IPC2_Cl_Disconnect() {
     client.disconnect();
+    received_script.blocks.clear();
 }
 
 void TASQuake::SV_BroadCastMessage(void* ptr, uint32_t length) {
@@ -44,13 +55,67 @@ void TASQuake::CL_SendMessage(void* ptr, uint32_t length) {
 }
 
 void TASQuake::SV_SendRun(const OptimizerRun& run) {
-    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)IPCMessages::OptimizerRun;
     writer.WriteBytes(&type, 1);
-    run.WriteToBuffer(writer);
+    run.WriteToBuffer(writer, IPC_Trajectory_Encoding());
     SV_BroadCastMessage(writer.m_pBuffer->ptr, writer.m_uFileOffset);
 }
 
+TASQuake::TrajectoryEncoding TASQuake::IPC_Trajectory_Encoding() {
+    return tas_ipc_compact.value != 0 ? TrajectoryEncoding::Compact : TrajectoryEncoding::Raw;
+}
+
+void TASQuake::SV_Write_Script(size_t connection_id, const TASScript& script, TASQuakeIO::BufferWriteInterface& writer) {
+    auto it = sent_scripts.find(connection_id);
+
+    if(it == sent_scripts.end()) {
+        ScriptPatch::Write_Update(nullptr, script, writer);
+        sent_scripts[connection_id] = script;
+    } else {
+        ScriptPatch::Write_Update(&it->second, script, writer);
+        it->second = script;
+    }
+}
+
+void TASQuake::SV_BroadCastScript(TASQuakeIO::BufferWriteInterface& writer, const TASScript& script) {
+    std::vector<size_t> connections;
+    server.get_sessions(connections);
+    uint32_t header_size = writer.m_uFileOffset;
+
+    for(auto& connection_id : connections) {
+        writer.m_uFileOffset = header_size;
+        SV_Write_Script(connection_id, script, writer);
+        server.send_message(connection_id, writer.m_pBuffer->ptr, writer.m_uFileOffset);
+    }
+}
+
+bool TASQuake::CL_Apply_Script_Update(TASScript& script, TASQuakeIO::BufferReadInterface& iface, int& first_changed_frame) {
+    // The working script gets edited locally by the optimizer, so the patch goes to an untouched copy
+    if(!ScriptPatch::Apply_Update(received_script, iface, first_changed_frame)) {
+        first_changed_frame = INT_MAX;
+        return false;
+    }
+
+    // Any textual change counts, repeating a toggle the game released by itself changes playback
+    int applied_frame;
+    first_changed_frame = script.FirstChangedFrame(&received_script);
+    script.ApplyChanges(&received_script, applied_frame);
+    return true;
+}
+
+void TASQuake::CL_Request_Resync() {
+    Con_Printf("Script out of sync with the server, requesting the full script\n");
+    uint8_t type = (uint8_t)IPCMessages::ScriptResync;
+    client.send_message(&type, sizeof(type));
+}
+
+static void SV_Resync(size_t connection_id) {
+    sent_scripts.erase(connection_id);
+    IPC_Prediction_Resync();
+    TASQuake::MultiGame_Resync();
+}
+
 std::int64_t TASQuake::Get_First_Session() {
     std::vector<size_t> connections;
     server.get_sessions(connections);
@@ -63,7 +128,7 @@ std::int64_t TASQuake::Get_First_Session() {
 }
 
 static void Send_Ping(size_t connection_id) {
-    auto iface = TASQuakeIO::BufferWriteInterface::Init();
+    auto iface = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)TASQuake::IPCMessages::Print;
     iface.WriteBytes(&type, 1);
     iface.WriteBytes("PING!", 6);
@@ -91,6 +156,12 @@ static void Handle_Server_Message(ipc::Message& msg) {
         case TASQuake::IPCMessages::OptimizerGoal:
             TASQuake::MultiGame_ReceiveGoal(msg);
             break;
+        case TASQuake::IPCMessages::OptimizerResult:
+            TASQuake::MultiGame_ReceiveResult(msg);
+            break;
+        case TASQuake::IPCMessages::ScriptResync:
+            SV_Resync(msg.connection_id);
+            break;
         default:
             Con_Printf("IPC message with unknown type %d", (int)type);
             break;
@@ -98,6 +169,20 @@ static void Handle_Server_Message(ipc::Message& msg) {
 }
 
 
+static void Handle_Disconnects() {
+    std::vector<size_t> connections;
+    server.get_sessions(connections);
+
+    for(auto connection_id : known_sessions) {
+        if(std::find(connections.begin(), connections.end(), connection_id) == connections.end()) {
+            sent_scripts.erase(connection_id);
+            TASQuake::MultiGame_Client_Disconnected(connection_id);
+        }
+    }
+
+    known_sessions = std::move(connections);
+}
+
 static void Handle_Server() {
     if(!server.m_bConnected) {
         return;
@@ -109,9 +194,12 @@ static void Handle_Server() {
 
     for(auto& msg : messages) {
         Handle_Server_Message(msg);
-        free(msg.address);
+        known_sessions.push_back(msg.connection_id); // In case the session already closed
+        ipc::free_message(msg);
     }
 
+    Handle_Disconnects();
+
     static double last_ping = 0;
 
     double diff = Sys_DoubleTime() - last_ping;
@@ -149,6 +237,9 @@ static void Handle_Client_Message(ipc::Message& msg) {
         case TASQuake::IPCMessages::OptimizerStop:
             TASQuake::Receive_Optimizer_Stop();
             break;
+        case TASQuake::IPCMessages::OptimizerBatch:
+            TASQuake::Receive_Optimizer_Batch(msg);
+            break;
         default:
             Con_Printf("IPC message with unknown type %d", (int)type);
             break;
@@ -165,7 +256,7 @@ static void Handle_Client() {
 
     for(auto& msg : messages) {
         Handle_Client_Message(msg);
-        free(msg.address);
+        ipc::free_message(msg);
     }
 }
 
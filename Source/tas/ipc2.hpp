@@ -2,10 +2,14 @@
 #include <cstdint>
 #include <vector>
 #include "libtasquake/boost_ipc.hpp"
+#include "libtasquake/io.hpp"
 #include "libtasquake/optimizer.hpp"
+#include "libtasquake/script_parse.hpp"
+
+extern cvar_t tas_ipc_compact; // Send optimizer runs and prediction lines with quantized trajectories
 
 namespace TASQuake {
-    enum class IPCMessages { Print, Predict, OptimizerRun, OptimizerProgress, OptimizerTask, OptimizerStop, OptimizerGoal };
+    enum class IPCMessages { Print, Predict, OptimizerRun, OptimizerProgress, OptimizerTask, OptimizerStop, OptimizerGoal, OptimizerBatch, OptimizerResult, ScriptResync };
 
     void IPC2_Frame_Hook();
     void Cmd_IPC2_Init();
@@ -16,5 +20,10 @@ namespace TASQuake {
     void SV_BroadCastMessage(void* ptr, uint32_t length);
     void CL_SendMessage(void* ptr, uint32_t length);
     void SV_SendRun(const OptimizerRun& run); // Send run to all clients
+    void SV_Write_Script(size_t connection_id, const TASScript& script, TASQuakeIO::BufferWriteInterface& writer); // Patch against what the client last received
+    void SV_BroadCastScript(TASQuakeIO::BufferWriteInterface& writer, const TASScript& script); // Sends writer with a script update appended to every client
+    TrajectoryEncoding IPC_Trajectory_Encoding();
+    bool CL_Apply_Script_Update(TASScript& script, TASQuakeIO::BufferReadInterface& iface, int& first_changed_frame); // Returns false if a patch didn't match the last received script
+    void CL_Request_Resync(); // Client script didn't match a patch, ask for the full script
     std::int64_t Get_First_Session();
 }
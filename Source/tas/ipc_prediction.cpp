@@ -15,6 +15,7 @@ static uint32_t last_request_id = 0;
 static double current_line_time = 0;
 static PredictionData data;
 static bool has_data = false;
+static bool resync = false;
 
 static void Request() {
     auto connection = TASQuake::Get_First_Session();
@@ -25,7 +26,8 @@ static void Request() {
         return; // No clients, give up
     
     last_request = Sys_DoubleTime();
-    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    resync = false;
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)TASQuake::IPCMessages::Predict;
     writer.WriteBytes(&type, 1);
     auto info = GetPlaybackInfo();
@@ -36,7 +38,7 @@ static void Request() {
     writer.WriteBytes(&current_frame, sizeof(int32_t));
     writer.WriteBytes(&target_frame, sizeof(int32_t));
     writer.WriteBytes(&last_request_id, sizeof(int32_t));
-    info->current_script.Write_To_Memory(writer);
+    TASQuake::SV_Write_Script(connection, info->current_script, writer);
 
     TASQuake::SV_StopMultiGameOpt();
     TASQuake::SV_SendMessage(connection, writer.m_pBuffer->ptr, writer.m_uFileOffset);
@@ -50,7 +52,12 @@ void IPC_Prediction_Read_Response(ipc::Message& msg) {
     if(request_id != last_request_id)
         return;
 
-    data.Load_From_Memory(reader);
+    if(!data.Load_From_Memory(reader)) {
+        data = PredictionData();
+        has_data = false;
+        return;
+    }
+
     has_data = true;
     current_line_time = last_request;
 }
@@ -65,6 +72,8 @@ static bool Should_Predict() {
         return true; // Has been edited, need to generate new line
     } else if(current_line_time == last_request && !has_line) {
         return true; // We have received a response, but some issues with the line
+    } else if(resync) {
+        return true; // Client couldn't apply the last script patch
     } else {
         return false;
     }
@@ -85,6 +94,10 @@ bool IPC_Prediction_HasLine() {
     return current_line_time >= info->last_edited && end <= data.m_iEndFrame && start >= data.m_iStartFrame;
 }
 
+void IPC_Prediction_Resync() {
+    resync = true;
+}
+
 TASQuake::PredictionData* IPC_Get_PredictionData() {
     return &data;
 }
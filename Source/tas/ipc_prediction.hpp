@@ -7,4 +7,5 @@
 void IPC_Prediction_Frame_Hook();
 void IPC_Prediction_Read_Response(ipc::Message& msg);
 bool IPC_Prediction_HasLine();
+void IPC_Prediction_Resync(); // Request the line again after the client asked for the full script
 TASQuake::PredictionData* IPC_Get_PredictionData();
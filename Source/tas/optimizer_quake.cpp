@@ -1,3 +1,10 @@
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include "draw.hpp"
 #include "hooks.h" // Ensure C linkage for SCR_CenterPrint_Hook
 #include "libtasquake/draw.hpp"
@@ -15,14 +22,19 @@ static qboolean Optimizer_Var_Updated(struct cvar_s *var, char *value);
 cvar_t tas_optimizer = {"tas_optimizer", "1"};
 cvar_t tas_optimizer_algs = {"tas_optimizer_algs", "basic", 0, Optimizer_Var_Updated};
 cvar_t tas_optimizer_casper = {"tas_optimizer_casper", "0", 0, Optimizer_Var_Updated};
+cvar_t tas_optimizer_checkpoints = {"tas_optimizer_checkpoints", "36", 0, Optimizer_Var_Updated};
 cvar_t tas_optimizer_goal = {"tas_optimizer_goal", "0", 0, Optimizer_Var_Updated};
 cvar_t tas_optimizer_multigame  = {"tas_optimizer_multigame", "0", 0, Optimizer_Var_Updated};
+cvar_t tas_optimizer_multigame_batch = {"tas_optimizer_multigame_batch", "4"};
+cvar_t tas_optimizer_multigame_inflight = {"tas_optimizer_multigame_inflight", "2"};
 cvar_t tas_optimizer_secondarygoals  = {"tas_optimizer_secondarygoals", "0", 0, Optimizer_Var_Updated};
+cvar_t tas_optimizer_threads = {"tas_optimizer_threads", "0", 0, Optimizer_Var_Updated};
 cvar_t tas_predict_endoffset{"tas_predict_endoffset", "0.5", 0, Optimizer_Var_Updated};
 
 static bool m_bFirstIteration = false;
 static int startFrame = -1;
 static size_t m_uOptIterations = 0;
+static double m_dOptStartTime = 0;
 static double m_dOriginalEfficacy = 0;
 static double m_dBestEfficacy = 0;
 static TASQuake::Optimizer opt;
@@ -33,9 +45,53 @@ static std::vector<PathPoint> m_BestPoints;
 static std::vector<PathPoint> m_CurrentPoints;
 static std::vector<Rect> m_BestRects;
 static bool multi_game_opt_running = false;
+static bool multi_game_resync = false;
 static std::map<size_t, int32_t> m_uIterationCounts; // Stores the iteration counts from clients
 static int32_t multi_game_opt_num = 1;
 
+static MultiGameCoordinator m_Coordinator;
+
+// Client side queue of the candidates dealt out by the server
+struct ClientCandidate {
+    std::uint32_t id;
+    TASScript script;
+};
+
+static std::deque<ClientCandidate> m_Candidates;
+static std::uint32_t m_uCurrentCandidate = 0; // 0 when the current iteration is a local mutation
+
+struct OptimizerCheckpoint {
+    TASQuake::OptimizerRunCheckpoint run;
+    Simulator sim;
+};
+
+// Checkpoints of a simulated run, iterations that only change later frames are resumed from these
+struct CheckpointedRun {
+    TASScript script;
+    std::vector<FrameData> data;
+    std::vector<PathPoint> points;
+    std::vector<OptimizerCheckpoint> checkpoints;
+
+    void Clear();
+    // Returns the index of the last checkpoint before the frame or -1 if there is none
+    int FindCheckpoint(int frame) const;
+};
+
+// Checkpoints of the iteration in progress and of the runs the next mutation can be based on
+struct IterationCheckpoints {
+    TASScript script;
+    std::vector<OptimizerCheckpoint> checkpoints;
+    CheckpointedRun lastRun;
+    CheckpointedRun bestRun;
+
+    void Init(const TASQuake::Optimizer& opt);
+    void Take(const TASQuake::Optimizer& opt, const Simulator& sim);
+    void SaveRun(const TASQuake::Optimizer& opt, const std::vector<PathPoint>& points, bool newBest);
+    void Resume(TASQuake::Optimizer& opt, Simulator& sim, std::vector<PathPoint>& points);
+};
+
+static IterationCheckpoints m_Checkpoints;
+
 static qboolean Optimizer_Var_Updated(struct cvar_s *var, char *value) {
     last_updated = 0;
     if(multi_game_opt_running) {
@@ -68,6 +124,11 @@ size_t TASQuake::OptimizerIterations() {
     return m_uOptIterations;
 }
 
+double TASQuake::OptimizerIterationsPerSecond() {
+    double elapsed = Sys_DoubleTime() - m_dOptStartTime;
+    return elapsed > 0 ? m_uOptIterations / elapsed : 0;
+}
+
 const TASScript* TASQuake::GetOptimizedVersion() {
     return &opt.m_currentBest.playbackInfo.current_script;
 }
@@ -168,10 +229,278 @@ static double get_vel_theta(const SimulationInfo& info) {
 	}
 }
 
+static bool game_opt_running = false;
+static const std::array<float, 4> color = { 0, 1, 1, 0.5 };
+
+void CheckpointedRun::Clear() {
+    script.blocks.clear();
+    data.clear();
+    points.clear();
+    checkpoints.clear();
+}
+
+int CheckpointedRun::FindCheckpoint(int frame) const {
+    int index = -1;
+
+    for(size_t i=0; i < checkpoints.size() && (int)checkpoints[i].run.m_uFrame <= frame; ++i) {
+        index = i;
+    }
+
+    return index;
+}
+
+void IterationCheckpoints::Init(const TASQuake::Optimizer& opt) {
+    script = opt.m_currentRun.playbackInfo.current_script;
+    checkpoints.clear();
+    lastRun.Clear();
+    bestRun.Clear();
+}
+
+void IterationCheckpoints::Take(const TASQuake::Optimizer& opt, const Simulator& sim) {
+    int interval = tas_optimizer_checkpoints.value;
+    std::uint32_t frame = opt.m_currentRun.playbackInfo.current_frame;
+
+    if(interval <= 0 || frame % interval != 0) {
+        return;
+    }
+    else if(!checkpoints.empty() && checkpoints.back().run.m_uFrame >= frame) {
+        return;
+    }
+
+    OptimizerCheckpoint checkpoint;
+    checkpoint.run = opt.m_currentRun.GetCheckpoint();
+    checkpoint.sim = sim;
+    checkpoints.push_back(checkpoint);
+}
+
+void IterationCheckpoints::SaveRun(const TASQuake::Optimizer& opt, const std::vector<PathPoint>& points, bool newBest) {
+    lastRun.script = std::move(script);
+    lastRun.data = opt.m_currentRun.m_vecData;
+    lastRun.points = points;
+    lastRun.checkpoints = std::move(checkpoints);
+    checkpoints.clear();
+
+    if(newBest) {
+        bestRun = lastRun;
+    }
+}
+
+void IterationCheckpoints::Resume(TASQuake::Optimizer& opt, Simulator& sim, std::vector<PathPoint>& points) {
+    const TASScript* current = &opt.m_currentRun.playbackInfo.current_script;
+    const CheckpointedRun* source = nullptr;
+    int sourceIndex = -1;
+    std::uint32_t sourceFrame = 0;
+
+    // The mutation was applied either to the last run or to the best run, pick whichever shares a longer prefix
+    for(auto run : {&lastRun, &bestRun}) {
+        int index = run->FindCheckpoint(run->script.FirstChangedFrame(current));
+        if(index != -1 && run->checkpoints[index].run.m_uFrame > sourceFrame) {
+            source = run;
+            sourceIndex = index;
+            sourceFrame = run->checkpoints[index].run.m_uFrame;
+        }
+    }
+
+    if(source) {
+        auto& checkpoint = source->checkpoints[sourceIndex];
+        opt.ResumeIteration(checkpoint.run, source->data);
+        sim = checkpoint.sim;
+        points.assign(source->points.begin(), source->points.begin() + std::min<size_t>(sourceFrame, source->points.size()));
+        checkpoints.assign(source->checkpoints.begin(), source->checkpoints.begin() + sourceIndex + 1);
+    }
+
+    script = *current;
+}
+
+static void StartIteration(TASQuake::Optimizer& opt, Simulator& sim, IterationCheckpoints& checkpoints, std::vector<PathPoint>& points, bool newBest) {
+    checkpoints.SaveRun(opt, points, newBest);
+    opt.ResetIteration();
+    sim = GetOptSimulator(&opt);
+    points.clear();
+    checkpoints.Resume(opt, sim, points);
+}
+
+static TASQuake::OptimizerState RunOptimizerFrame(TASQuake::Optimizer& opt, Simulator& sim, IterationCheckpoints& checkpoints, std::vector<PathPoint>& points, trace_context_t* ctx) {
+    checkpoints.Take(opt, sim);
+    TASQuake::ExtendedFrameData data;
+    data.m_frameData.m_dVelTheta = get_vel_theta(sim.info);
+    data.m_frameData.pos.x = sim.info.ent.v.origin[0];
+    data.m_frameData.pos.y = sim.info.ent.v.origin[1];
+    data.m_frameData.pos.z = sim.info.ent.v.origin[2];
+    data.m_dTime = sim.info.time;
+
+    auto result = opt.OnRunnerFrame(&data);
+    sim.RunFrame(ctx);
+    PathPoint p;
+    p.color = color;
+    VectorCopy(sim.info.ent.v.origin, p.point);
+    points.push_back(p);
+
+    return result;
+}
+
+// An independent optimizer running on a worker thread, the best runs are exchanged with the main thread between slices
+struct OptimizerWorker {
+    TASQuake::Optimizer opt;
+    TASQuake::OptimizerState state = TASQuake::OptimizerState::Stop;
+    Simulator sim;
+    trace_context_t trace; // Box hull of this worker, the world is shared
+    IterationCheckpoints checkpoints;
+    std::vector<PathPoint> points;
+    std::vector<PathPoint> bestPoints;
+    double originalEfficacy = 0;
+    double bestEfficacy = 0;
+    std::uint32_t iterations = 0;
+    std::thread thread;
+
+    void Init(const PlaybackInfo* playback, const TASQuake::OptimizerSettings* settings, std::uint32_t seed);
+    void NewIteration();
+    void Run(std::chrono::steady_clock::time_point deadline);
+};
+
+// Worker threads only run while the main thread waits in RunSlice, so the game state stays untouched meanwhile.
+// Each worker traces through its own trace context.
+struct OptimizerPool {
+    std::vector<std::unique_ptr<OptimizerWorker>> workers;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    std::uint32_t generation = 0;
+    size_t running = 0;
+    bool exit = false;
+    std::chrono::steady_clock::time_point deadline;
+    edict_t* player = nullptr;
+
+    ~OptimizerPool() { Stop(); }
+    void Start(size_t count);
+    void Stop();
+    void RunSlice(double seconds);
+    void WorkerMain(OptimizerWorker* worker);
+};
+
+static OptimizerPool m_Pool;
+
+void OptimizerWorker::Init(const PlaybackInfo* playback, const TASQuake::OptimizerSettings* settings, std::uint32_t seed) {
+    iterations = 0;
+    originalEfficacy = 0;
+    bestEfficacy = 0;
+    points.clear();
+    bestPoints.clear();
+
+    if(!opt.Init(playback, settings)) {
+        state = TASQuake::OptimizerState::Stop;
+        return;
+    }
+
+    opt.Seed(seed);
+    sim = GetOptSimulator(&opt);
+    checkpoints.Init(opt);
+    state = TASQuake::OptimizerState::ContinueIteration;
+}
+
+void OptimizerWorker::NewIteration() {
+    bool newBest = false;
+    double runEfficacy = opt.m_currentRun.RunEfficacy();
+
+    if(iterations == 0) {
+        originalEfficacy = opt.m_currentBest.RunEfficacy();
+        bestEfficacy = originalEfficacy;
+        bestPoints = points;
+        newBest = true;
+    } else if(runEfficacy > bestEfficacy) {
+        bestPoints = points;
+        bestEfficacy = runEfficacy;
+        newBest = true;
+    }
+
+    StartIteration(opt, sim, checkpoints, points, newBest);
+    ++iterations;
+}
+
+void OptimizerWorker::Run(std::chrono::steady_clock::time_point deadline) {
+    SV_InitTraceContext(&trace); // The map may have changed since the last slice
+
+    while(std::chrono::steady_clock::now() < deadline && state != TASQuake::OptimizerState::Stop) {
+        if(state == TASQuake::OptimizerState::NewIteration) {
+            NewIteration();
+        }
+
+        state = RunOptimizerFrame(opt, sim, checkpoints, points, &trace);
+    }
+}
+
+void OptimizerPool::Start(size_t count) {
+    if(workers.size() == count) {
+        return;
+    }
+
+    Stop();
+    exit = false;
+
+    for(size_t i=0; i < count; ++i) {
+        workers.push_back(std::make_unique<OptimizerWorker>());
+    }
+
+    for(auto& worker : workers) {
+        OptimizerWorker* ptr = worker.get();
+        worker->thread = std::thread([this, ptr]() { WorkerMain(ptr); });
+    }
+}
+
+void OptimizerPool::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exit = true;
+    }
+    start_cv.notify_all();
+
+    for(auto& worker : workers) {
+        if(worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+
+    workers.clear();
+}
+
+void OptimizerPool::RunSlice(double seconds) {
+    std::unique_lock<std::mutex> lock(mutex);
+    deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    player = sv_player;
+    running = workers.size();
+    ++generation;
+    start_cv.notify_all();
+    done_cv.wait(lock, [this]() { return running == 0; });
+}
+
+void OptimizerPool::WorkerMain(OptimizerWorker* worker) {
+    std::uint32_t seen = 0;
+
+    for(;;) {
+        std::unique_lock<std::mutex> lock(mutex);
+        start_cv.wait(lock, [&]() { return exit || generation != seen; });
+        if(exit) {
+            return;
+        }
+        seen = generation;
+        sv_player = player;
+        auto end = deadline;
+        lock.unlock();
+
+        worker->Run(end);
+
+        lock.lock();
+        if(--running == 0) {
+            done_cv.notify_all();
+        }
+    }
+}
+
 static void InitOptimizer(PlaybackInfo* playback) {
     startFrame = playback->current_frame;
     m_bFirstIteration = true;
     m_uOptIterations = 0;
+    m_dOptStartTime = Sys_DoubleTime();
     last_updated = playback->last_edited;
     auto settings = GetSettings();
     if(!opt.Init(playback, &settings)) {
@@ -181,30 +510,80 @@ static void InitOptimizer(PlaybackInfo* playback) {
     state = TASQuake::OptimizerState::ContinueIteration;
     m_CurrentPoints.clear();
     m_BestPoints.clear();
+    m_Checkpoints.Init(opt);
+
+    int threads = tas_optimizer_threads.value;
+    if(threads > 0) {
+        m_Pool.Start(threads);
+        for(size_t i=0; i < m_Pool.workers.size(); ++i) {
+            m_Pool.workers[i]->Init(playback, &settings, i + 1);
+        }
+    } else {
+        m_Pool.Stop();
+    }
 }
 
 static void InitNewIteration() {
+    bool newBest = false;
+
     if(m_bFirstIteration) {
         m_dOriginalEfficacy = opt.m_currentBest.RunEfficacy();
         m_dBestEfficacy = m_dOriginalEfficacy;
         m_bFirstIteration = false;
         m_BestPoints = m_CurrentPoints;
         AddCurve(&m_BestPoints, OPTIMIZER_ID);
+        newBest = true;
     } else {
         double runEfficacy = opt.m_currentRun.RunEfficacy();
         if(runEfficacy > m_dBestEfficacy) {
             m_BestPoints = m_CurrentPoints;
             m_dBestEfficacy = runEfficacy;
+            newBest = true;
         }
     }
-    opt.ResetIteration();
-    sim = GetOptSimulator(&opt);
+    StartIteration(opt, sim, m_Checkpoints, m_CurrentPoints, newBest);
     ++m_uOptIterations;
-    m_CurrentPoints.clear();
 }
 
-static bool game_opt_running = false;
-static const std::array<float, 4> color = { 0, 1, 1, 0.5 };
+static void Collect_Worker_Results() {
+    bool running = false;
+    m_uOptIterations = 0;
+
+    for(auto& worker : m_Pool.workers) {
+        m_uOptIterations += worker->iterations;
+        running = running || worker->state != TASQuake::OptimizerState::Stop;
+
+        if(worker->iterations == 0) {
+            continue;
+        }
+
+        if(m_bFirstIteration) {
+            m_dOriginalEfficacy = worker->originalEfficacy;
+            m_dBestEfficacy = m_dOriginalEfficacy;
+            m_bFirstIteration = false;
+            AddCurve(&m_BestPoints, OPTIMIZER_ID);
+        }
+
+        if(worker->opt.m_currentBest.IsBetterThan(opt.m_currentBest)) {
+            opt.m_currentBest = worker->opt.m_currentBest;
+            m_dBestEfficacy = worker->bestEfficacy;
+            m_BestPoints = worker->bestPoints;
+        }
+    }
+
+    // Share the best run so that the workers reset back to it
+    for(auto& worker : m_Pool.workers) {
+        if(opt.m_currentBest.IsBetterThan(worker->opt.m_currentBest)) {
+            worker->opt.m_currentBest = opt.m_currentBest;
+            worker->bestEfficacy = m_dBestEfficacy;
+            worker->bestPoints = m_BestPoints;
+        }
+    }
+
+    if(!running) {
+        state = TASQuake::OptimizerState::Stop;
+    }
+}
 
 static void SimOptimizer_Frame(bool canPredict)
 {
@@ -224,6 +603,14 @@ static void SimOptimizer_Frame(bool canPredict)
         InitOptimizer(playback);
 	}
 
+    if(!m_Pool.workers.empty()) {
+        if(state != TASQuake::OptimizerState::Stop) {
+            m_Pool.RunSlice(tas_predict_per_frame.value);
+            Collect_Worker_Results();
+        }
+        return;
+    }
+
 	double realTimeStart = Sys_DoubleTime();
 
 	while (Sys_DoubleTime() - realTimeStart < tas_predict_per_frame.value && state != TASQuake::OptimizerState::Stop) {
@@ -231,28 +618,16 @@ static void SimOptimizer_Frame(bool canPredict)
             InitNewIteration();
         }
 
-		TASQuake::ExtendedFrameData data;
-        data.m_frameData.m_dVelTheta = get_vel_theta(sim.info);
-        data.m_frameData.pos.x = sim.info.ent.v.origin[0];
-        data.m_frameData.pos.y = sim.info.ent.v.origin[1];
-        data.m_frameData.pos.z = sim.info.ent.v.origin[2];
-        data.m_dTime = sim.info.time;
-
-        state = opt.OnRunnerFrame(&data);
-        sim.RunFrame();
-        PathPoint p;
-        p.color = color;
-        VectorCopy(sim.info.ent.v.origin, p.point);
-        m_CurrentPoints.push_back(p);
+        state = RunOptimizerFrame(opt, sim, m_Checkpoints, m_CurrentPoints, SV_ThreadTraceContext());
 	}
 }
 
 static void SV_SendBest(const TASQuake::OptimizerRun& run) {
-    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)IPCMessages::OptimizerRun;
     writer.WriteBytes(&type, 1);
     writer.WriteBytes(&multi_game_opt_num, sizeof(multi_game_opt_num));
-    run.WriteToBuffer(writer);
+    run.WriteToBuffer(writer, IPC_Trajectory_Encoding());
     SV_BroadCastMessage(writer.m_pBuffer->ptr, writer.m_uFileOffset);
 }
 
@@ -266,21 +641,23 @@ void TASQuake::MultiGame_ReceiveRun(const ipc::Message& msg) {
         return;
     }
 
-    opt.m_currentRun.ReadFromBuffer(reader);
+    TASQuake::OptimizerRun run;
+    if(!run.ReadFromBuffer(reader)) {
+        Con_Printf("Invalid run from client %u\n", (unsigned)msg.connection_id);
+        return;
+    }
+
+    m_Coordinator.Add_Client(msg.connection_id); // Clients get work once they have sent their baseline run
+    opt.m_currentRun = std::move(run);
 #if 0
-    TASScript script;
-    script.Load_From_Memory(reader);
+    std::uint64_t checksum;
+    reader.Read(&checksum);
 
     auto info = GetPlaybackInfo();
     TASScript copied = info->current_script;
     copied.AddScript(&opt.m_currentBest.playbackInfo.current_script, info->current_frame);
-    auto str1 = script.ToString();
-    auto str2 = copied.ToString();
-    if(str1 != str2) {
-        printf("Didnt match:\n%s\nvs.\n%s\n", str1.c_str(), str2.c_str());
-
-        TASScript copied = info->current_script;
-        copied.AddScript(&script, info->current_frame);
+    if(checksum != copied.Checksum()) {
+        printf("Didnt match:\n%s\n", copied.ToString().c_str());
     }
 #endif
     if(opt.m_currentRun.RunEfficacy() > m_dBestEfficacy || m_bFirstIteration) {
@@ -321,6 +698,7 @@ void TASQuake::MultiGame_ReceiveProgress(const ipc::Message& msg) {
     int32_t iterations;
     reader.Read(&iterations, sizeof(iterations));
     m_uIterationCounts[msg.connection_id] = iterations;
+    m_Coordinator.Add_Client(msg.connection_id); // Make sure the client gets work
 
     // Update the count
     m_uOptIterations = 0;
@@ -329,6 +707,68 @@ void TASQuake::MultiGame_ReceiveProgress(const ipc::Message& msg) {
     }
 }
 
+void TASQuake::MultiGame_ReceiveResult(const ipc::Message& msg) {
+    auto reader = TASQuakeIO::BufferReadInterface::Init((std::uint8_t*)msg.address + 1, msg.length - 1);
+    int32_t identifier;
+    std::uint32_t id;
+    reader.Read(&identifier, sizeof(identifier));
+    reader.Read(&id, sizeof(id));
+
+    // Improvements arrive separately as an OptimizerRun, results only keep the work flowing
+    if(identifier == multi_game_opt_num) {
+        m_Coordinator.Receive_Result(msg.connection_id, id, Sys_DoubleTime());
+    }
+}
+
+// Candidates are single mutations of the best run. The algorithms are reset for every candidate
+// so that no candidate depends on the result of another one that is still in flight.
+static TASScript SV_NextCandidate() {
+    opt.m_currentRun = opt.m_currentBest;
+
+    if(!opt.m_vecAlgorithms.empty()) {
+        auto alg = opt.m_vecAlgorithms[opt.RandomizeIndex()];
+        alg->Reset();
+        alg->Mutate(&opt.m_currentRun.playbackInfo.current_script, &opt);
+    }
+
+    return opt.m_currentRun.playbackInfo.current_script;
+}
+
+static void SV_SendBatch(size_t connection_id, const std::vector<std::uint32_t>& ids) {
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
+    uint8_t type = (uint8_t)IPCMessages::OptimizerBatch;
+    std::uint32_t batch_count = ids.size();
+    writer.WriteBytes(&type, sizeof(type));
+    writer.WriteBytes(&multi_game_opt_num, sizeof(multi_game_opt_num));
+    writer.WriteBytes(&batch_count, sizeof(batch_count));
+
+    for(auto id : ids) {
+        writer.WriteBytes(&id, sizeof(id));
+        m_Coordinator.in_flight[id].script.Write_To_Memory_Binary(writer);
+    }
+
+    SV_SendMessage(connection_id, writer.m_pBuffer->ptr, writer.m_uFileOffset);
+}
+
+static void SV_DealCandidates() {
+    // Mutations need the data of the baseline run
+    if(m_bFirstIteration || opt.m_currentBest.m_vecData.empty()) {
+        return;
+    }
+
+    size_t batch_size = std::max(1, (int)tas_optimizer_multigame_batch.value);
+    size_t max_in_flight = batch_size * std::max(1, (int)tas_optimizer_multigame_inflight.value);
+    auto batches = m_Coordinator.Deal(Sys_DoubleTime(), batch_size, max_in_flight, SV_NextCandidate);
+
+    for(auto& batch : batches) {
+        SV_SendBatch(batch.first, batch.second);
+    }
+}
+
+void TASQuake::MultiGame_Client_Disconnected(size_t connection_id) {
+    m_Coordinator.Remove_Client(connection_id);
+}
+
 static void SV_StartMultiGameOpt() {
     ++multi_game_opt_num;
     last_updated = Sys_DoubleTime();
@@ -337,13 +777,18 @@ static void SV_StartMultiGameOpt() {
     Get_Prediction_Frames(start_frame, end_frame);
     opt.m_settings = GetSettings();
 
-    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)IPCMessages::OptimizerTask;
     writer.WriteBytes(&type, sizeof(type));
     opt.m_settings.WriteToBuffer(writer);
     writer.WriteBytes(&start_frame, sizeof(start_frame));
     writer.WriteBytes(&end_frame, sizeof(end_frame));
     writer.WriteBytes(&multi_game_opt_num, sizeof(multi_game_opt_num));
+    multi_game_resync = false;
+    
+    m_dBestEfficacy = 0;
+    m_Coordinator.Reset();
+    opt.Init(info, &opt.m_settings);
 
     if(tas_optimizer_casper.value != 0)
     {
@@ -351,16 +796,18 @@ static void SV_StartMultiGameOpt() {
         // but now we want to have the optimizer figure out how to make it work with sv_casper 0
         TASScript script = info->current_script;
         script.RemoveCvarsFromRange("sv_casper", 0, info->Get_Last_Frame());
-        script.Write_To_Memory(writer);
+        SV_BroadCastScript(writer, script);
     }
     else
     {
-        info->current_script.Write_To_Memory(writer);
+        SV_BroadCastScript(writer, info->current_script);
     }
-    
-    m_dBestEfficacy = 0;
+}
 
-    SV_BroadCastMessage(writer.m_pBuffer->ptr, writer.m_uFileOffset);
+void TASQuake::MultiGame_Resync() {
+    if(multi_game_opt_running) {
+        multi_game_resync = true;
+    }
 }
 
 void TASQuake::Receive_Optimizer_Task(const ipc::Message& msg) {
@@ -373,33 +820,12 @@ void TASQuake::Receive_Optimizer_Task(const ipc::Message& msg) {
     reader.Read(&identifier, sizeof(identifier));
 
     auto info = GetPlaybackInfo();
-    TASScript script;
-    script.Load_From_Memory(reader);
-    //std::string incoming = script.ToString();
-    //std::string original = info->current_script.ToString();
     int32_t first_changed_frame;
-    info->current_script.ApplyChanges(&script, first_changed_frame);
-    Savestate_Script_Updated(first_changed_frame);
-#if 0
-    std::string updated = info->current_script.ToString();
-
-    if(updated != incoming)
-    {
-        Con_Printf("Update didnt match, incoming:\n%s\n", incoming.c_str());
-        Con_Printf("original:\n%s\n", original.c_str());
-        Con_Printf("updated:\n%s\n", updated.c_str());
-
-        for(size_t i=0; i < updated.size(); ++i)
-        {
-            if(updated[i] != incoming[i])
-            {
-                Con_Printf("at index %d \"%s\" != \"%s\"\n", i, updated.c_str() + i, incoming.c_str() + i);
-                break;
-            }
-        }
-
+    if(!CL_Apply_Script_Update(info->current_script, reader, first_changed_frame)) {
+        CL_Request_Resync();
+        return;
     }
-#endif
+    Savestate_Script_Updated(first_changed_frame);
 
     TASQuake::GameOpt_InitOptimizer(start, end, identifier, settings);
 }
@@ -413,11 +839,12 @@ void TASQuake::SV_StopMultiGameOpt() {
         return;
     }
 
-    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)IPCMessages::OptimizerStop;
     writer.WriteBytes(&type, sizeof(type));
     SV_BroadCastMessage(writer.m_pBuffer->ptr, writer.m_uFileOffset);
     multi_game_opt_running = false;
+    m_Coordinator.Reset();
 }
 
 static void MultiGameOpt_Frame(bool canPredict) {
@@ -434,7 +861,7 @@ static void MultiGameOpt_Frame(bool canPredict) {
 
     auto info = GetPlaybackInfo();
 
-    if(!multi_game_opt_running || info->last_edited > last_updated) {
+    if(!multi_game_opt_running || info->last_edited > last_updated || multi_game_resync) {
         if(!IPC_Prediction_HasLine()) {
             return; // Wait until IPC prediction has finished prior to sending new opt request
         }
@@ -446,6 +873,7 @@ static void MultiGameOpt_Frame(bool canPredict) {
 
         m_bFirstIteration = true;
         m_uOptIterations = 0;
+        m_dOptStartTime = Sys_DoubleTime();
         last_updated = info->last_edited;
 
         state = TASQuake::OptimizerState::ContinueIteration;
@@ -455,6 +883,8 @@ static void MultiGameOpt_Frame(bool canPredict) {
 
         SV_StartMultiGameOpt();
     }
+
+    SV_DealCandidates();
 }
 
 void TASQuake::RunOptimizer(bool canPredict)
@@ -470,6 +900,13 @@ static int32_t game_opt_start_frame = 0;
 static int32_t game_opt_end_frame = 0;
 static int32_t game_opt_identifier = 0;
 
+// Headless batch runs started with tas_optimizer_batch
+static bool batch_running = false;
+static char batch_output[MAX_OSPATH];
+static size_t batch_max_iterations = 0;
+static double batch_start_time = 0;
+static void Batch_Write_Results(bool success);
+
 
 void TASQuake::Receive_Optimizer_Run(const ipc::Message& msg) {
     auto reader = TASQuakeIO::BufferReadInterface::Init((std::uint8_t*)msg.address + 1, msg.length - 1);
@@ -482,7 +919,10 @@ void TASQuake::Receive_Optimizer_Run(const ipc::Message& msg) {
     }
 
     TASQuake::OptimizerRun newRun;
-    newRun.ReadFromBuffer(reader);
+    if(!newRun.ReadFromBuffer(reader)) {
+        Con_Printf("Invalid run received\n");
+        return;
+    }
 
     if(newRun.IsBetterThan(opt.m_currentBest)) {
         opt.m_currentBest = newRun;
@@ -494,18 +934,70 @@ void TASQuake::Receive_Optimizer_Run(const ipc::Message& msg) {
 }
 
 static void CL_SendRun(const OptimizerRun& run) {
-    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)IPCMessages::OptimizerRun;
     writer.WriteBytes(&type, 1);
     writer.WriteBytes(&game_opt_identifier, sizeof(game_opt_identifier));
-    run.WriteToBuffer(writer);
+    run.WriteToBuffer(writer, IPC_Trajectory_Encoding());
+    // The server already has the script, the checksum is enough to tell if the run was made against it
     auto info = GetPlaybackInfo();
-    info->current_script.Write_To_Memory(writer);
+    std::uint64_t checksum = info->current_script.Checksum();
+    writer.Write(&checksum);
+    TASQuake::CL_SendMessage(writer.m_pBuffer->ptr, writer.m_uFileOffset);
+}
+
+void TASQuake::Receive_Optimizer_Batch(const ipc::Message& msg) {
+    auto reader = TASQuakeIO::BufferReadInterface::Init((std::uint8_t*)msg.address + 1, msg.length - 1);
+    int32_t identifier;
+    std::uint32_t count;
+    reader.Read(&identifier, sizeof(identifier));
+
+    if(identifier != game_opt_identifier || !game_opt_running) {
+        Con_Printf("Batch discarded\n");
+        return;
+    }
+
+    reader.Read(&count, sizeof(count));
+
+    for(std::uint32_t i=0; i < count; ++i) {
+        ClientCandidate candidate;
+        reader.Read(&candidate.id, sizeof(candidate.id));
+        if(!candidate.script.Load_From_Memory(reader)) {
+            Con_Printf("Invalid candidate in optimizer batch\n");
+            return;
+        }
+        m_Candidates.push_back(std::move(candidate));
+    }
+}
+
+static void CL_SendResult(std::uint32_t id) {
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
+    uint8_t type = (uint8_t)IPCMessages::OptimizerResult;
+    writer.WriteBytes(&type, 1);
+    writer.WriteBytes(&game_opt_identifier, sizeof(game_opt_identifier));
+    writer.WriteBytes(&id, sizeof(id));
     TASQuake::CL_SendMessage(writer.m_pBuffer->ptr, writer.m_uFileOffset);
 }
 
+// Runs the next candidate from the server instead of the local mutation, if there is one
+static void CL_StartCandidate() {
+    if(m_Candidates.empty()) {
+        return;
+    }
+
+    // The local algorithm didn't produce the candidate, so it must not see its result
+    if(opt.m_iCurrentAlgorithm != -1) {
+        opt.m_vecAlgorithms[opt.m_iCurrentAlgorithm]->Reset();
+        opt.m_iCurrentAlgorithm = -1;
+    }
+
+    opt.m_currentRun.playbackInfo.current_script = std::move(m_Candidates.front().script);
+    m_uCurrentCandidate = m_Candidates.front().id;
+    m_Candidates.pop_front();
+}
+
 static void CL_SendOptimizerProgress(int iterations) {
-    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)IPCMessages::OptimizerProgress;
     writer.WriteBytes(&type, 1);
     writer.WriteBytes(&game_opt_identifier, sizeof(game_opt_identifier));
@@ -532,6 +1024,9 @@ void TASQuake::GameOpt_InitOptimizer(int32_t start_frame, int32_t end_frame, int
     game_opt_end_frame = end_frame;
     m_bFirstIteration = true;
     m_uOptIterations = 0;
+    m_dOptStartTime = Sys_DoubleTime();
+    m_Candidates.clear();
+    m_uCurrentCandidate = 0;
 
     if(!opt.Init(info, &_settings)) {
         return;
@@ -545,6 +1040,74 @@ void TASQuake::GameOpt_InitOptimizer(int32_t start_frame, int32_t end_frame, int
     game_opt_running = true;
 }
 
+void TASQuake::Cmd_TAS_Optimizer_Batch() {
+    if (Cmd_Argc() < 5) {
+        Con_Print("Usage: tas_optimizer_batch <script> <start> <end> <output> [max iterations]\n");
+        return;
+    }
+
+    char name[MAX_OSPATH];
+    // Leave room for the extension that COM_ForceExtension appends
+    if (snprintf(name, sizeof(name) - 5, "%s/tas/%s", com_gamedir, Cmd_Argv(1)) >= (int)sizeof(name) - 5
+        || snprintf(batch_output, sizeof(batch_output) - 5, "%s/tas/%s", com_gamedir, Cmd_Argv(4)) >= (int)sizeof(batch_output) - 5) {
+        Con_Printf("Path too long\n");
+        return;
+    }
+    COM_ForceExtension(name, ".qtas");
+
+    if (!TAS_Script_Load(name)) {
+        Con_Printf("Could not load script %s\n", name);
+        return;
+    }
+
+    batch_max_iterations = Cmd_Argc() > 5 ? atoi(Cmd_Argv(5)) : 0;
+    batch_start_time = Sys_DoubleTime();
+    batch_running = true;
+
+    int start = atoi(Cmd_Argv(2));
+    int end = atoi(Cmd_Argv(3));
+    auto settings = GetSettings();
+    settings.m_iFrames = end - start;
+    TASQuake::GameOpt_InitOptimizer(start, end, 0, settings);
+
+    if (!game_opt_running) {
+        Con_Printf("Optimizer failed to start\n");
+        Batch_Write_Results(false);
+    }
+}
+
+static void Batch_Write_Results(bool success) {
+    auto info = GetPlaybackInfo();
+    TASScript best = info->current_script;
+    best.AddScript(&opt.m_currentBest.playbackInfo.current_script, game_opt_start_frame);
+
+    char name[MAX_OSPATH];
+    snprintf(name, sizeof(name), "%s", batch_output);
+    COM_ForceExtension(name, ".qtas");
+    best.file_name = name;
+    best.Write_To_File();
+
+    snprintf(name, sizeof(name), "%s", batch_output);
+    COM_ForceExtension(name, ".txt");
+    FILE* fp = fopen(name, "w");
+
+    if (fp) {
+        fprintf(fp, "status %s\n", success ? "ok" : "failed");
+        fprintf(fp, "goal %s\n", TASQuake::OptimizerGoalStr());
+        fprintf(fp, "original %f\n", TASQuake::OriginalEfficacy());
+        fprintf(fp, "optimized %f\n", TASQuake::OptimizedEfficacy());
+        fprintf(fp, "iterations %zu\n", m_uOptIterations);
+        fprintf(fp, "seconds %f\n", Sys_DoubleTime() - batch_start_time);
+        fclose(fp);
+    } else {
+        Con_Printf("Could not write optimizer stats to %s\n", name);
+    }
+
+    Con_Printf("Optimizer batch %s after %zu iterations, wrote %s\n", success ? "finished" : "failed", m_uOptIterations, batch_output);
+    batch_running = false;
+    Cbuf_AddText("quit\n");
+}
+
 void TASQuake::Cmd_TAS_Optimizer_Run() {
 	if (Cmd_Argc() <= 2) {
         Con_Print("Usage: tas_optimizer_run <start> <end>\n");
@@ -579,7 +1142,7 @@ void TASQuake::MultiGame_ReceiveGoal(const ipc::Message& msg) {
 }
 
 static void CL_SendGoal() {
-    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)IPCMessages::OptimizerGoal;
     writer.WriteBytes(&type, 1);
     writer.WriteBytes(&game_opt_identifier, sizeof(game_opt_identifier));
@@ -588,6 +1151,12 @@ static void CL_SendGoal() {
 }
 
 static void GameOpt_NewIteration() {
+    if(m_uCurrentCandidate != 0) {
+        CL_SendResult(m_uCurrentCandidate);
+        m_uCurrentCandidate = 0;
+    }
+    CL_StartCandidate();
+
     auto info = GetPlaybackInfo();
     info->current_script.AddScript(&opt.m_currentRun.playbackInfo.current_script, game_opt_start_frame);
 
@@ -644,16 +1213,27 @@ static void Game_Opt_Add_FrameData(int current_frame) {
 }
 
 static void Game_Opt_Ended() {
+    if(batch_running && batch_max_iterations > 0 && m_uOptIterations + 1 >= batch_max_iterations) {
+        state = TASQuake::OptimizerState::Stop;
+    }
+
     if(state == TASQuake::OptimizerState::NewIteration) {
         CL_SendOptimizerProgress(m_uOptIterations + 1);
         GameOpt_NewIteration();
     } else if(state == TASQuake::OptimizerState::Stop) {
         Con_Printf("Optimizer ran to completion\n");
         game_opt_running = false;
-        Run_Script(game_opt_start_frame, true);
+        if(batch_running) {
+            Batch_Write_Results(true);
+        } else {
+            Run_Script(game_opt_start_frame, true);
+        }
     } else {
         Con_Printf("Optimizer ended with invalid state\n");
         game_opt_running = false;
+        if(batch_running) {
+            Batch_Write_Results(false);
+        }
     }
 }
 
@@ -7,9 +7,13 @@
 extern cvar_t tas_optimizer;
 extern cvar_t tas_optimizer_algs;
 extern cvar_t tas_optimizer_casper;
+extern cvar_t tas_optimizer_checkpoints;
 extern cvar_t tas_optimizer_goal;
 extern cvar_t tas_optimizer_multigame;
+extern cvar_t tas_optimizer_multigame_batch; // Candidates per batch dealt to a multi-game client
+extern cvar_t tas_optimizer_multigame_inflight; // Batches each multi-game client keeps queued
 extern cvar_t tas_optimizer_secondarygoals;
+extern cvar_t tas_optimizer_threads;
 struct TASScript;
 
 namespace TASQuake {
@@ -18,16 +22,22 @@ namespace TASQuake {
     double OriginalEfficacy();
     double OptimizedEfficacy();
     std::size_t OptimizerIterations();
+    double OptimizerIterationsPerSecond();
     const TASScript* GetOptimizedVersion();
     void Optimizer_Frame_Hook();
     void GameOpt_InitOptimizer(int32_t start_frame, int32_t end_frame, int32_t identifier, const OptimizerSettings& settings);
+    void Cmd_TAS_Optimizer_Batch();
     void Cmd_TAS_Optimizer_Run();
     void Receive_Optimizer_Task(const ipc::Message& msg);
     void Receive_Optimizer_Run(const ipc::Message& msg);
+    void Receive_Optimizer_Batch(const ipc::Message& msg);
     void Receive_Optimizer_Stop();
     void MultiGame_ReceiveRun(const ipc::Message& msg);
     void MultiGame_ReceiveProgress(const ipc::Message& msg);
     void MultiGame_ReceiveGoal(const ipc::Message& msg);
+    void MultiGame_ReceiveResult(const ipc::Message& msg);
+    void MultiGame_Client_Disconnected(size_t connection_id); // Deals out the candidates the client had to the others
+    void MultiGame_Resync(); // Restart the multi-game optimizer after a client asked for the full script
     void SV_StopMultiGameOpt();
     void Get_Prediction_Frames(int32_t& start_frame, int32_t& end_frame);
 }
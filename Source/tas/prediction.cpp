@@ -1,3 +1,8 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "cpp_quakedef.hpp"
 #include "hooks.h"
 #include "draw.hpp"
@@ -10,6 +15,7 @@ cvar_t tas_predict_per_frame{"tas_predict_per_frame", "0.01"};
 cvar_t tas_predict{"tas_predict", "1"};
 cvar_t tas_predict_grenade { "tas_predict_grenade", "0" };
 cvar_t tas_predict_maxlength{"tas_predict_maxlength", "10"};
+cvar_t tas_predict_thread{"tas_predict_thread", "1"};
 const std::array<float, 4> color = { 0, 0, 1, 0.5 };
 static std::vector<PathPoint> points;
 static std::vector<Rect> rects;
@@ -39,6 +45,225 @@ void TASQuake::Get_Prediction_Frames(int32_t& start_frame, int32_t& end_frame) {
     end_frame = start_frame + diffy;
 }
 
+// The line being simulated. While the prediction thread runs it owns the line,
+// the main thread only touches it while the thread is held.
+struct PredictionLine
+{
+	PlaybackInfo playback; // Copy of the playback state the line is simulated with
+	Simulator sim;
+	edict_t* player = nullptr;
+	int32_t last_sim_frame = 0;
+	std::vector<PathPoint> points;
+	std::vector<Rect> rects;
+	std::vector<SimulationInfo> snapshots; // Simulator state at the start of the frame each point was drawn on
+	std::uint32_t version = 0; // Bumped whenever points or rects change
+
+	void Restart(const PlaybackInfo* current, bool same_start);
+	void Rebuild_Rects();
+	bool Run_Frame();
+	void Clear();
+};
+
+// Simulates the prediction line in the background. The thread is held from the start of a host frame until
+// rendering, so commands, physics and script edits never change the game state while it simulates.
+struct PredictionThread
+{
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::atomic<bool> hold{true};
+	bool parked = true;
+	bool has_work = false;
+	bool exit = false;
+
+	~PredictionThread() { Stop(); }
+	void Start();
+	void Stop();
+	void Hold();
+	void Release();
+	void ThreadMain();
+};
+
+static PredictionLine line;
+static PredictionThread prediction_thread;
+
+void PredictionLine::Restart(const PlaybackInfo* current, bool same_start)
+{
+	int32_t start_frame;
+	TASQuake::Get_Prediction_Frames(start_frame, last_sim_frame);
+	size_t resume_index = 0;
+
+	// Frames before the first effective change simulate the same way, keep them
+	if (same_start)
+	{
+		int changed_frame = playback.current_script.FirstEffectiveChange(&current->current_script);
+		int64_t changed_index = static_cast<int64_t>(changed_frame) - start_frame;
+		changed_index = std::min<int64_t>(changed_index, last_sim_frame - start_frame);
+		resume_index = std::clamp<int64_t>(changed_index, 0, snapshots.size());
+	}
+
+	playback = *current;
+
+	if (resume_index == 0)
+	{
+		sim = Simulator::GetSimulator();
+	}
+	else if (resume_index < snapshots.size())
+	{
+		sim.info = snapshots[resume_index];
+		sim.frame = start_frame + resume_index;
+	}
+
+	sim.playback = &playback;
+	player = sv_player;
+	points.resize(resume_index);
+	snapshots.resize(resume_index);
+	Rebuild_Rects();
+	++version;
+
+	points.reserve(last_sim_frame - start_frame);
+	snapshots.reserve(last_sim_frame - start_frame);
+}
+
+void PredictionLine::Rebuild_Rects()
+{
+	int start_frame = playback.current_frame;
+	int prev_frame = start_frame - 1;
+	rects.clear();
+
+	for (auto& block : playback.current_script.blocks)
+	{
+		int index = block.frame - start_frame;
+		if (block.frame <= prev_frame)
+			continue;
+		else if (index >= points.size())
+			break;
+
+		Rect rect = Rect::Get_Rect(color, points[index].point, 3, 3, PREDICTION_ID);
+		rects.push_back(rect);
+		prev_frame = block.frame;
+	}
+}
+
+// Returns false once the line is finished or can't progress
+bool PredictionLine::Run_Frame()
+{
+	if (sim.frame >= last_sim_frame)
+		return false;
+
+	PathPoint vec;
+	vec.color[3] = 1;
+	if (sim.info.collision)
+	{
+		vec.color[0] = 1;
+	}
+	else
+	{
+		vec.color[1] = 1;
+	}
+	VectorCopy(sim.info.ent.v.origin, vec.point);
+	points.push_back(vec);
+	snapshots.push_back(sim.info);
+
+	auto block = playback.Get_Current_Block(sim.frame);
+	if (block && block->frame == sim.frame)
+	{
+		Rect rect = Rect::Get_Rect(color, sim.info.ent.v.origin, 3, 3, PREDICTION_ID);
+		rects.push_back(rect);
+	}
+
+	int frame = sim.frame;
+	sim.RunFrame();
+	++version;
+
+	return sim.frame != frame;
+}
+
+void PredictionLine::Clear()
+{
+	points.clear();
+	rects.clear();
+	snapshots.clear();
+	sim.frame = last_sim_frame = 0;
+	++version;
+}
+
+void PredictionThread::Start()
+{
+	if (thread.joinable())
+		return;
+
+	exit = false;
+	parked = true;
+	thread = std::thread([this]() { ThreadMain(); });
+}
+
+void PredictionThread::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		exit = true;
+		hold = true;
+	}
+	cv.notify_all();
+
+	if (thread.joinable())
+		thread.join();
+
+	parked = true;
+}
+
+void PredictionThread::Hold()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	hold = true;
+	cv.wait(lock, [this]() { return parked; });
+}
+
+void PredictionThread::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		hold = false;
+		has_work = line.sim.frame < line.last_sim_frame;
+	}
+	cv.notify_all();
+}
+
+void PredictionThread::ThreadMain()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;)
+	{
+		parked = true;
+		cv.notify_all();
+		cv.wait(lock, [this]() { return exit || (!hold && has_work); });
+		if (exit)
+			return;
+
+		parked = false;
+		sv_player = line.player;
+		lock.unlock();
+
+		while (!hold && line.Run_Frame())
+			;
+
+		lock.lock();
+		has_work = false;
+	}
+}
+
+void Prediction_Thread_Hold()
+{
+	prediction_thread.Hold();
+}
+
+void Prediction_Thread_Release()
+{
+	prediction_thread.Release();
+}
+
 bool Calculate_Prediction_Line(bool canPredict)
 {
 	static int startFrame = -1;
@@ -48,54 +273,42 @@ bool Calculate_Prediction_Line(bool canPredict)
 			RemoveCurve(PREDICTION_ID);
 			RemoveRectangles(PREDICTION_ID);
 			path_assigned = false;
+			line.Clear();
 		}
 		return false;
 	}
 
 	auto playback = GetPlaybackInfo();
 	static double last_updated = 0; 
+	static std::uint32_t published_version = 0;
 	double currentTime = Sys_DoubleTime();
-	static int32_t last_sim_frame = 0;
-	static Simulator sim;
 
 	if (last_updated < playback->last_edited || startFrame != playback->current_frame)
 	{
-		rects.clear();
-		points.clear();
+		line.Restart(playback, startFrame == playback->current_frame);
 		last_updated = currentTime;
 		startFrame = playback->current_frame;
-		sim = Simulator::GetSimulator();
-		int32_t start_frame;
-		TASQuake::Get_Prediction_Frames(start_frame, last_sim_frame);
-
-		points.reserve(last_sim_frame - start_frame);
 	}
 
-	double realTimeStart = Sys_DoubleTime();
-
-	while (Sys_DoubleTime() - realTimeStart < tas_predict_per_frame.value && sim.frame < last_sim_frame)
+	if (tas_predict_thread.value != 0)
 	{
-		PathPoint vec;
-		vec.color[3] = 1;
-		if (sim.info.collision)
-		{
-			vec.color[0] = 1;
-		}
-		else
-		{
-			vec.color[1] = 1;
-		}
-		VectorCopy(sim.info.ent.v.origin, vec.point);
-		points.push_back(vec);
+		prediction_thread.Start();
+	}
+	else
+	{
+		prediction_thread.Stop();
+		double realTimeStart = Sys_DoubleTime();
 
-		auto block = playback->Get_Current_Block(sim.frame);
-		if (block && block->frame == sim.frame)
-		{
-			Rect rect = Rect::Get_Rect(color, sim.info.ent.v.origin, 3, 3, PREDICTION_ID);
-			rects.push_back(rect);
-		}
+		while (Sys_DoubleTime() - realTimeStart < tas_predict_per_frame.value && line.Run_Frame())
+			;
+	}
 
-		sim.RunFrame();
+	// The renderer draws its own copy, the line keeps changing while the thread runs
+	if (published_version != line.version)
+	{
+		points = line.points;
+		rects = line.rects;
+		published_version = line.version;
 	}
 
 	if (!path_assigned)
@@ -103,7 +316,7 @@ bool Calculate_Prediction_Line(bool canPredict)
 		path_assigned = true;
 	}
 
-	return sim.frame >= last_sim_frame;
+	return line.sim.frame >= line.last_sim_frame;
 }
 
 void Predict_Grenade(std::function<void(vec3_t)> frameCallback, std::function<void(vec3_t)> finalCallback, vec3_t origin, vec3_t v_angle)
@@ -136,10 +349,11 @@ void Predict_Grenade(std::function<void(vec3_t)> frameCallback, std::function<vo
 	const float alivetime = 2.5f;
 	double hfr = 1 / cl_maxfps.value;
 	int frames = alivetime * cl_maxfps.value;
+	trace_context_t* ctx = SV_ThreadTraceContext();
 
 	for (int i = 0; i < frames; ++i)
 	{
-		Simulate_SV_Physics_Toss(&t, hfr);
+		Simulate_SV_Physics_Toss(ctx, &t, hfr);
 		frameCallback(t.v.origin);
 	}
 
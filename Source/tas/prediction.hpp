@@ -9,8 +9,12 @@ extern bool grenade_assigned;
 
 extern cvar_t tas_predict_endoffset;
 extern cvar_t tas_predict_maxlength;
+// desc: Simulate the prediction line on a background thread while the game renders, instead of for tas_predict_per_frame seconds each frame.
+extern cvar_t tas_predict_thread;
 
 bool Calculate_Prediction_Line(bool canPredict);
+void Prediction_Thread_Hold(); // Waits until the prediction thread stops touching the game state
+void Prediction_Thread_Release();
 void Calculate_Grenade_Line(bool canPredict);
 
 bool Prediction_HasLine();
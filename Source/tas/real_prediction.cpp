@@ -27,12 +27,12 @@ void GamePrediction_Receive_IPC(ipc::Message& msg) {
     data.m_vecFBdata.clear();
     data.m_vecPoints.clear();
 
-    TASScript script;
-    script.Load_From_Memory(iface);
-
     auto info = GetPlaybackInfo();
-    int first_changed_frame = 0;
-    info->current_script.ApplyChanges(&script, first_changed_frame);
+    int first_changed_frame;
+    if(!TASQuake::CL_Apply_Script_Update(info->current_script, iface, first_changed_frame)) {
+        TASQuake::CL_Request_Resync();
+        return;
+    }
     first_changed_frame = std::min(first_changed_frame, data.m_iStartFrame);
 	Savestate_Script_Updated(first_changed_frame);
     info->last_edited = Sys_DoubleTime();
@@ -42,11 +42,11 @@ void GamePrediction_Receive_IPC(ipc::Message& msg) {
 
 static void GamePredition_IPC_Respond() {
     ipc_request_finished = true;
-    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    auto writer = TASQuakeIO::BufferWriteInterface::InitArena();
     uint8_t type = (uint8_t)TASQuake::IPCMessages::Predict;
     writer.WriteBytes(&type, sizeof(type));
     writer.Write(&ipc_prediction_id);
-    data.Write_To_Memory(writer);
+    data.Write_To_Memory(writer, TASQuake::IPC_Trajectory_Encoding());
     TASQuake::CL_SendMessage(writer.m_pBuffer->ptr, writer.m_uFileOffset);
 }
 
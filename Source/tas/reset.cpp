@@ -24,7 +24,9 @@ static const char* const EXCLUDE_CVARS[] = {"gl_texturemode",
 											"tas_ipc",
 											"tas_reward",
 											"tas_freecam",
-											"tas_optimizer"};
+											"tas_optimizer",
+											"tas_trace_cache",
+											"tas_trace_record"};
 
 static const char* const INCLUDE_SUBSTR[] = {"cl_", "sv_", "tas_", "gl_", "r_", "v_centerspeed"};
 
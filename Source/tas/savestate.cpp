@@ -1,11 +1,52 @@
-
+#include <algorithm>
+#include <climits>
+#include <cstdio>
 #include <map>
 #include <fstream>
+#include <memory>
+#include <vector>
 #include "cpp_quakedef.hpp"
+extern "C"
+{
+#include "../net_loop.h"
+}
 #include "savestate.hpp"
 #include "afterframes.hpp"
 #include "libtasquake/utils.hpp"
 #include "hooks.h"
+#include "script_playback.hpp"
+
+const int MAX_PARTICLES = 2048;
+
+// Raw copy of the game state, only valid for the server instance it was taken from
+struct MemoryState
+{
+	int spawn_id;
+
+	// Server
+	std::vector<byte> edicts;
+	std::vector<byte> areanodes;
+	std::vector<float> globals;
+	int num_edicts;
+	double time;
+	int lastcheck;
+	double lastchecktime;
+	char* lightstyles[MAX_LIGHTSTYLES];
+	float spawn_parms[NUM_SPAWN_PARMS];
+	int old_frags;
+	std::vector<byte> client_message;
+	rng_state_t rng;
+
+	// Client
+	client_state_t cl;
+	std::vector<entity_t> entities;
+	lightstyle_t lightstyle[MAX_LIGHTSTYLES];
+	dlight_t dlights[MAX_DLIGHTS];
+	beam_t beams[MAX_BEAMS];
+	std::vector<r_particle_t> particles;
+	r_particle_t* active_particles;
+	r_particle_t* free_particles;
+};
 
 struct Savestate
 {
@@ -14,500 +55,489 @@ struct Savestate
 
 	int frame;
 	int number;
+	bool level_start = false;
+	unsigned int last_used = 0;
+	// Game state hash on the frame, used to tell whether the state survived a script edit
+	unsigned int hash = 0;
+	// Cleared by edits before the frame, set again when replaying reaches the same state
+	bool verified = true;
+	// Latest edited frame before this one since the state was made
+	int last_edit = -1;
+	std::shared_ptr<MemoryState> memory;
 };
 
-static int save_number = 0;
 static int current_frame = 0;
+static int edit_frame = 0;
+static unsigned int use_counter = 0;
 static bool in_playback = false;
-const int MAX_PARTICLES = 2048;
+static int spawn_id = 0;
+static std::shared_ptr<MemoryState> pending_restore;
 static std::map<int, Savestate> savestateMap;
 cvar_t tas_savestate_auto = {"tas_savestate_auto", "0"};
 cvar_t tas_savestate_prefix = {"tas_savestate_prefix", "ss_"};
 cvar_t tas_savestate_enabled = {"tas_savestate_enabled", "1"};
+cvar_t tas_savestate_memory = {"tas_savestate_memory", "1"};
+cvar_t tas_savestate_max = {"tas_savestate_max", "64"};
+cvar_t tas_savestate_budget = {"tas_savestate_budget", "512"};
 const int frequency = 100;
 
 void SS(const char* savename);
 
-static bool Can_Savestate()
+// Static entities are left out, they are all spawned by the time a savestate can be made and never change after
+static std::shared_ptr<MemoryState> Take_Memory_State()
 {
-	return cls.state == ca_connected && cls.signon == SIGNONS && tas_playing.value == 1 && cl.intermission == 0 && tas_savestate_enabled.value != 0;;
-}
+	auto state = std::make_shared<MemoryState>();
 
-static void Create_Savestate(int frame, bool force)
-{
-	static char BUFFER[80];
-
-	if (!Can_Savestate())
-	{
-		if(force)
-			Con_Print("Cannot savestate on current frame.\n");
-
-		return;
-	}
-
-	if (!force)
-	{
-		auto it = savestateMap.find(frame);
+	state->spawn_id = spawn_id;
+	state->num_edicts = sv.num_edicts;
+	state->edicts.resize(sv.num_edicts * pr_edict_size);
+	memcpy(state->edicts.data(), sv.edicts, state->edicts.size());
+	state->areanodes.resize(SV_AreaNodesSize());
+	SV_SaveAreaNodes(state->areanodes.data());
+	state->globals.assign(pr_globals, pr_globals + progs->numglobals);
+	state->time = sv.time;
+	state->lastcheck = sv.lastcheck;
+	state->lastchecktime = sv.lastchecktime;
+	memcpy(state->lightstyles, sv.lightstyles, sizeof(sv.lightstyles));
+	memcpy(state->spawn_parms, svs.clients->spawn_parms, sizeof(state->spawn_parms));
+	state->old_frags = svs.clients->old_frags;
+	state->client_message.assign(svs.clients->message.data, svs.clients->message.data + svs.clients->message.cursize);
+	Get_RNG_State(&state->rng);
 
-		if(it != savestateMap.end())
-			return;
-	}
+	state->cl = cl;
+	state->entities.assign(cl_entities, cl_entities + cl.num_entities);
+	memcpy(state->lightstyle, cl_lightstyle, sizeof(cl_lightstyle));
+	memcpy(state->dlights, cl_dlights, sizeof(cl_dlights));
+	memcpy(state->beams, cl_beams, sizeof(cl_beams));
+	state->particles.assign(r_particles, r_particles + MAX_PARTICLES);
+	state->active_particles = r_active_particles;
+	state->free_particles = r_free_particles;
 
-	snprintf(BUFFER, ARRAYSIZE(BUFFER), "savestates/%s%d", tas_savestate_prefix.string, save_number);
-	SS(BUFFER);
-	savestateMap[frame] = Savestate(frame, save_number);
-	++save_number;
+	return state;
 }
 
-int Savestate_Load_State(int frame)
+static void Restore_Memory_State(const MemoryState& state)
 {
-	if (savestateMap.empty() || tas_savestate_enabled.value == 0)
-		return -1;
-
-	auto exact_match = savestateMap.find(frame);
-	auto it = savestateMap.lower_bound(frame);
+	// Edicts allocated after the state was taken are not in the restored area links
+	if (sv.num_edicts > state.num_edicts)
+		memset((byte*)sv.edicts + state.edicts.size(), 0, (sv.num_edicts - state.num_edicts) * pr_edict_size);
 
-	int number;
-	int savestate_frame;
-
-
-	if (exact_match != savestateMap.end())
-	{
-		auto elem = exact_match->second;
-		savestate_frame = elem.frame;
-		number = elem.number;
-	}
-	else if (it == savestateMap.begin())
-		return -1;
-	else
-	{
-		--it;
-		auto elem = it->second;
-		savestate_frame = elem.frame;
-		number = elem.number;
-	}
+	memcpy(sv.edicts, state.edicts.data(), state.edicts.size());
+	SV_RestoreAreaNodes(state.areanodes.data());
+	memcpy(pr_globals, state.globals.data(), state.globals.size() * sizeof(float));
+	sv.num_edicts = state.num_edicts;
+	sv.time = state.time;
+	sv.lastcheck = state.lastcheck;
+	sv.lastchecktime = state.lastchecktime;
+	sv.paused = qfalse;
+	memcpy(sv.lightstyles, state.lightstyles, sizeof(sv.lightstyles));
+	memcpy(svs.clients->spawn_parms, state.spawn_parms, sizeof(state.spawn_parms));
+	svs.clients->old_frags = state.old_frags;
+	SZ_Clear(&svs.clients->message);
+	if (!state.client_message.empty())
+		SZ_Write(&svs.clients->message, (void*)state.client_message.data(), state.client_message.size());
+	SZ_Clear(&sv.datagram);
+	SZ_Clear(&sv.reliable_datagram);
+	Loop_Flush(); // Messages already sent describe the state that is being replaced
+	Set_RNG_State(&state.rng);
 
-	static char BUFFER[80];
-	snprintf(BUFFER, ARRAYSIZE(BUFFER), "tas_ls savestates/%s%d", tas_savestate_prefix.string, number);
-	tas_gamestate = loading;
-	AddAfterframes(1, "disconnect", NoFilter);
-	AddAfterframes(2, BUFFER, NoFilter);
+	cl = state.cl;
+	memcpy(cl_entities, state.entities.data(), state.entities.size() * sizeof(entity_t));
+	memcpy(cl_lightstyle, state.lightstyle, sizeof(cl_lightstyle));
+	memcpy(cl_dlights, state.dlights, sizeof(cl_dlights));
+	memcpy(cl_beams, state.beams, sizeof(cl_beams));
+	memcpy(r_particles, state.particles.data(), state.particles.size() * sizeof(r_particle_t));
+	r_active_particles = state.active_particles;
+	r_free_particles = state.free_particles;
 
+	S_StopAllSounds(qtrue);
 
-	return savestate_frame;
+	// A demo would jump backwards in time, the file based savestates stop it by disconnecting
+	if (cls.demorecording)
+		CL_Stop_f();
 }
 
-static bool Should_Savestate(int frame, int target_frame)
+static size_t Memory_State_Size(const MemoryState& state)
 {
-	if(frame < 10)
-		return false;
-	else if(cl.movemessages == 0)
-		return true;
-	else if(frame % frequency == 0 && target_frame - frame < 500 && tas_savestate_auto.value != 0)
-		return true;
-	else
-		return false;
+	return sizeof(MemoryState) + state.edicts.size() + state.areanodes.size() + state.globals.size() * sizeof(float)
+	       + state.client_message.size() + state.entities.size() * sizeof(entity_t)
+	       + state.particles.size() * sizeof(r_particle_t);
 }
 
-void Savestate_Frame_Hook(int frame, int target_frame)
+static void Hash_Bytes(unsigned int& hash, const void* data, size_t size)
 {
-	current_frame = frame;
+	const byte* bytes = (const byte*)data;
 
-	if (Should_Savestate(frame, target_frame))
-		Create_Savestate(frame, false);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
 }
 
-void Savestate_Script_Updated(int frame)
+// FNV-1a of the entity fields, globals, view angles, RNG state and stacked script values.
+// Area links and other pointers are left out since they differ between otherwise identical states.
+static unsigned int Game_State_Hash()
 {
-	auto it = savestateMap.lower_bound(frame);
+	unsigned int hash = 2166136261u;
+	size_t fields_size = pr_edict_size - offsetof(edict_t, v);
 
-	for (auto it = savestateMap.begin(); it != savestateMap.end(); ++it)
+	Hash_Bytes(hash, &sv.time, sizeof(sv.time));
+	Hash_Bytes(hash, &sv.num_edicts, sizeof(sv.num_edicts));
+
+	for (int i = 0; i < sv.num_edicts; ++i)
 	{
-		if (it->first > frame)
-		{
-			savestateMap.erase(it, savestateMap.end());
-			break;
-		}
+		edict_t* ed = EDICT_NUM(i);
+		Hash_Bytes(hash, &ed->free, sizeof(ed->free));
+		if (!ed->free)
+			Hash_Bytes(hash, &ed->v, fields_size);
 	}
 
+	Hash_Bytes(hash, pr_globals, progs->numglobals * sizeof(float));
+	Hash_Bytes(hash, cl.viewangles, sizeof(cl.viewangles));
 
-	save_number = savestateMap.size();
+	// An edit can change how often random() was called without changing any field
+	rng_state_t rng;
+	Get_RNG_State(&rng);
+	Hash_Bytes(hash, &rng, sizeof(rng));
+
+	std::string stacked = GetPlaybackInfo()->stacked.GetCommand();
+	Hash_Bytes(hash, stacked.data(), stacked.size());
+
+	return hash;
 }
 
-void Savestate_Playback_Started(int target_frame)
+static bool Memory_State_Valid(const Savestate& state)
 {
-	const int fps = 72;
+	return state.memory && state.memory->spawn_id == spawn_id && tas_savestate_memory.value != 0;
 }
 
-void Cmd_TAS_Savestate(void)
+static bool Can_Savestate()
 {
-	Create_Savestate(current_frame, true);
+	return cls.state == ca_connected && cls.signon == SIGNONS && tas_playing.value == 1 && cl.intermission == 0 && tas_savestate_enabled.value != 0;;
 }
 
-void GrabEntity(std::ifstream& in, char* data)
+static void Savestate_Path(char* buffer, size_t size, int number)
 {
-	char c;
-	Read(in, c);
+	snprintf(buffer, size, "savestates/%s%d", tas_savestate_prefix.string, number);
+}
 
-	while (c != '}' && in.good())
-	{
-		*data = c;
-		++data;
-		Read(in, c);
-	}
+static void Delete_Savestate_File(int number)
+{
+	char name[MAX_OSPATH];
+	char path[80];
 
-	*data = c;
-	++data;
-	*data = '\0';
+	Savestate_Path(path, ARRAYSIZE(path), number);
+	snprintf(name, ARRAYSIZE(name), "%s/%s.sav", com_gamedir, path);
+	remove(name);
 }
 
-static ddef_t* ED_FieldAtOfs(int ofs)
+// Lowest file number not used by any state, so evicted files get overwritten instead of piling up
+static int Free_Save_Number()
 {
-	ddef_t* def;
-	int	i;
+	std::vector<bool> used(savestateMap.size() + 1, false);
 
-	for (i = 0; i < progs->numfielddefs; i++)
+	for (auto& pair : savestateMap)
 	{
-		def = &pr_fielddefs[i];
-		if (def->ofs == ofs)
-			return def;
+		if (pair.second.number >= 0 && pair.second.number < (int)used.size())
+			used[pair.second.number] = true;
 	}
 
-	return NULL;
-}
+	int number = 0;
+	while (used[number])
+		++number;
 
+	return number;
+}
 
-/*
-============
-ED_FindField
-============
-*/
-static ddef_t* ED_FindField(char* name)
+// How much playback a state saves, relative to its neighbours and distance from the edit point
+static double Savestate_Usefulness(std::map<int, Savestate>::const_iterator it)
 {
-	ddef_t* def;
-	int	i;
-
-	for (i = 0; i < progs->numfielddefs; i++)
-	{
-		def = &pr_fielddefs[i];
-		if (!strcmp(pr_strings + def->s_name, name))
-			return def;
-	}
+	int prev = it == savestateMap.begin() ? 0 : std::prev(it)->first;
+	auto next_it = std::next(it);
+	int next = next_it == savestateMap.end() ? std::max(it->first, edit_frame) : next_it->first;
+	int distance = std::abs(it->first - edit_frame);
 
-	return NULL;
+	return (double)(next - prev) / (1 + distance / (double)frequency);
 }
 
-static qboolean _ED_ParseEpair(void* base, ddef_t* key, char* s)
+static std::map<int, Savestate>::iterator Least_Useful_Savestate(bool with_memory, int keep_frame)
 {
-	int		i;
-	char		string[128];
-	ddef_t* def;
-	char* v, * w;
-	void* d;
-	dfunction_t* func;
-	int val;
+	auto worst = savestateMap.end();
+	double worst_usefulness = 0;
 
-	d = (void*)((int*)base + key->ofs);
-
-	switch (key->type & ~DEF_SAVEGLOBAL)
+	// Unverified states go first. Level starts are kept as long as possible since they cannot be
+	// recreated without playing the level
+	for (int pass = 0; pass < 3 && worst == savestateMap.end(); ++pass)
 	{
-	case ev_string:
-		*(string_t*)d = ED_NewString(s) - pr_strings;
-		break;
-
-	case ev_float:
-		val = atoi(s);
-		*(float*)d = *reinterpret_cast<float*>(&val);
-		break;
-
-	case ev_vector:
-		strcpy(string, s);
-		v = string;
-		w = string;
-		for (i = 0; i < 3; i++)
+		for (auto it = savestateMap.begin(); it != savestateMap.end(); ++it)
 		{
-			while (*v && *v != ' ')
-				v++;
-			*v = 0;
-			((float*)d)[i] = atof(w);
-			w = v = v + 1;
-		}
-		break;
+			auto& state = it->second;
+			int state_pass = !state.verified ? 0 : state.level_start ? 2 : 1;
 
-	case ev_entity:
-		*(int*)d = EDICT_TO_PROG(EDICT_NUM(atoi(s)));
-		break;
+			if (state_pass != pass || (with_memory && !state.memory) || it->first == keep_frame)
+				continue;
 
-	case ev_field:
-		if (!(def = ED_FindField(s)))
-		{
-			// LordHavoc: don't warn about worldspawn sky/fog fields
-			// because they don't require mod support
-			if (strcmp(s, "sky") && strncmp(s, "fog_", 4))
-				Con_Printf("Can't find field %s\n", s);
-			return qfalse;
-		}
-		*(int*)d = G_INT(def->ofs);
-		break;
+			double usefulness = Savestate_Usefulness(it);
 
-	case ev_function:
-		if (!(func = ED_FindFunction(s)))
-		{
-			Con_Printf("Can't find function %s\n", s);
-			return qfalse;
+			if (worst == savestateMap.end() || usefulness < worst_usefulness
+			    || (usefulness == worst_usefulness && state.last_used < worst->second.last_used))
+			{
+				worst = it;
+				worst_usefulness = usefulness;
+			}
 		}
-		*(func_t*)d = func - pr_functions;
-		break;
-
-	default:
-		break;
 	}
 
-	return qtrue;
+	return worst;
 }
 
-/*
-====================
-ED_ParseEdict
-
-Parses an edict out of the given string, returning the new position
-ed should be a properly initialized empty edict.
-Used for initial level load and for savegames.
-====================
-*/
-static char* SS_ED_ParseEdict(char* data, edict_t* ent)
+static void Evict_Savestates(int keep_frame)
 {
-	ddef_t* key;
-	qboolean	anglehack;
-	qboolean	init;
-	char		keyname[256];
-	int		n;
-
-	init = qfalse;
+	int max_states = std::max(1, (int)tas_savestate_max.value);
 
-	// clear it
-	if (ent != sv.edicts)	// hack
-		memset(&ent->v, 0, progs->entityfields * 4);
-
-	// go through all the dictionary pairs
-	while (1)
+	while ((int)savestateMap.size() > max_states)
 	{
-		// parse key
-		data = COM_Parse(data);
-		if (com_token[0] == '}')
+		auto it = Least_Useful_Savestate(false, keep_frame);
+		if (it == savestateMap.end())
 			break;
-		if (!data)
-			Sys_Error("ED_ParseEntity: EOF without closing brace");
 
-		// anglehack is to allow QuakeEd to write single scalar angles
-		// and allow them to be turned into vectors. (FIXME...)
-		if (!strcmp(com_token, "angle"))
-		{
-			strcpy(com_token, "angles");
-			anglehack = qtrue;
-		}
-		else
-			anglehack = qfalse;
+		Delete_Savestate_File(it->second.number);
+		savestateMap.erase(it);
+	}
 
-		// FIXME: change light to _light to get rid of this hack
-		if (!strcmp(com_token, "light"))
-			strcpy(com_token, "light_lev");	// hack for single light def
+	size_t budget = (size_t)std::max(0.0f, tas_savestate_budget.value) * 1024 * 1024;
+	size_t used = 0;
 
-		strcpy(keyname, com_token);
+	for (auto& pair : savestateMap)
+	{
+		if (pair.second.memory)
+			used += Memory_State_Size(*pair.second.memory);
+	}
 
-		// another hack to fix keynames with trailing spaces
-		n = strlen(keyname);
-		while (n && keyname[n - 1] == ' ')
-		{
-			keyname[n - 1] = 0;
-			n--;
-		}
+	// Over the memory budget only the binary copy is dropped, the state can still be loaded from file
+	while (used > budget)
+	{
+		auto it = Least_Useful_Savestate(true, keep_frame);
+		if (it == savestateMap.end())
+			break;
 
-		// parse value	
-		if (!(data = COM_Parse(data)))
-			Sys_Error("ED_ParseEntity: EOF without closing brace");
+		used -= Memory_State_Size(*it->second.memory);
+		it->second.memory.reset();
+	}
+}
 
-		if (com_token[0] == '}')
-			Sys_Error("ED_ParseEntity: closing brace without data");
+static void Create_Savestate(int frame, bool force)
+{
+	static char BUFFER[80];
 
-		init = qtrue;
+	if (!Can_Savestate())
+	{
+		if(force)
+			Con_Print("Cannot savestate on current frame.\n");
 
-		// keynames with a leading underscore are used for utility comments,
-		// and are immediately discarded by quake
-		if (keyname[0] == '_')
-			continue;
+		return;
+	}
 
-		if (!(key = ED_FindField(keyname)))
-		{
-			Con_Printf("'%s' is not a field\n", keyname);
-			continue;
-		}
+	if (!force)
+	{
+		auto it = savestateMap.find(frame);
 
-		if (anglehack)
+		if (it != savestateMap.end())
 		{
-			char	temp[32];
-
-			strcpy(temp, com_token);
-			sprintf(com_token, "0 %s 0", temp);
+			// Server was respawned since the state was made, retake the in-memory copy
+			if (tas_savestate_memory.value != 0 && !Memory_State_Valid(it->second))
+			{
+				it->second.memory = Take_Memory_State();
+				Evict_Savestates(frame);
+			}
+			return;
 		}
-
-		if (!_ED_ParseEpair((void*)&ent->v, key, com_token))
-			Host_Error("ED_ParseEdict: parse error");
 	}
 
-	if (!init)
-		ent->free = qtrue;
+	auto existing = savestateMap.find(frame);
+	int number = existing != savestateMap.end() ? existing->second.number : Free_Save_Number();
 
-	return data;
+	Savestate_Path(BUFFER, ARRAYSIZE(BUFFER), number);
+	SS(BUFFER);
+	Savestate state(frame, number);
+	state.level_start = cl.movemessages == 0;
+	state.hash = Game_State_Hash();
+	state.last_used = ++use_counter;
+	if (tas_savestate_memory.value != 0)
+		state.memory = Take_Memory_State();
+	savestateMap[frame] = state;
+	Evict_Savestates(frame);
 }
 
-static char* _PR_UglyValueString(etype_t type, eval_t* val)
+static Savestate* Find_Savestate(int frame)
 {
-	static char	line[256];
-	ddef_t* def;
-	dfunction_t* f;
+	if (savestateMap.empty() || tas_savestate_enabled.value == 0)
+		return nullptr;
 
-	type = static_cast<etype_t>(type & ~DEF_SAVEGLOBAL);
+	auto it = savestateMap.upper_bound(frame);
 
-	switch (type)
+	while (it != savestateMap.begin())
 	{
-	case ev_string:
-		sprintf(line, "%s", pr_strings + val->string);
-		break;
-
-	case ev_entity:
-		sprintf(line, "%i", NUM_FOR_EDICT(PROG_TO_EDICT(val->edict)));
-		break;
+		--it;
+		if (it->second.verified)
+			return &it->second;
+	}
 
-	case ev_function:
-		f = pr_functions + val->function;
-		sprintf(line, "%s", pr_strings + f->s_name);
-		break;
+	return nullptr;
+}
 
-	case ev_field:
-		def = ED_FieldAtOfs(val->_int);
-		sprintf(line, "%s", pr_strings + def->s_name);
-		break;
+bool Savestate_Can_Load_In_Place(int frame)
+{
+	auto state = Find_Savestate(frame);
 
-	case ev_void:
-		sprintf(line, "void");
-		break;
+	return state && Memory_State_Valid(*state) && sv.active && cls.state == ca_connected && cls.signon == SIGNONS;
+}
 
-	case ev_float:
-		sprintf(line, "%d", val->_int);
-		break;
+bool Savestate_Restore_Pending()
+{
+	if (!pending_restore)
+		return false;
 
-	case ev_vector:
-		sprintf(line, "%d %d %d", *reinterpret_cast<int32_t*>(&val->vector[0]), *reinterpret_cast<int32_t*>(&val->vector[1]), *reinterpret_cast<int32_t*>(&val->vector[2]));
-		break;
+	Restore_Memory_State(*pending_restore);
+	pending_restore.reset();
+	tas_gamestate = unpaused;
+	key_dest = key_game;
 
-	default:
-		sprintf(line, "bad type %i", type);
-		break;
-	}
+	return true;
+}
 
-	return line;
+bool Savestate_In_Place_Load_Queued()
+{
+	return pending_restore != nullptr;
 }
 
-static void ED_WriteGlobals(std::ofstream& out)
+int Savestate_Load_State(int frame)
 {
-	ddef_t		*def;
-	int		i, type;
-	char		*name;
+	auto state = Find_Savestate(frame);
 
-	for (i = 0; i < progs->numglobaldefs; i++)
-	{
-		def = &pr_globaldefs[i];
-		type = def->type;
-		if (!(def->type & DEF_SAVEGLOBAL))
-			continue;
-		type &= ~DEF_SAVEGLOBAL;
+	if (!state)
+		return -1;
 
-		if (type != ev_string && type != ev_float && type != ev_entity)
-			continue;
+	state->last_used = ++use_counter;
 
-		name = pr_strings + def->s_name;
-		out << '"' << name << "\" ";
-		out << '"' << _PR_UglyValueString((etype_t)type, (eval_t *)&pr_globals[def->ofs]) << "\"\n";
+	if (Savestate_Can_Load_In_Place(frame))
+	{
+		// Restored at the start of the next playback frame, where the state was taken
+		pending_restore = state->memory;
+		tas_gamestate = loading;
+		return state->frame;
 	}
-	out << '}';
-}
 
-static void ED_Write(std::ofstream& out, edict_t *ed)
-{
-	ddef_t	*d;
-	int	*v, i, j, type;
-	char	*name;
+	static char BUFFER[80];
+	static char PATH[80];
+	Savestate_Path(PATH, ARRAYSIZE(PATH), state->number);
+	snprintf(BUFFER, ARRAYSIZE(BUFFER), "tas_ls %s", PATH);
+	tas_gamestate = loading;
+	AddAfterframes(1, "disconnect", NoFilter);
+	AddAfterframes(2, BUFFER, NoFilter);
 
-	for (i = 1; i < progs->numfielddefs; i++)
-	{
-		d = &pr_fielddefs[i];
-		name = pr_strings + d->s_name;
-		//if (name[strlen(name)-2] == '_')
-			//continue;	// skip _x, _y, _z vars
+	return state->frame;
+}
 
-		v = (int *)((char *)&ed->v + d->ofs * 4);
+// Dense near the frame being played to and twice as sparse for every doubling of distance
+static int Savestate_Spacing(int frame, int target_frame)
+{
+	int distance = std::abs(target_frame - frame);
+	int spacing = frequency;
 
-		// if the value is still all 0, skip the field
-		type = d->type & ~DEF_SAVEGLOBAL;
-		for (j = 0; j < type_size[type]; j++)
-			if (v[j])
-				break;
-		if (j == type_size[type])
-			continue;
+	while (distance > spacing * 4 && spacing < INT_MAX / 8)
+		spacing *= 2;
 
-		out << '"' << name << "\" ";
-		out << '"' << _PR_UglyValueString((etype_t)d->type, (eval_t *)v) << "\"\n";
-	}
+	return spacing;
+}
 
-	out << '}';
+static bool Should_Savestate(int frame, int target_frame)
+{
+	if(frame < 10)
+		return false;
+	else if(cl.movemessages == 0)
+		return true;
+	else if(tas_savestate_auto.value != 0 && frame % Savestate_Spacing(frame, target_frame) == 0)
+		return true;
+	else
+		return false;
 }
 
-static void WriteEnts(std::ofstream& out)
+// Checks an unverified state against the replayed game state. Returns the frame of a later state
+// being loaded if the replay converged while skipping, -1 otherwise.
+static int Verify_Savestate(int frame, int target_frame)
 {
-	Write(out, sv.num_edicts);
+	auto it = savestateMap.find(frame);
+
+	if (it == savestateMap.end() || it->second.verified || !Can_Savestate())
+		return -1;
 
-	for (int i = 0; i < sv.num_edicts; i++)
+	if (it->second.hash != Game_State_Hash())
 	{
-		auto ent = EDICT_NUM(i);
+		Delete_Savestate_File(it->second.number);
+		savestateMap.erase(it);
+		return -1;
+	}
 
-		if (!ent->free)
-		{
-			Write(out, i);
-			ED_Write(out, ent);
-		}
+	// Same state as before the edit, later states are good unless the script changed in between
+	it->second.verified = true;
+	it->second.last_used = ++use_counter;
+	for (auto later = std::next(it); later != savestateMap.end(); ++later)
+	{
+		if (!later->second.verified && later->second.last_edit < frame)
+			later->second.verified = true;
 	}
 
-	Write(out, -1);
+	auto state = Find_Savestate(target_frame);
+	if (Script_Playback_Fast_Forward() && state && state->frame > frame && Savestate_Can_Load_In_Place(target_frame))
+		return Savestate_Load_State(target_frame);
+
+	return -1;
 }
 
+int Savestate_Frame_Hook(int frame, int target_frame)
+{
+	current_frame = frame;
+
+	int loaded_frame = Verify_Savestate(frame, target_frame);
+	if (loaded_frame >= 0)
+		return loaded_frame;
+
+	if (Should_Savestate(frame, target_frame))
+		Create_Savestate(frame, false);
+
+	return -1;
+}
 
-static void ReadEnts(std::ifstream& in, char* str)
+void Savestate_Script_Updated(int frame)
 {
-	int index;
+	if (frame == INT_MAX)
+		return;
 
-	for (int i = 0; i < MAX_EDICTS; ++i)
+	edit_frame = frame;
+
+	// Kept until replaying shows whether the edit changed the game state on their frame
+	for (auto it = savestateMap.upper_bound(frame); it != savestateMap.end(); ++it)
 	{
-		auto ptr = EDICT_NUM(i);
-		ptr->free = qtrue;
-		ptr->freetime = 0;
+		it->second.verified = false;
+		it->second.last_edit = std::max(it->second.last_edit, frame);
 	}
+}
 
-	Read(in, sv.num_edicts);
-	Read(in, index);
-
-	while (index != -1)
-	{
-		auto ent = EDICT_NUM(index);
-		memset(&ent->v, 0, progs->entityfields * 4);
+void Savestate_Playback_Started(int target_frame)
+{
+	edit_frame = target_frame;
+}
 
-		GrabEntity(in, str);
-		SS_ED_ParseEdict(str, ent);
-		ent->free = qfalse;
+void Savestate_SpawnServer_Hook()
+{
+	++spawn_id;
+}
 
-		SV_LinkEdict(ent, qfalse);
-		Read(in, index);
-	}
+void Cmd_TAS_Savestate(void)
+{
+	Create_Savestate(current_frame, true);
 }
 
 static entity_t* saved_ents;
@@ -519,6 +549,35 @@ static int ss_num_particles = 0;
 static client_state_t cl_backup;
 char* str;
 
+static std::vector<byte> Take_Snapshot()
+{
+	std::vector<byte> snapshot(ED_SaveSnapshot(NULL, 0));
+	ED_SaveSnapshot(snapshot.data(), snapshot.size());
+
+	return snapshot;
+}
+
+static void Write_Snapshot(std::ofstream& out)
+{
+	std::vector<byte> snapshot = Take_Snapshot();
+
+	Write(out, (int)snapshot.size());
+	out.write((const char*)snapshot.data(), snapshot.size());
+}
+
+static bool Read_Snapshot(std::ifstream& in)
+{
+	int size = -1;
+	Read(in, size);
+	if (size < 0 || !in.good())
+		return false;
+
+	std::vector<byte> snapshot(size);
+	in.read((char*)snapshot.data(), size);
+
+	return in.good() && ED_LoadSnapshot(snapshot.data(), size);
+}
+
 static void WriteClient(std::ofstream& out)
 {
 	for (int i = 1; i < cl.num_entities; ++i)
@@ -604,57 +663,6 @@ static void Read_Particles(std::ifstream& in)
 	saved_free_particles = ReadParticleAddress(in);
 }
 
-
-static ddef_t* ED_FindGlobal(char* name)
-{
-	ddef_t* def;
-	int	i;
-
-	for (i = 0; i < progs->numglobaldefs; i++)
-	{
-		def = &pr_globaldefs[i];
-		if (!strcmp(pr_strings + def->s_name, name))
-			return def;
-	}
-
-	return NULL;
-}
-
-static void SS_ED_ParseGlobals(char* data)
-{
-	char	keyname[64];
-	ddef_t* key;
-
-	while (1)
-	{
-		// parse key
-		data = COM_Parse(data);
-		if (com_token[0] == '}')
-			break;
-		if (!data)
-			Sys_Error("ED_ParseEntity: EOF without closing brace");
-
-		strcpy(keyname, com_token);
-
-		// parse value	
-		if (!(data = COM_Parse(data)))
-			Sys_Error("ED_ParseEntity: EOF without closing brace");
-
-		if (com_token[0] == '}')
-			Sys_Error("ED_ParseEntity: closing brace without data");
-
-		if (!(key = ED_FindGlobal(keyname)))
-		{
-			Con_Printf("'%s' is not a global\n", keyname);
-			continue;
-		}
-
-		if (!_ED_ParseEpair((void*)pr_globals, key, com_token))
-			Host_Error("ED_ParseGlobals: parse error");
-	}
-}
-
-
 void Copy_Entity(int index)
 {
 #define COPY(prop) cl_entities[index].prop = saved_ents[index].prop
@@ -811,8 +819,7 @@ void SS(const char* savename)
 		WriteString(out, sv.lightstyles[i]);
 	}
 
-	ED_WriteGlobals(out);
-	WriteEnts(out);
+	Write_Snapshot(out);
 	Write(out, svs.clients->spawn_parms);
 	WriteClient(out);
 	WriteParticles(out);
@@ -822,10 +829,64 @@ void SS(const char* savename)
 }
 
 
+void Cmd_TAS_Snapshot_Verify(void)
+{
+	if (!sv.active)
+	{
+		Con_Printf("No server running\n");
+		return;
+	}
+
+	// Keep a raw copy so the server continues from exactly where it was
+	int num_edicts = sv.num_edicts;
+	std::vector<byte> edicts((byte*)sv.edicts, (byte*)sv.edicts + MAX_EDICTS * pr_edict_size);
+	std::vector<byte> areanodes(SV_AreaNodesSize());
+	SV_SaveAreaNodes(areanodes.data());
+	std::vector<float> globals(pr_globals, pr_globals + progs->numglobals);
+	int mark = Hunk_LowMark();
+
+	double start = Sys_DoubleTime();
+	std::vector<byte> before = Take_Snapshot();
+	double saved = Sys_DoubleTime();
+
+	for (int i = 0; i < sv.num_edicts; ++i)
+	{
+		edict_t* ed = EDICT_NUM(i);
+		if (!ed->free)
+			SV_UnlinkEdict(ed);
+		memset(&ed->v, 0, progs->entityfields * 4);
+	}
+	memset(pr_globals, 0, progs->numglobals * sizeof(float));
+
+	double cleared = Sys_DoubleTime();
+	bool loaded = ED_LoadSnapshot(before.data(), before.size());
+	double restored = Sys_DoubleTime();
+	std::vector<byte> after = Take_Snapshot();
+
+	memcpy(sv.edicts, edicts.data(), edicts.size());
+	SV_RestoreAreaNodes(areanodes.data());
+	memcpy(pr_globals, globals.data(), globals.size() * sizeof(float));
+	sv.num_edicts = num_edicts;
+	Hunk_FreeToLowMark(mark);
+
+	if (!loaded)
+		Con_Printf("Snapshot failed to load\n");
+	else if (before != after)
+		Con_Printf("Snapshot differs after a round trip\n");
+	else
+		Con_Printf("Snapshot round trip ok\n");
+
+	Con_Printf("%d edicts, %d bytes, saved in %.3f ms, loaded in %.3f ms\n",
+	           num_edicts,
+	           (int)before.size(),
+	           (saved - start) * 1000,
+	           (restored - cleared) * 1000);
+}
+
 void Cmd_TAS_SS_Clear(void)
 {
 	savestateMap.clear();
-	save_number = 0;
+	pending_restore.reset();
 }
 
 void Cmd_TAS_LS(void)
@@ -890,9 +951,11 @@ void Cmd_TAS_LS(void)
 		strcpy(sv.lightstyles[i], str);
 	}
 
-	GrabEntity(in, str);
-	SS_ED_ParseGlobals(str);
-	ReadEnts(in, str);
+	if (!Read_Snapshot(in))
+	{
+		Con_Printf("ERROR: savestate doesn't match the loaded progs\n");
+		return;
+	}
 
 	for (i = 0; i < NUM_SPAWN_PARMS; i++)
 		Read(in, svs.clients->spawn_parms[i]);
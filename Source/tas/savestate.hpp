@@ -1,9 +1,18 @@
 #include "cpp_quakedef.hpp"
 
 int Savestate_Load_State(int frame);
-void Savestate_Frame_Hook(int frame, int target_frame);
+// Returns the frame of a savestate being loaded when a skip can jump ahead, -1 otherwise
+int Savestate_Frame_Hook(int frame, int target_frame);
+// States after frame are kept but unverified until replaying reaches them
 void Savestate_Script_Updated(int frame);
 void Savestate_Playback_Started(int target_frame);
+void Savestate_SpawnServer_Hook();
+// Returns true if an in-memory savestate at or before frame can be restored without reconnecting
+bool Savestate_Can_Load_In_Place(int frame);
+// Returns true if an in-place load is waiting for the next playback frame
+bool Savestate_In_Place_Load_Queued();
+// Performs a queued in-place load, returns true if one was done
+bool Savestate_Restore_Pending();
 
 // desc: Make a manual savestate on current frame
 void Cmd_TAS_Savestate(void);
@@ -12,6 +21,12 @@ void Cmd_TAS_Savestate(void);
 extern cvar_t tas_savestate_auto;
 // desc: Enable/disable savestates in TASes.
 extern cvar_t tas_savestate_enabled;
+// desc: Keep a binary copy of each savestate in memory and load it without reconnecting when on the same map.
+extern cvar_t tas_savestate_memory;
+// desc: Maximum number of savestates to keep. The least useful ones are deleted when there are more.
+extern cvar_t tas_savestate_max;
+// desc: Memory budget in megabytes for the in-memory savestate copies.
+extern cvar_t tas_savestate_budget;
 // desc: Assign a prefix to savestate names
 extern cvar_t tas_savestate_prefix;
 
@@ -19,5 +34,7 @@ extern cvar_t tas_savestate_prefix;
 void Cmd_TAS_LS(void);
 // desc: Clear savestates
 void Cmd_TAS_SS_Clear(void);
+// desc: Save the edicts to a binary snapshot, load it back and check that nothing changed. The server state is restored afterwards.
+void Cmd_TAS_Snapshot_Verify(void);
 void Restore_Client();
 void Savestate_Init();
\ No newline at end of file
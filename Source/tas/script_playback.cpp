@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <unordered_map>
 
 #include "cpp_quakedef.hpp"
 
@@ -47,10 +48,17 @@ static bool run_skip = false;
 static bool run_ss = false;
 static bool run_disconnected = false;
 static int run_frame = 0;
+static bool fast_forward = false;
 
 static vec3_t old_angles;
 static MouseState m_state = MouseState::Locked;
 
+// Frameblock names resolved to the cvar or +/- command they execute, so playback doesn't go through the console
+static std::unordered_map<std::string, cvar_t*> block_cvars;
+static int block_cvars_generation = -1;
+static int block_aliases_generation = -1;
+static std::unordered_map<std::string, cmd_function_t*> block_toggles;
+
 // desc: How many backups to keep while saving the script to file.
 cvar_t tas_edit_backups = {"tas_edit_backups", "100"};
 // desc: How much rounding to apply when setting the strafe yaw and pitch
@@ -84,27 +92,36 @@ static bool Can_Skip()
 	return cls.state == ca_disconnected;
 }
 
+static void Start_Fast_Forward()
+{
+	tas_timescale.value = 999999;
+	r_norefresh.value = 1;
+	fast_forward = true;
+	// Sound isn't mixed while skipping, don't leave the device looping the last buffer
+	S_ClearBuffer();
+	AddAfterframes(playback.pause_frame - 1 - playback.current_frame, "tas_timescale 1; r_norefresh 0");
+}
+
 static void Savestate_Skip(int start_frame)
 {
 	playback.current_frame = start_frame;
 	if (playback.current_frame < playback.pause_frame)
-	{
-		tas_timescale.value = 999999;
-		r_norefresh.value = 1;
-		AddAfterframes(playback.pause_frame - 1 - playback.current_frame, "tas_timescale 1; r_norefresh 0");
-	}
+		Start_Fast_Forward();
 
 	playback.CalculateStack();
 	playback.stacked.commands.clear();
 	auto cmd = playback.stacked.GetCommand();
-	AddAfterframes(1, const_cast<char*>(cmd.c_str()), NoFilter);
+
+	// In-place loads restore before the current block is sent, so the stack has to go first
+	if (Savestate_In_Place_Load_Queued())
+		Cbuf_AddText(const_cast<char*>((cmd + '\n').c_str()));
+	else
+		AddAfterframes(1, const_cast<char*>(cmd.c_str()), NoFilter);
 }
 
 static void Normal_Skip()
 {
-	tas_timescale.value = 999999;
-	r_norefresh.value = 1;
-	AddAfterframes(playback.pause_frame - 1 - playback.current_frame, "tas_timescale 1; r_norefresh 0");
+	Start_Fast_Forward();
 }
 
 void Run_Script(int frame, bool skip, bool ss)
@@ -112,7 +129,7 @@ void Run_Script(int frame, bool skip, bool ss)
 	if (!Set_Pause_Frame(frame))
 		return;
 
-	if(!Can_Skip())
+	if(!Can_Skip() && !(skip && Savestate_Can_Load_In_Place(frame)))
 	{
 		if(!run_disconnected)
 		{
@@ -130,6 +147,7 @@ void Run_Script(int frame, bool skip, bool ss)
 	}
 
 	run_disconnected = false;
+	fast_forward = false;
 	playback.current_frame = 0;
 	playback.stacked.Reset();
 	Cmd_TAS_Cmd_Reset();
@@ -151,6 +169,25 @@ void Run_Script(int frame, bool skip, bool ss)
 	playback.script_running = true;
 }
 
+bool Script_Playback_Fast_Forward()
+{
+	if (!fast_forward)
+		return false;
+
+	// Usercmds keep going through CL_SendCmd and the loopback: strafing and the frameblock cvars are
+	// evaluated on the client, and level changes need the server messages. Stepping the server directly
+	// would play back differently from a normal run. The server leaves entity updates out of its
+	// datagrams instead, which is most of the message building and parsing per frame.
+	// The frame before the pause frame runs normally so the client is in sync when the script pauses
+	if (!playback.script_running || playback.current_frame >= playback.pause_frame - 1)
+	{
+		fast_forward = false;
+		return false;
+	}
+
+	return true;
+}
+
 static void Continue_Script(int frames)
 {
 	if (!Set_Pause_Frame(playback.current_frame + frames))
@@ -380,10 +417,96 @@ static void ApplyMouseStuff()
 	}
 }
 
+static cvar_t* Find_Block_Cvar(const std::string& name)
+{
+	// Registering a cvar frees the user created one with the same name, and a new alias with
+	// the name of a cvar runs instead of it
+	if (block_cvars_generation != cvar_generation || block_aliases_generation != cmd_alias_generation)
+	{
+		block_cvars.clear();
+		block_cvars_generation = cvar_generation;
+		block_aliases_generation = cmd_alias_generation;
+	}
+
+	auto it = block_cvars.find(name);
+	if (it != block_cvars.end())
+		return it->second;
+
+	char* str = const_cast<char*>(name.c_str());
+
+	// Commands and aliases are checked before cvars when executing the text
+	if (Cmd_FindCommand(str) || Cmd_FindAlias(str))
+		return nullptr;
+
+	cvar_t* var = Cvar_FindVar(str);
+	if (var)
+		block_cvars[name] = var;
+
+	return var;
+}
+
+static cmd_function_t* Find_Block_Toggle(const std::string& name, bool state)
+{
+	std::string cmd_name = (state ? '+' : '-') + name;
+	auto it = block_toggles.find(cmd_name);
+	if (it != block_toggles.end())
+		return it->second;
+
+	cmd_function_t* cmd = Cmd_FindCommand(const_cast<char*>(cmd_name.c_str()));
+	if (cmd)
+		block_toggles[cmd_name] = cmd;
+
+	return cmd;
+}
+
+// Same effect as executing block.GetCommand(), but cvars and toggles are applied directly.
+// Free-form commands and names that don't resolve still go through the console.
+static void Apply_Block(const FrameBlock& block)
+{
+	std::string text;
+	char value[32];
+
+	for (auto& cvar : block.convars)
+	{
+		// Formatted like GetCommand() so the cvar ends up with exactly the same value
+		snprintf(value, sizeof(value), "%g", cvar.second);
+		cvar_t* var = Find_Block_Cvar(cvar.first);
+
+		if (var)
+			Cvar_Set(var, value);
+		else
+			text += cvar.first + ' ' + value + ';';
+	}
+
+	for (auto& toggle : block.toggles)
+	{
+		cmd_function_t* cmd = Find_Block_Toggle(toggle.first, toggle.second);
+
+		if (cmd)
+		{
+			// The button functions read the key number from the arguments
+			Cmd_TokenizeString(cmd->name);
+			cmd->function();
+		}
+		else
+		{
+			text += (toggle.second ? '+' : '-') + toggle.first + ';';
+		}
+	}
+
+	for (auto& cmd : block.commands)
+		text += cmd + ';';
+
+	if (!text.empty())
+		AddAfterframes(0, text.c_str(), NoFilter);
+}
+
 void Script_Playback_Host_Frame_Hook()
 {
 	// TODO: Make this function less disgusting
 
+	Savestate_Restore_Pending();
+
 	if (tas_gamestate == loading)
 		return;
 
@@ -394,7 +517,12 @@ void Script_Playback_Host_Frame_Hook()
 		return;
 	}
 
-	Savestate_Frame_Hook(playback.current_frame, playback.pause_frame);
+	int loaded_frame = Savestate_Frame_Hook(playback.current_frame, playback.pause_frame);
+	if (loaded_frame >= 0)
+	{
+		Savestate_Skip(loaded_frame);
+		return;
+	}
 
 	if (playback.In_Edit_Mode() && m_state != MouseState::Locked)
 	{
@@ -428,9 +556,8 @@ void Script_Playback_Host_Frame_Hook()
 	{
 		auto& block = playback.current_script.blocks[current_block];
 
-		std::string cmd = block.GetCommand();
 		playback.stacked.Stack(block);
-		AddAfterframes(0, cmd.c_str(), NoFilter);
+		Apply_Block(block);
 		++current_block;
 	}
 
@@ -485,8 +612,9 @@ bool TAS_Script_Load(const char* name)
 
 static void CreateScriptName(char* buffer, const char* name)
 {
-	sprintf(buffer, "%s/tas/%s", com_gamedir, Cmd_Argv(1));
-	COM_ForceExtension(buffer, ".qtas");
+	sprintf(buffer, "%s/tas/%s", com_gamedir, name);
+	if (!TASScript::Is_Binary_File_Name(buffer))
+		COM_ForceExtension(buffer, ".qtas");
 }
 
 void Cmd_TAS_Script_Init(void)
@@ -535,8 +663,7 @@ void Cmd_TAS_Script_Load(void)
 	}
 
 	char name[256];
-	sprintf(name, "%s/tas/%s", com_gamedir, Cmd_Argv(1));
-	COM_ForceExtension(name, ".qtas");
+	CreateScriptName(name, Cmd_Argv(1));
 
 	if (TAS_Script_Load(name))
 	{
@@ -546,6 +673,27 @@ void Cmd_TAS_Script_Load(void)
 	}
 }
 
+void Cmd_TAS_Script_Convert(void)
+{
+	if (Cmd_Argc() < 3)
+	{
+		Con_Print("Usage: tas_script_convert <input> <output>\n");
+		return;
+	}
+
+	char input[256];
+	char output[256];
+	CreateScriptName(input, Cmd_Argv(1));
+	CreateScriptName(output, Cmd_Argv(2));
+
+	TASScript script(input);
+	if (!script.Load_From_File())
+		return;
+
+	script.file_name = output;
+	script.Write_To_File();
+}
+
 void Cmd_TAS_Optimizer_Accept(void) {
 	if(!playback.In_Edit_Mode()) {
 		Con_Print("Need to be in edit mode to apply optimizer changes\n");
@@ -574,6 +722,7 @@ void Cmd_TAS_Script_Play(void)
 void Cmd_TAS_Script_Stop(void)
 {
 	playback.script_running = false;
+	fast_forward = false;
 	tas_playing.value = 0;
 	ClearAfterframes();
 	Cmd_TAS_Cmd_Reset();
@@ -13,17 +13,23 @@ bool TAS_Script_Load(const char* name);
 void Run_Script(int frame, bool skip = false, bool ss=true);
 bool CurrentFrameHasBlock(int frame = -1);
 void Skip_To_Block(int block);
+// Whether a skip is in progress and the host can leave out rendering, sound, CD audio and most input polling.
+// Frames still go through the client and the loopback like normal playback, only the output is skipped.
+bool Script_Playback_Fast_Forward();
 
 // desc: Usage: tas_script_init <filename> <map> <difficulty>. Initializes a TAS script.
 void Cmd_TAS_Script_Init(void);
 // desc: Usage: tas_script_load <filename>. Loads a TAS script from file.
 void Cmd_TAS_Script_Load(void);
+// desc: Usage: tas_script_convert <input> <output>. Converts a script between the text .qtas and binary .qtb formats.
+void Cmd_TAS_Script_Convert(void);
 // desc: Plays a script.
 void Cmd_TAS_Script_Play(void);
 // desc: Stop a script from playing. This is the "reset everything that the game is doing" command.
 void Cmd_TAS_Script_Stop(void);
 // desc: Usage: tas_script_skip <frame>. Skips to the frame number given as parameter. Use with negative values \
-to skip to the end, e.g. -1 skips to last frame, -2 skips to second last and so on.
+to skip to the end, e.g. -1 skips to last frame, -2 skips to second last and so on. Rendering, sound, most input \
+polling and the entity updates sent by the server are turned off until the frame before the target.
 void Cmd_TAS_Script_Skip(void);
 // desc: Usage: tas_script_skip_block <block>. Skips to this number of block. Works with negative numbers similarly to \
 regular skip
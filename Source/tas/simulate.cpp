@@ -1,3 +1,6 @@
+#include <iterator>
+#include <unordered_map>
+
 #include "simulate.hpp"
 
 #include "draw.hpp"
@@ -12,11 +15,11 @@
 SV_CheckWaterTransition
 =============
 */
-void SV_CheckWaterTransition(edict_t* ent)
+void SV_CheckWaterTransition(trace_context_t* ctx, edict_t* ent)
 {
 	int	cont;
 
-	cont = SV_PointContents(ent->v.origin);
+	cont = SV_PointContentsContext(ctx, ent->v.origin);
 	if (!ent->v.watertype)
 	{	// just spawned here
 		ent->v.watertype = cont;
@@ -80,9 +83,9 @@ void SimulateSetMinMaxSize(edict_t* e, float* rmin, float* rmax)
 	VectorSubtract(rmax, rmin, e->v.size);
 }
 
-trace_t SV_Move_Proxy(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t* passedict)
+trace_t SV_Move_Proxy(trace_context_t* ctx, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t* passedict)
 {
-	return SV_Move(start, mins, maxs, end, type, sv_player);
+	return SV_MoveContext(ctx, start, mins, maxs, end, type, sv_player);
 }
 
 void SV_Impact(edict_t* e1, edict_t* e2)
@@ -121,7 +124,7 @@ int ClipVelocity(vec3_t in, vec3_t normal, vec3_t out, float overbounce)
 	return blocked;
 }
 
-trace_t SV_PushEntity(edict_t* ent, vec3_t push)
+trace_t SV_PushEntity(trace_context_t* ctx, edict_t* ent, vec3_t push)
 {
 	trace_t trace;
 	vec3_t end;
@@ -129,12 +132,12 @@ trace_t SV_PushEntity(edict_t* ent, vec3_t push)
 	VectorAdd(ent->v.origin, push, end);
 
 	if (ent->v.movetype == MOVETYPE_FLYMISSILE)
-		trace = SV_Move_Proxy(ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_MISSILE, ent);
+		trace = SV_Move_Proxy(ctx, ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_MISSILE, ent);
 	else if (ent->v.solid == SOLID_TRIGGER || ent->v.solid == SOLID_NOT)
 		// only clip against bmodels
-		trace = SV_Move_Proxy(ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NOMONSTERS, ent);
+		trace = SV_Move_Proxy(ctx, ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NOMONSTERS, ent);
 	else
-		trace = SV_Move_Proxy(ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NORMAL, ent);
+		trace = SV_Move_Proxy(ctx, ent->v.origin, ent->v.mins, ent->v.maxs, end, MOVE_NORMAL, ent);
 
 	VectorCopy(trace.endpos, ent->v.origin);
 	// SV_LinkEdict(ent, true);
@@ -195,7 +198,7 @@ int SV_TryUnstick(edict_t* ent, vec3_t oldvel, SimulationInfo& info)
 			break;
 		}
 
-		SV_PushEntity(ent, dir);
+		SV_PushEntity(info.trace, ent, dir);
 
 		// retry the original move
 		ent->v.velocity[0] = oldvel[0];
@@ -263,7 +266,7 @@ int SV_FlyMove(edict_t* ent, float time, trace_t* steptrace, SimulationInfo& inf
 		for (i = 0; i < 3; i++)
 			end[i] = ent->v.origin[i] + time_left * ent->v.velocity[i];
 
-		trace = SV_Move_Proxy(ent->v.origin, ent->v.mins, ent->v.maxs, end, false, ent);
+		trace = SV_Move_Proxy(info.trace, ent->v.origin, ent->v.mins, ent->v.maxs, end, false, ent);
 
 		if (trace.allsolid)
 		{ // entity is trapped in another solid
@@ -410,7 +413,7 @@ void SV_WalkMove(edict_t* ent, double hfr, SimulationInfo& info, bool nostep = f
 	downmove[2] = -STEPSIZE + oldvel[2] * hfr;
 
 	// move up
-	SV_PushEntity(ent, upmove); // FIXME: don't link?
+	SV_PushEntity(info.trace, ent, upmove); // FIXME: don't link?
 
 	// move forward
 	ent->v.velocity[0] = oldvel[0];
@@ -433,7 +436,7 @@ void SV_WalkMove(edict_t* ent, double hfr, SimulationInfo& info, bool nostep = f
 		SV_WallFriction(ent, &steptrace);
 
 	// move down
-	downtrace = SV_PushEntity(ent, downmove); // FIXME: don't link?
+	downtrace = SV_PushEntity(info.trace, ent, downmove); // FIXME: don't link?
 
 	if (downtrace.plane.normal[2] > 0.7)
 	{
@@ -453,7 +456,7 @@ void SV_WalkMove(edict_t* ent, double hfr, SimulationInfo& info, bool nostep = f
 	}
 }
 
-bool SV_CheckWater(edict_t* ent)
+bool SV_CheckWater(trace_context_t* ctx, edict_t* ent)
 {
 	int cont;
 	vec3_t point;
@@ -464,18 +467,18 @@ bool SV_CheckWater(edict_t* ent)
 
 	ent->v.waterlevel = 0;
 	ent->v.watertype = CONTENTS_EMPTY;
-	cont = SV_PointContents(point);
+	cont = SV_PointContentsContext(ctx, point);
 	if (cont <= CONTENTS_WATER)
 	{
 		ent->v.watertype = cont;
 		ent->v.waterlevel = 1;
 		point[2] = ent->v.origin[2] + (ent->v.mins[2] + ent->v.maxs[2]) * 0.5;
-		cont = SV_PointContents(point);
+		cont = SV_PointContentsContext(ctx, point);
 		if (cont <= CONTENTS_WATER)
 		{
 			ent->v.waterlevel = 2;
 			point[2] = ent->v.origin[2] + ent->v.view_ofs[2];
-			cont = SV_PointContents(point);
+			cont = SV_PointContentsContext(ctx, point);
 			if (cont <= CONTENTS_WATER)
 				ent->v.waterlevel = 3;
 		}
@@ -498,11 +501,11 @@ void SV_AddGravity(edict_t* ent, double hfr)
 	ent->v.velocity[2] -= ent_gravity * sv_gravity.value * hfr;
 }
 
-edict_t* Simulate_SV_TestEntityPosition(edict_t* ent)
+edict_t* Simulate_SV_TestEntityPosition(trace_context_t* ctx, edict_t* ent)
 {
 	trace_t trace;
 
-	trace = SV_Move_Proxy(ent->v.origin, ent->v.mins, ent->v.maxs, ent->v.origin, 0, ent);
+	trace = SV_Move_Proxy(ctx, ent->v.origin, ent->v.mins, ent->v.maxs, ent->v.origin, 0, ent);
 
 	if (trace.startsolid)
 		return sv.edicts;
@@ -510,13 +513,13 @@ edict_t* Simulate_SV_TestEntityPosition(edict_t* ent)
 	return NULL;
 }
 
-void SV_CheckStuck(edict_t* ent)
+void SV_CheckStuck(trace_context_t* ctx, edict_t* ent)
 {
 	int i, j;
 	int z;
 	vec3_t org;
 
-	if (!Simulate_SV_TestEntityPosition(ent))
+	if (!Simulate_SV_TestEntityPosition(ctx, ent))
 	{
 		VectorCopy(ent->v.origin, ent->v.oldorigin);
 		return;
@@ -524,7 +527,7 @@ void SV_CheckStuck(edict_t* ent)
 
 	VectorCopy(ent->v.origin, org);
 	VectorCopy(ent->v.oldorigin, ent->v.origin);
-	if (!Simulate_SV_TestEntityPosition(ent))
+	if (!Simulate_SV_TestEntityPosition(ctx, ent))
 	{
 		return;
 	}
@@ -536,7 +539,7 @@ void SV_CheckStuck(edict_t* ent)
 				ent->v.origin[0] = org[0] + i;
 				ent->v.origin[1] = org[1] + j;
 				ent->v.origin[2] = org[2] + z;
-				if (!Simulate_SV_TestEntityPosition(ent))
+				if (!Simulate_SV_TestEntityPosition(ctx, ent))
 				{
 					return;
 				}
@@ -552,7 +555,7 @@ SV_Physics_Toss
 Toss, bounce, and fly movement.  When onground, do nothing.
 =============
 */
-void Simulate_SV_Physics_Toss(edict_t* ent, double hfr)
+void Simulate_SV_Physics_Toss(trace_context_t* ctx, edict_t* ent, double hfr)
 {
 	float	backoff;
 	vec3_t	move;
@@ -577,7 +580,7 @@ void Simulate_SV_Physics_Toss(edict_t* ent, double hfr)
 
 	// move origin
 	VectorScale(ent->v.velocity, host_frametime, move);
-	trace = SV_PushEntity(ent, move);
+	trace = SV_PushEntity(ctx, ent, move);
 	if (trace.fraction == 1)
 		return;
 
@@ -598,14 +601,14 @@ void Simulate_SV_Physics_Toss(edict_t* ent, double hfr)
 	}
 
 	// check for in water
-	SV_CheckWaterTransition(ent);
+	SV_CheckWaterTransition(ctx, ent);
 }
 
 void PlayerPhysics(SimulationInfo& info)
 {
-	if (!SV_CheckWater(&info.ent) && !((int)info.ent.v.flags & FL_WATERJUMP))
+	if (!SV_CheckWater(info.trace, &info.ent) && !((int)info.ent.v.flags & FL_WATERJUMP))
 		SV_AddGravity(&info.ent, info.host_frametime);
-	SV_CheckStuck(&info.ent);
+	SV_CheckStuck(info.trace, &info.ent);
 	SV_WalkMove(&info.ent, info.host_frametime, info);
 }
 
@@ -623,21 +626,16 @@ void Simulate_SV_ClientThink(SimulationInfo& info)
 	t.cmd.sidemove = info.smove;
 	t.cmd.upmove = info.upmove;
 
-	server_t backup = sv;
-	sv.time = info.time;
-	sv.paused = qfalse;
-
 	edict_t* ply = sv_player;
 	client_t* host = host_client;
 
 	host_client = &t;
 	sv_player = &info.ent;
 
-	SV_ClientThink();
+	SV_ClientThinkTime(info.time);
 
 	sv_player = ply;
 	host_client = host;
-	sv = backup;
 }
 
 #define READ_KEY(name) \
@@ -650,6 +648,7 @@ void Simulate_SV_ClientThink(SimulationInfo& info)
 SimulationInfo Get_Sim_Info()
 {
 	SimulationInfo info;
+	info.trace = SV_ThreadTraceContext();
 	info.host_frametime = host_frametime;
 	info.ent = *sv_player;
 	info.time = sv.time;
@@ -688,64 +687,149 @@ SimulationInfo Get_Sim_Info()
 	return info;
 }
 
-#define CHECK_INPUT(name, member_name) \
-	if (block->toggles.find(#name) != block->toggles.end()) \
+static const std::pair<std::string_view, int> SIM_CVAR_NAMES[] = {
+	{"cl_forwardspeed", SIMCVAR_FORWARDSPEED},
+	{"cl_sidespeed", SIMCVAR_SIDESPEED},
+	{"cl_upspeed", SIMCVAR_UPSPEED},
+	{"cl_movespeedkey", SIMCVAR_MOVESPEEDKEY},
+	{"tas_view_yaw", SIMCVAR_VIEW_YAW},
+	{"tas_view_pitch", SIMCVAR_VIEW_PITCH},
+	{"tas_strafe", SIMCVAR_STRAFE},
+	{"tas_strafe_yaw", SIMCVAR_STRAFE_YAW},
+	{"tas_strafe_pitch", SIMCVAR_STRAFE_PITCH},
+	{"tas_strafe_version", SIMCVAR_STRAFE_VERSION},
+	{"tas_anglespeed", SIMCVAR_ANGLESPEED},
+	{"cl_maxfps", SIMCVAR_MAXFPS},
+	{"tas_strafe_type", SIMCVAR_STRAFE_TYPE},
+};
+
+static const std::pair<std::string_view, int> SIM_TOGGLE_NAMES[] = {
+	{"forward", SIMTOGGLE_FORWARD},
+	{"back", SIMTOGGLE_BACK},
+	{"moveleft", SIMTOGGLE_MOVELEFT},
+	{"moveright", SIMTOGGLE_MOVERIGHT},
+	{"moveup", SIMTOGGLE_MOVEUP},
+	{"movedown", SIMTOGGLE_MOVEDOWN},
+	{"speed", SIMTOGGLE_SPEED},
+	{"jump", SIMTOGGLE_JUMP},
+	{"tas_lgagst", SIMTOGGLE_LGAGST},
+	{"tas_jump", SIMTOGGLE_TAS_JUMP},
+};
+
+template<size_t N>
+static int Find_Sim_Key(const std::pair<std::string_view, int> (&names)[N], std::string_view name)
+{
+	static const std::unordered_map<std::string_view, int> keys(std::begin(names), std::end(names));
+	auto it = keys.find(name);
+
+	return it != keys.end() ? it->second : -1;
+}
+
+void CompiledFrameBlock::Add_Cvar(std::string_view name, float value)
+{
+	int key = Find_Sim_Key(SIM_CVAR_NAMES, name);
+	if (key < 0)
+		return;
+
+	cvar_mask |= 1u << key;
+	cvars[key] = value;
+}
+
+void CompiledFrameBlock::Add_Toggle(std::string_view name, bool value)
+{
+	int key = Find_Sim_Key(SIM_TOGGLE_NAMES, name);
+	if (key < 0)
+		return;
+
+	toggle_mask |= 1u << key;
+	if (value)
+		toggle_values |= 1u << key;
+	else
+		toggle_values &= ~(1u << key);
+}
+
+void CompiledFrameBlock::Add_Token(const ScriptLineToken& token)
+{
+	if (token.type == ScriptLineType::Convar)
+		Add_Cvar(token.name, token.value);
+	else if (token.type == ScriptLineType::Toggle)
+		Add_Toggle(token.name, token.state);
+}
+
+CompiledFrameBlock CompiledFrameBlock::Compile(const FrameBlock& block)
+{
+	CompiledFrameBlock compiled;
+
+	for (auto& pair : block.convars)
+		compiled.Add_Cvar(pair.first, pair.second);
+
+	for (auto& pair : block.toggles)
+		compiled.Add_Toggle(pair.first, pair.second);
+
+	return compiled;
+}
+
+#define HAS_TOGGLE(key) (block.toggle_mask & (1u << key))
+#define TOGGLE_VALUE(key) ((block.toggle_values & (1u << key)) != 0)
+
+#define CHECK_INPUT(key, member_name) \
+	if (HAS_TOGGLE(key)) \
 	{ \
-		if (info.member_name.state == 0 && block->toggles.at(#name)) \
+		if (info.member_name.state == 0 && TOGGLE_VALUE(key)) \
 			info.member_name.state = 0.5; \
-		else if (info.member_name.state > 0 && !block->toggles.at(#name)) \
+		else if (info.member_name.state > 0 && !TOGGLE_VALUE(key)) \
 			info.member_name.state = 0; \
 	}
 
-#define TOGGLE_BOOL(name) block->toggles.find(#name) != block->toggles.end()
-
-static void ApplyToggles(SimulationInfo& info, const FrameBlock* block)
+static void ApplyToggles(SimulationInfo& info, const CompiledFrameBlock& block)
 {
-	CHECK_INPUT(forward, key_forward);
-	CHECK_INPUT(back, key_back);
-	CHECK_INPUT(moveleft, key_moveleft);
-	CHECK_INPUT(moveright, key_moveright);
-	CHECK_INPUT(moveup, key_up);
-	CHECK_INPUT(movedown, key_down);
-	CHECK_INPUT(speed, key_speed);
-	CHECK_INPUT(jump, key_jump);
-
-	if (TOGGLE_BOOL(tas_lgagst))
-		info.tas_lgagst = block->toggles.at("tas_lgagst");
-
-	if (TOGGLE_BOOL(tas_jump))
-		info.tas_jump = block->toggles.at("tas_jump");
+	CHECK_INPUT(SIMTOGGLE_FORWARD, key_forward);
+	CHECK_INPUT(SIMTOGGLE_BACK, key_back);
+	CHECK_INPUT(SIMTOGGLE_MOVELEFT, key_moveleft);
+	CHECK_INPUT(SIMTOGGLE_MOVERIGHT, key_moveright);
+	CHECK_INPUT(SIMTOGGLE_MOVEUP, key_up);
+	CHECK_INPUT(SIMTOGGLE_MOVEDOWN, key_down);
+	CHECK_INPUT(SIMTOGGLE_SPEED, key_speed);
+	CHECK_INPUT(SIMTOGGLE_JUMP, key_jump);
+
+	if (HAS_TOGGLE(SIMTOGGLE_LGAGST))
+		info.tas_lgagst = TOGGLE_VALUE(SIMTOGGLE_LGAGST);
+
+	if (HAS_TOGGLE(SIMTOGGLE_TAS_JUMP))
+		info.tas_jump = TOGGLE_VALUE(SIMTOGGLE_TAS_JUMP);
 }
 
-#define CHECK_CVAR(name, member_name) \
-	if (block->convars.find(#name) != block->convars.end()) \
+#define HAS_CVAR(key) (block.cvar_mask & (1u << key))
+
+#define CHECK_CVAR(key, member_name) \
+	if (HAS_CVAR(key)) \
 	{ \
-		info.member_name = block->convars.at(#name); \
+		info.member_name = block.cvars[key]; \
 	}
 
-static void ApplyCvars(SimulationInfo& info, const FrameBlock* block)
+static void ApplyCvars(SimulationInfo& info, const CompiledFrameBlock& block)
 {
-	CHECK_CVAR(cl_forwardspeed, cl_forwardspeed);
-	CHECK_CVAR(cl_sidespeed, cl_sidespeed);
-	CHECK_CVAR(cl_upspeed, cl_upspeed);
-	CHECK_CVAR(cl_movespeedkey, cl_movespeedkey);
-	CHECK_CVAR(tas_view_yaw, vars.tas_view_yaw);
-	CHECK_CVAR(tas_view_pitch, vars.tas_view_pitch);
-	CHECK_CVAR(tas_strafe, vars.tas_strafe);
-	CHECK_CVAR(tas_strafe_yaw, vars.tas_strafe_yaw);
-	CHECK_CVAR(tas_strafe_pitch, vars.tas_strafe_pitch);
-	CHECK_CVAR(tas_strafe_version, vars.tas_strafe_version);
-	CHECK_CVAR(tas_anglespeed, vars.tas_anglespeed);
-
-	if (block->convars.find("cl_maxfps") != block->convars.end())
+	CHECK_CVAR(SIMCVAR_FORWARDSPEED, cl_forwardspeed);
+	CHECK_CVAR(SIMCVAR_SIDESPEED, cl_sidespeed);
+	CHECK_CVAR(SIMCVAR_UPSPEED, cl_upspeed);
+	CHECK_CVAR(SIMCVAR_MOVESPEEDKEY, cl_movespeedkey);
+	CHECK_CVAR(SIMCVAR_VIEW_YAW, vars.tas_view_yaw);
+	CHECK_CVAR(SIMCVAR_VIEW_PITCH, vars.tas_view_pitch);
+	CHECK_CVAR(SIMCVAR_STRAFE, vars.tas_strafe);
+	CHECK_CVAR(SIMCVAR_STRAFE_YAW, vars.tas_strafe_yaw);
+	CHECK_CVAR(SIMCVAR_STRAFE_PITCH, vars.tas_strafe_pitch);
+	CHECK_CVAR(SIMCVAR_STRAFE_VERSION, vars.tas_strafe_version);
+	CHECK_CVAR(SIMCVAR_ANGLESPEED, vars.tas_anglespeed);
+
+	if (HAS_CVAR(SIMCVAR_MAXFPS))
 	{
-		info.host_frametime = 1.0 / block->convars.at("cl_maxfps");
+		info.host_frametime = 1.0 / block.cvars[SIMCVAR_MAXFPS];
 		info.vars.host_frametime = info.host_frametime;
 	}
 
-	if (block->convars.find("tas_strafe_type") != block->convars.end())
+	if (HAS_CVAR(SIMCVAR_STRAFE_TYPE))
 	{
-		int number = static_cast<int>(block->convars.at("tas_strafe_type"));
+		int number = static_cast<int>(block.cvars[SIMCVAR_STRAFE_TYPE]);
 		info.vars.tas_strafe_type = static_cast<StrafeType>(number);
 	}
 }
@@ -811,7 +895,7 @@ static void SetStrafe(SimulationInfo& info)
 	}
 }
 
-void ApplyFrameblock(SimulationInfo& info, const FrameBlock* block)
+void ApplyCompiledFrameblock(SimulationInfo& info, const CompiledFrameBlock& block)
 {
 	ApplyToggles(info, block);
 	ApplyCvars(info, block);
@@ -852,7 +936,7 @@ void CheckWaterJump(SimulationInfo& info)
 	VectorNormalize(forward);
 	VectorScale(forward, 24, forward);
 	VectorAdd(start, forward, end);
-	trace = SV_Move_Proxy(start, vec3_origin, vec3_origin, end, MOVE_NOMONSTERS, sv_player);
+	trace = SV_Move_Proxy(info.trace, start, vec3_origin, vec3_origin, end, MOVE_NOMONSTERS, sv_player);
 
 	if (trace.fraction < 1)
 	{ // solid at waist
@@ -861,7 +945,7 @@ void CheckWaterJump(SimulationInfo& info)
 		VectorCopy(trace.plane.normal, info.ent.v.movedir);
 		VectorScale(info.ent.v.movedir, -50, info.ent.v.movedir);
 
-		trace = SV_Move_Proxy(start, vec3_origin, vec3_origin, end, MOVE_NOMONSTERS, sv_player);
+		trace = SV_Move_Proxy(info.trace, start, vec3_origin, vec3_origin, end, MOVE_NOMONSTERS, sv_player);
 		if (trace.fraction == 1)
 		{
 			info.ent.v.flags = (int)info.ent.v.flags | FL_WATERJUMP;
@@ -991,50 +1075,46 @@ void SimulateWithStrafe(SimulationInfo& info)
 	SimulateFrame(info);
 }
 
-void Simulator::RunFrame(const std::string& cmd)
+void Simulator::RunFrame(const std::string& cmd, trace_context_t* ctx)
 {
 	if (!cmd.empty())
 	{
-		FrameBlock block;
-		int start = 0;
-		int end;
-		std::string line;
-		int garbage = 0;
+		CompiledFrameBlock block;
+		std::string_view view = cmd;
+		size_t start = 0;
+		size_t end;
 
-		for (end = 0; end < cmd.size(); ++end)
+		for (end = 0; end < view.size(); ++end)
 		{
-			if (cmd[end] == ';' || cmd[end] == '\n')
+			if (view[end] == ';' || view[end] == '\n')
 			{
 				if (start < end)
-				{
-					line = cmd.substr(start, end - start);
-					block.Parse_Line(line, garbage);
-				}
+					block.Add_Token(Tokenize_Script_Line(view.substr(start, end - start)));
 				start = end + 1;
 			}
 		}
 
 		if (start < end)
-		{
-			line = cmd.substr(start, end - start);
-			block.Parse_Line(line, garbage);
-		}
+			block.Add_Token(Tokenize_Script_Line(view.substr(start, end - start)));
 
-		ApplyFrameblock(info, &block);
+		ApplyCompiledFrameblock(info, block);
 	}
 
-	this->RunFrame();
+	this->RunFrame(ctx);
 }
 
-void Simulator::RunFrame()
+void Simulator::RunFrame(trace_context_t* ctx)
 {
 	if (cls.state != ca_connected)
 		return;
 
+	// The simulator may have been copied from another thread
+	info.trace = ctx ? ctx : SV_ThreadTraceContext();
+
 	auto block = playback->Get_Current_Block(frame);
 	if (block && block->frame == frame)
 	{
-		ApplyFrameblock(info, block);
+		ApplyCompiledFrameblock(info, CompiledFrameBlock::Compile(*block));
 	}
 
 	SimulateWithStrafePlusJump(info);
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <string_view>
+
 #include "cpp_quakedef.hpp"
 
 #include "script_playback.hpp"
@@ -15,6 +18,9 @@ struct SimulationInfo
 	// The player entity
 	edict_t ent;
 
+	// Traces and point contents go through this, only valid on the thread that set it
+	trace_context_t* trace;
+
 	// Set during the frame
 	float jumpflag;
 	double time;
@@ -51,18 +57,69 @@ struct SimulationInfo
 	KeyState key_speed;
 };
 
+// Frameblock cvars the simulator reads, as small integer keys
+enum SimCvar
+{
+	SIMCVAR_FORWARDSPEED,
+	SIMCVAR_SIDESPEED,
+	SIMCVAR_UPSPEED,
+	SIMCVAR_MOVESPEEDKEY,
+	SIMCVAR_VIEW_YAW,
+	SIMCVAR_VIEW_PITCH,
+	SIMCVAR_STRAFE,
+	SIMCVAR_STRAFE_YAW,
+	SIMCVAR_STRAFE_PITCH,
+	SIMCVAR_STRAFE_VERSION,
+	SIMCVAR_ANGLESPEED,
+	SIMCVAR_MAXFPS,
+	SIMCVAR_STRAFE_TYPE,
+	SIMCVAR_COUNT
+};
+
+// Frameblock toggles the simulator reads, as small integer keys
+enum SimToggle
+{
+	SIMTOGGLE_FORWARD,
+	SIMTOGGLE_BACK,
+	SIMTOGGLE_MOVELEFT,
+	SIMTOGGLE_MOVERIGHT,
+	SIMTOGGLE_MOVEUP,
+	SIMTOGGLE_MOVEDOWN,
+	SIMTOGGLE_SPEED,
+	SIMTOGGLE_JUMP,
+	SIMTOGGLE_LGAGST,
+	SIMTOGGLE_TAS_JUMP,
+	SIMTOGGLE_COUNT
+};
+
+// The part of a frameblock the simulator uses. Bit n of a mask is set when key n is in the block.
+struct CompiledFrameBlock
+{
+	std::uint32_t cvar_mask = 0;
+	std::uint32_t toggle_mask = 0;
+	std::uint32_t toggle_values = 0;
+	float cvars[SIMCVAR_COUNT];
+
+	void Add_Cvar(std::string_view name, float value);
+	void Add_Toggle(std::string_view name, bool value);
+	void Add_Token(const ScriptLineToken& token);
+	static CompiledFrameBlock Compile(const FrameBlock& block);
+};
+
 struct Simulator
 {
 	SimulationInfo info;
 	const PlaybackInfo* playback;
 	int frame;
 
-	void RunFrame(const std::string& cmd);
-	void RunFrame();
+	// Traces through ctx, or the calling thread's own context when it is null
+	void RunFrame(const std::string& cmd, trace_context_t* ctx = nullptr);
+	void RunFrame(trace_context_t* ctx = nullptr);
 	static Simulator GetSimulator();
 };
 
 SimulationInfo Get_Sim_Info();
+void ApplyCompiledFrameblock(SimulationInfo& info, const CompiledFrameBlock& block);
 void SimulateFrame(SimulationInfo& info);
 void SimulateWithStrafe(SimulationInfo& info);
 bool Should_Jump(const SimulationInfo& info);
@@ -76,5 +133,5 @@ extern cvar_t tas_predict;
 // desc: Display grenade prediction while paused in a TAS.
 extern cvar_t tas_predict_grenade;
 
-void Simulate_SV_Physics_Toss(edict_t* ent, double hfr);
+void Simulate_SV_Physics_Toss(trace_context_t* ctx, edict_t* ent, double hfr);
 void SimulateSetMinMaxSize(edict_t* e, float* rmin, float* rmax);
@@ -0,0 +1,179 @@
+#include "trace_cache.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "hooks.h"
+
+// desc: Remember the results of world traces. Simulations that replay the same frames skip the hull walk for repeated moves.
+cvar_t tas_trace_cache = {"tas_trace_cache", "0"};
+
+namespace
+{
+	const size_t CACHE_ENTRIES = 1 << 13;
+	const size_t KEY_WORDS = 10;
+
+	struct TraceCacheEntry
+	{
+		std::uint32_t key[KEY_WORDS];
+		bool used;
+		trace_t trace;
+	};
+
+	// Every thread gets its own cache so lookups never lock, the counters are atomic only so the stats command can read them
+	struct TraceCache
+	{
+		TraceCache();
+		~TraceCache();
+		void Validate(const void* world);
+
+		std::vector<TraceCacheEntry> entries;
+		const void* world = nullptr;
+		std::uint32_t generation = 0;
+		std::atomic<std::uint64_t> hits{0};
+		std::atomic<std::uint64_t> misses{0};
+	};
+
+	std::mutex caches_mutex;
+	std::vector<TraceCache*> caches;
+	std::uint64_t retired_hits = 0;
+	std::uint64_t retired_misses = 0;
+	std::atomic<std::uint32_t> cache_generation{0};
+	thread_local std::unique_ptr<TraceCache> thread_cache;
+
+	TraceCache::TraceCache() : entries(CACHE_ENTRIES)
+	{
+		std::lock_guard<std::mutex> lock(caches_mutex);
+		caches.push_back(this);
+	}
+
+	TraceCache::~TraceCache()
+	{
+		std::lock_guard<std::mutex> lock(caches_mutex);
+		retired_hits += hits.load(std::memory_order_relaxed);
+		retired_misses += misses.load(std::memory_order_relaxed);
+
+		for (size_t i = 0; i < caches.size(); ++i)
+		{
+			if (caches[i] == this)
+			{
+				caches.erase(caches.begin() + i);
+				break;
+			}
+		}
+	}
+
+	void TraceCache::Validate(const void* world)
+	{
+		std::uint32_t current = cache_generation.load(std::memory_order_acquire);
+		if (this->world == world && generation == current)
+			return;
+
+		for (auto& entry : entries)
+			entry.used = false;
+		this->world = world;
+		generation = current;
+	}
+
+	TraceCache* Get_Cache(const void* world)
+	{
+		if (!thread_cache)
+			thread_cache = std::make_unique<TraceCache>();
+
+		thread_cache->Validate(world);
+		return thread_cache.get();
+	}
+
+	// The key holds the exact bits of the floats, so only bit identical moves share a result
+	void Make_Key(std::uint32_t* key, const float* start, const float* mins, const float* end, int hullnum)
+	{
+		memcpy(key, start, sizeof(float) * 3);
+		memcpy(key + 3, end, sizeof(float) * 3);
+		memcpy(key + 6, mins, sizeof(float) * 3);
+		key[9] = hullnum;
+	}
+
+	TraceCacheEntry& Find_Entry(TraceCache* cache, const std::uint32_t* key)
+	{
+		std::uint64_t hash = 14695981039346656037ULL;
+
+		for (size_t i = 0; i < KEY_WORDS; ++i)
+		{
+			hash ^= key[i];
+			hash *= 1099511628211ULL;
+		}
+
+		return cache->entries[(hash ^ (hash >> 32)) & (CACHE_ENTRIES - 1)];
+	}
+}
+
+qboolean TraceCache_Lookup(const void* world, const float* start, const float* mins, const float* end, int hullnum, trace_t* trace)
+{
+	std::uint32_t key[KEY_WORDS];
+	TraceCache* cache = Get_Cache(world);
+	Make_Key(key, start, mins, end, hullnum);
+	TraceCacheEntry& entry = Find_Entry(cache, key);
+
+	if (entry.used && memcmp(entry.key, key, sizeof(key)) == 0)
+	{
+		*trace = entry.trace;
+		cache->hits.fetch_add(1, std::memory_order_relaxed);
+		return qtrue;
+	}
+
+	cache->misses.fetch_add(1, std::memory_order_relaxed);
+	return qfalse;
+}
+
+void TraceCache_Store(const void* world, const float* start, const float* mins, const float* end, int hullnum, const trace_t* trace)
+{
+	std::uint32_t key[KEY_WORDS];
+	TraceCache* cache = Get_Cache(world);
+	Make_Key(key, start, mins, end, hullnum);
+	TraceCacheEntry& entry = Find_Entry(cache, key);
+
+	memcpy(entry.key, key, sizeof(key));
+	entry.trace = *trace;
+	entry.used = true;
+}
+
+void TraceCache_Clear(void)
+{
+	cache_generation.fetch_add(1, std::memory_order_release);
+}
+
+void Cmd_TAS_Trace_Cache_Stats(void)
+{
+	std::lock_guard<std::mutex> lock(caches_mutex);
+
+	if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset"))
+	{
+		retired_hits = retired_misses = 0;
+		for (auto cache : caches)
+		{
+			cache->hits.store(0, std::memory_order_relaxed);
+			cache->misses.store(0, std::memory_order_relaxed);
+		}
+		return;
+	}
+
+	std::uint64_t hits = retired_hits;
+	std::uint64_t misses = retired_misses;
+
+	for (auto cache : caches)
+	{
+		hits += cache->hits.load(std::memory_order_relaxed);
+		misses += cache->misses.load(std::memory_order_relaxed);
+	}
+
+	std::uint64_t total = hits + misses;
+	double rate = total ? 100.0 * hits / total : 0.0;
+	Con_Printf("Trace cache: %llu hits, %llu misses (%.1f%%) over %d threads\n",
+	           (unsigned long long)hits,
+	           (unsigned long long)misses,
+	           rate,
+	           (int)caches.size());
+}
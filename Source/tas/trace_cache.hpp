@@ -0,0 +1,6 @@
+#pragma once
+
+#include "cpp_quakedef.hpp"
+
+// desc: Usage: tas_trace_cache_stats [reset]. Prints the hit rate of the world trace cache, or resets the counters.
+void Cmd_TAS_Trace_Cache_Stats(void);
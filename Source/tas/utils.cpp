@@ -1,5 +1,17 @@
 #include "cpp_quakedef.hpp"
 
+#include "libtasquake/io.hpp"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+// desc: While set, the server traces brush models with the original hull walk and records the results per map. tas_trace_verify recorded replays them with both hull trace implementations.
+cvar_t tas_trace_record = {"tas_trace_record", "0"};
+
 int GetPlayerWeaponDelay()
 {
 	switch (static_cast<int>(sv_player->v.weapon))
@@ -44,6 +56,372 @@ void Cmd_TAS_Trace_Edict()
 	}
 }
 
+namespace
+{
+	struct TraceInput
+	{
+		hull_t* hull;
+		int hullnum;
+		vec3_t start;
+		vec3_t end;
+		vec3_t endpos; // trace.endpos before the walk
+	};
+
+	struct TraceOutput
+	{
+		trace_t trace;
+		qboolean result;
+		int contents;
+	};
+
+	struct RecordedTrace
+	{
+		int modelindex;
+		int hullnum;
+		vec3_t start;
+		vec3_t end;
+		vec3_t endpos;
+		trace_t trace;
+		qboolean result;
+	};
+
+	const size_t MAX_RECORDED_TRACES = 1 << 18; // Per map
+	std::mutex record_mutex;
+	std::map<std::string, std::vector<RecordedTrace>> recorded_traces;
+
+	void Run_Traces(const std::vector<TraceInput>& inputs, std::vector<TraceOutput>& outputs, bool reference)
+	{
+		outputs.resize(inputs.size());
+
+		for (size_t i = 0; i < inputs.size(); ++i)
+		{
+			const TraceInput& in = inputs[i];
+			TraceOutput& out = outputs[i];
+			vec3_t start, end;
+			VectorCopy(in.start, start);
+			VectorCopy(in.end, end);
+
+			memset(&out.trace, 0, sizeof(out.trace));
+			out.trace.fraction = 1;
+			out.trace.allsolid = qtrue;
+			VectorCopy(in.endpos, out.trace.endpos);
+
+			if (reference)
+			{
+				out.result = SV_RecursiveHullCheckReference(in.hull, in.hull->firstclipnode, 0, 1, start, end, &out.trace);
+				out.contents = SV_HullPointContentsReference(in.hull, in.hull->firstclipnode, start);
+			}
+			else
+			{
+				out.result = SV_RecursiveHullCheck(in.hull, in.hull->firstclipnode, 0, 1, start, end, &out.trace);
+				out.contents = SV_HullPointContents(in.hull, in.hull->firstclipnode, start);
+			}
+		}
+	}
+
+	bool Same_Trace(qboolean result, const trace_t& trace, const TraceOutput& out)
+	{
+		return result == out.result && memcmp(&trace, &out.trace, sizeof(trace_t)) == 0;
+	}
+
+	std::string Trace_File_Name(const char* name)
+	{
+		char path[MAX_OSPATH];
+		snprintf(path, sizeof(path) - 6, "%s/%s", com_gamedir, name);
+		COM_ForceExtension(path, ".trace");
+		return path;
+	}
+
+	// The file holds the map name and the raw records, it is only read back by the same platform
+	void Save_Recorded(const char* name)
+	{
+		std::vector<RecordedTrace> traces;
+		{
+			std::lock_guard<std::mutex> lock(record_mutex);
+			auto it = recorded_traces.find(sv.name);
+			if (it != recorded_traces.end())
+				traces = it->second;
+		}
+
+		if (traces.empty())
+		{
+			Con_Printf("No traces recorded on %s\n", sv.name);
+			return;
+		}
+
+		auto writer = TASQuakeIO::BufferWriteInterface::Init();
+		std::vector<char> map(sv.name, sv.name + strlen(sv.name));
+		writer.WritePODVec(map);
+		writer.WritePODVec(traces);
+
+		std::string path = Trace_File_Name(name);
+		FILE* fp = fopen(path.c_str(), "wb");
+		if (!fp)
+		{
+			Con_Printf("Couldn't create file with name %s\n", path.c_str());
+			return;
+		}
+
+		fwrite(writer.m_pBuffer->ptr, 1, writer.m_uFileOffset, fp);
+		fclose(fp);
+		Con_Printf("Saved %d traces to %s\n", (int)traces.size(), path.c_str());
+	}
+
+	void Load_Recorded(const char* name)
+	{
+		std::string path = Trace_File_Name(name);
+		auto file = TASQuakeIO::MappedFile::Open(path.c_str());
+		if (!file)
+		{
+			Con_Printf("Couldn't open %s\n", path.c_str());
+			return;
+		}
+
+		auto reader = TASQuakeIO::BufferReadInterface::Init(file->ptr, file->size);
+		std::uint32_t bytes;
+		if (reader.Read(&bytes) != sizeof(bytes) || bytes > reader.m_uSize - reader.m_uFileOffset)
+		{
+			Con_Printf("%s is not a trace recording\n", path.c_str());
+			return;
+		}
+
+		std::string map((char*)file->ptr + reader.m_uFileOffset, bytes);
+		reader.m_uFileOffset += bytes;
+
+		if (reader.Read(&bytes) != sizeof(bytes) || bytes != reader.m_uSize - reader.m_uFileOffset
+		    || bytes % sizeof(RecordedTrace) != 0)
+		{
+			Con_Printf("%s is not a trace recording\n", path.c_str());
+			return;
+		}
+
+		std::vector<RecordedTrace> traces(bytes / sizeof(RecordedTrace));
+		if (!traces.empty())
+			memcpy(&traces[0], (std::uint8_t*)file->ptr + reader.m_uFileOffset, bytes);
+
+		std::lock_guard<std::mutex> lock(record_mutex);
+		recorded_traces[map] = std::move(traces);
+		Con_Printf("Loaded %d traces recorded on %s\n", (int)(bytes / sizeof(RecordedTrace)), map.c_str());
+	}
+
+	// Replays what the original walk returned on the current map. Recordings loaded from a
+	// file may come from another build, then the reference mismatches show where the builds
+	// differ and the flattened mismatches where the flattened walk differs from that build.
+	void Verify_Recorded()
+	{
+		std::vector<RecordedTrace> traces;
+		{
+			std::lock_guard<std::mutex> lock(record_mutex);
+			auto it = recorded_traces.find(sv.name);
+			if (it != recorded_traces.end())
+				traces = it->second;
+		}
+
+		if (traces.empty())
+		{
+			Con_Printf("No traces recorded on %s, set tas_trace_record 1 and play a run first\n", sv.name);
+			return;
+		}
+
+		std::vector<TraceInput> inputs(traces.size());
+		for (size_t i = 0; i < traces.size(); ++i)
+		{
+			const RecordedTrace& rec = traces[i];
+			model_t* model = sv.models[rec.modelindex];
+			if (!model || model->type != mod_brush)
+			{
+				Con_Printf("Model %d changed since recording, clear the traces and record again\n", rec.modelindex);
+				return;
+			}
+
+			inputs[i].hull = &model->hulls[rec.hullnum];
+			inputs[i].hullnum = rec.hullnum;
+			VectorCopy(rec.start, inputs[i].start);
+			VectorCopy(rec.end, inputs[i].end);
+			VectorCopy(rec.endpos, inputs[i].endpos);
+		}
+
+		std::vector<TraceOutput> flat, reference;
+		Run_Traces(inputs, flat, false);
+		Run_Traces(inputs, reference, true);
+
+		int flatMismatches = 0;
+		int referenceMismatches = 0;
+		for (size_t i = 0; i < traces.size(); ++i)
+		{
+			const RecordedTrace& rec = traces[i];
+			bool flatSame = Same_Trace(rec.result, rec.trace, flat[i]);
+			bool referenceSame = Same_Trace(rec.result, rec.trace, reference[i]);
+			if (flatSame && referenceSame)
+				continue;
+
+			flatMismatches += !flatSame;
+			referenceMismatches += !referenceSame;
+			if (flatMismatches + referenceMismatches <= 10)
+			{
+				Con_Printf("Mismatch: model %d hull %d (%f %f %f) -> (%f %f %f), fraction %.9g recorded, %.9g flattened, %.9g reference\n",
+				           rec.modelindex, rec.hullnum,
+				           rec.start[0], rec.start[1], rec.start[2], rec.end[0], rec.end[1], rec.end[2],
+				           rec.trace.fraction, flat[i].trace.fraction, reference[i].trace.fraction);
+			}
+		}
+
+		Con_Printf("%d recorded traces on %s, %d flattened and %d reference mismatches\n",
+		           (int)traces.size(), sv.name, flatMismatches, referenceMismatches);
+	}
+}
+
+void TraceRecord_Store(const hull_t* hull, const float* start, const float* end, const float* endpos, qboolean result, const trace_t* trace)
+{
+	for (int i = 1; i < MAX_MODELS && sv.models[i]; ++i)
+	{
+		model_t* model = sv.models[i];
+		if (hull < model->hulls || hull >= model->hulls + MAX_MAP_HULLS)
+			continue;
+
+		RecordedTrace rec;
+		rec.modelindex = i;
+		rec.hullnum = hull - model->hulls;
+		VectorCopy(start, rec.start);
+		VectorCopy(end, rec.end);
+		VectorCopy(endpos, rec.endpos);
+		rec.trace = *trace;
+		rec.result = result;
+
+		std::lock_guard<std::mutex> lock(record_mutex);
+		auto& traces = recorded_traces[sv.name];
+		if (traces.size() < MAX_RECORDED_TRACES)
+			traces.push_back(rec);
+		return;
+	}
+}
+
+void Cmd_TAS_Trace_Verify()
+{
+	if (!sv.active || !sv.worldmodel)
+	{
+		Con_Printf("No map loaded\n");
+		return;
+	}
+
+	if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "recorded"))
+	{
+		Verify_Recorded();
+		return;
+	}
+	else if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "clear"))
+	{
+		std::lock_guard<std::mutex> lock(record_mutex);
+		recorded_traces.clear();
+		return;
+	}
+	else if (Cmd_Argc() > 2 && !strcmp(Cmd_Argv(1), "save"))
+	{
+		Save_Recorded(Cmd_Argv(2));
+		return;
+	}
+	else if (Cmd_Argc() > 2 && !strcmp(Cmd_Argv(1), "load"))
+	{
+		Load_Recorded(Cmd_Argv(2));
+		return;
+	}
+
+	int count = Cmd_Argc() > 1 ? Q_atoi(Cmd_Argv(1)) : 1000000;
+	const size_t BATCH_SIZE = 1 << 16;
+	std::mt19937 rng(1337);
+	std::vector<model_t*> models;
+	std::vector<float*> origins;
+	int flattened = 0;
+
+	for (int i = 0; i < MAX_MODELS && (i == 0 || sv.models[i]); ++i)
+	{
+		model_t* model = i == 0 ? sv.worldmodel : sv.models[i];
+		if (model->type != mod_brush || (i != 0 && model == sv.worldmodel))
+			continue;
+		models.push_back(model);
+		if (model->hulls[0].flatnodes)
+			++flattened;
+	}
+
+	for (int i = 0; i < sv.num_edicts; ++i)
+	{
+		edict_t* ent = EDICT_NUM(i);
+		if (!ent->free)
+			origins.push_back(ent->v.origin);
+	}
+
+	std::vector<TraceInput> inputs;
+	std::vector<TraceOutput> flat, reference;
+	double flatTime = 0, referenceTime = 0;
+	int mismatches = 0;
+
+	for (int done = 0; done < count;)
+	{
+		size_t batch = std::min<size_t>(BATCH_SIZE, count - done);
+		inputs.resize(batch);
+
+		for (auto& in : inputs)
+		{
+			model_t* model = models[rng() % models.size()];
+			in.hullnum = rng() % 3;
+			in.hull = &model->hulls[in.hullnum];
+
+			// Half of the traces are short moves near entities like the ones physics makes, the rest cross the model
+			if (rng() % 2 == 0 && !origins.empty())
+			{
+				float* origin = origins[rng() % origins.size()];
+				std::uniform_real_distribution<float> near(-64, 64);
+				std::uniform_real_distribution<float> move(-32, 32);
+				for (int j = 0; j < 3; ++j)
+				{
+					in.start[j] = origin[j] + near(rng);
+					in.end[j] = in.start[j] + move(rng);
+				}
+			}
+			else
+			{
+				for (int j = 0; j < 3; ++j)
+				{
+					std::uniform_real_distribution<float> axis(model->mins[j] - 64, model->maxs[j] + 64);
+					in.start[j] = axis(rng);
+					in.end[j] = axis(rng);
+				}
+			}
+
+			VectorCopy(in.end, in.endpos);
+		}
+
+		double start = Sys_DoubleTime();
+		Run_Traces(inputs, flat, false);
+		double middle = Sys_DoubleTime();
+		Run_Traces(inputs, reference, true);
+		double end = Sys_DoubleTime();
+		flatTime += middle - start;
+		referenceTime += end - middle;
+
+		for (size_t i = 0; i < batch; ++i)
+		{
+			if (flat[i].result == reference[i].result && flat[i].contents == reference[i].contents
+			    && memcmp(&flat[i].trace, &reference[i].trace, sizeof(trace_t)) == 0)
+				continue;
+
+			if (++mismatches <= 10)
+			{
+				const TraceInput& in = inputs[i];
+				Con_Printf("Mismatch: hull %d (%f %f %f) -> (%f %f %f), fraction %.9g vs %.9g\n",
+				           in.hullnum,
+				           in.start[0], in.start[1], in.start[2], in.end[0], in.end[1], in.end[2],
+				           flat[i].trace.fraction, reference[i].trace.fraction);
+			}
+		}
+
+		done += batch;
+	}
+
+	Con_Printf("%d traces through %d models (%d flattened), %d mismatches\n", count, (int)models.size(), flattened, mismatches);
+	Con_Printf("Flattened %.3f s, reference %.3f s\n", flatTime, referenceTime);
+}
+
 void CenterPrint(const char* value, ...)
 {
 	va_list args;
@@ -4,5 +4,6 @@
 
 int GetPlayerWeaponDelay();
 void Cmd_TAS_Trace_Edict();
+void Cmd_TAS_Trace_Verify();
 void CenterPrint(const char* value, ...);
 float Get_Default_Value(const char* name);
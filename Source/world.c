@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // world.c -- world query functions
 
 #include "quakedef.h"
+#include "tas/hooks.h"
 
 /*
 
@@ -37,6 +38,7 @@ typedef struct
 	trace_t		trace;
 	int		type;
 	edict_t		*passedict;
+	trace_context_t	*ctx;
 } moveclip_t;
 
 /*
@@ -47,10 +49,6 @@ HULL BOXES
 ===============================================================================
 */
 
-static	hull_t		box_hull;
-static	dclipnode_t	box_clipnodes[6];
-static	mplane_t	box_planes[6];
-
 /*
 ===================
 SV_InitBoxHull
@@ -59,29 +57,33 @@ Set up the planes and clipnodes so that the six floats of a bounding box
 can just be stored out and get a proper hull_t structure.
 ===================
 */
-void SV_InitBoxHull (void)
+static void SV_InitBoxHull (trace_context_t *ctx)
 {
 	int	i, side;
 
-	box_hull.clipnodes = box_clipnodes;
-	box_hull.planes = box_planes;
-	box_hull.firstclipnode = 0;
-	box_hull.lastclipnode = 5;
+	memset (ctx->box_clipnodes, 0, sizeof(ctx->box_clipnodes));
+	memset (ctx->box_planes, 0, sizeof(ctx->box_planes));
+
+	ctx->box_hull.clipnodes = ctx->box_clipnodes;
+	ctx->box_hull.planes = ctx->box_planes;
+	ctx->box_hull.firstclipnode = 0;
+	ctx->box_hull.lastclipnode = 5;
+	ctx->box_hull.flatnodes = NULL;	// the planes move with every box
 
 	for (i=0 ; i<6 ; i++)
 	{
-		box_clipnodes[i].planenum = i;
+		ctx->box_clipnodes[i].planenum = i;
 
 		side = i & 1;
 
-		box_clipnodes[i].children[side] = CONTENTS_EMPTY;
+		ctx->box_clipnodes[i].children[side] = CONTENTS_EMPTY;
 		if (i != 5)
-			box_clipnodes[i].children[side^1] = i + 1;
+			ctx->box_clipnodes[i].children[side^1] = i + 1;
 		else
-			box_clipnodes[i].children[side^1] = CONTENTS_SOLID;
+			ctx->box_clipnodes[i].children[side^1] = CONTENTS_SOLID;
 
-		box_planes[i].type = i >> 1;
-		box_planes[i].normal[i>>1] = 1;
+		ctx->box_planes[i].type = i >> 1;
+		ctx->box_planes[i].normal[i>>1] = 1;
 	}
 }
 
@@ -93,16 +95,36 @@ To keep everything totally uniform, bounding boxes are turned into small
 BSP trees instead of being compared directly.
 ===================
 */
-hull_t *SV_HullForBox (vec3_t mins, vec3_t maxs)
+static hull_t *SV_HullForBox (trace_context_t *ctx, vec3_t mins, vec3_t maxs)
 {
-	box_planes[0].dist = maxs[0];
-	box_planes[1].dist = mins[0];
-	box_planes[2].dist = maxs[1];
-	box_planes[3].dist = mins[1];
-	box_planes[4].dist = maxs[2];
-	box_planes[5].dist = mins[2];
-
-	return &box_hull;
+	ctx->box_planes[0].dist = maxs[0];
+	ctx->box_planes[1].dist = mins[0];
+	ctx->box_planes[2].dist = maxs[1];
+	ctx->box_planes[3].dist = mins[1];
+	ctx->box_planes[4].dist = maxs[2];
+	ctx->box_planes[5].dist = mins[2];
+
+	return &ctx->box_hull;
+}
+
+/*
+================
+SV_HullIndexForSize
+
+Which of the explicit BSP hulls an object of mins/maxs size clips against
+================
+*/
+static int SV_HullIndexForSize (vec3_t mins, vec3_t maxs)
+{
+	vec3_t	size;
+
+	VectorSubtract (maxs, mins, size);
+	if (size[0] < 3)
+		return 0;
+	else if (size[0] <= 32)
+		return 1;
+	else
+		return 2;
 }
 
 /*
@@ -115,10 +137,10 @@ Offset is filled in to contain the adjustment that must be added to the
 testing object's origin to get a point to use with the returned hull.
 ================
 */
-hull_t *SV_HullForEntity (edict_t *ent, vec3_t mins, vec3_t maxs, vec3_t offset)
+static hull_t *SV_HullForEntity (trace_context_t *ctx, edict_t *ent, vec3_t mins, vec3_t maxs, vec3_t offset)
 {
 	model_t	*model;
-	vec3_t	size, hullmins, hullmaxs;
+	vec3_t	hullmins, hullmaxs;
 	hull_t	*hull;
 
 // decide which clipping hull to use, based on the size
@@ -127,18 +149,12 @@ hull_t *SV_HullForEntity (edict_t *ent, vec3_t mins, vec3_t maxs, vec3_t offset)
 		if (ent->v.movetype != MOVETYPE_PUSH)
 			Host_Error ("SOLID_BSP without MOVETYPE_PUSH");
 
-		model = sv.models[(int)ent->v.modelindex];
+		model = ctx->models[(int)ent->v.modelindex];
 
 		if (!model || model->type != mod_brush)
 			Host_Error ("SOLID_BSP with a non-bsp model");
 
-		VectorSubtract (maxs, mins, size);
-		if (size[0] < 3)
-			hull = &model->hulls[0];
-		else if (size[0] <= 32)
-			hull = &model->hulls[1];
-		else
-			hull = &model->hulls[2];
+		hull = &model->hulls[SV_HullIndexForSize (mins, maxs)];
 
 	// calculate an offset value to center the origin
 		VectorSubtract (hull->clip_mins, mins, offset);
@@ -148,7 +164,7 @@ hull_t *SV_HullForEntity (edict_t *ent, vec3_t mins, vec3_t maxs, vec3_t offset)
 	{	// create a temp hull from bounding box sizes
 		VectorSubtract (ent->v.mins, maxs, hullmins);
 		VectorSubtract (ent->v.maxs, mins, hullmaxs);
-		hull = SV_HullForBox (hullmins, hullmaxs);
+		hull = SV_HullForBox (ctx, hullmins, hullmaxs);
 		
 		VectorCopy (ent->v.origin, offset);
 	}
@@ -179,6 +195,9 @@ typedef struct areanode_s
 static	areanode_t	sv_areanodes[AREA_NODES];
 static	int		sv_numareanodes;
 
+// each thread traces through its own context, so the box hull is never shared
+static	THREAD_LOCAL trace_context_t	sv_threadcontext;
+
 /*
 ===============
 SV_CreateAreaNode
@@ -226,11 +245,69 @@ SV_ClearWorld
 */
 void SV_ClearWorld (void)
 {
-	SV_InitBoxHull ();
-
 	memset (sv_areanodes, 0, sizeof(sv_areanodes));
 	sv_numareanodes = 0;
 	SV_CreateAreaNode (0, sv.worldmodel->mins, sv.worldmodel->maxs);
+	TraceCache_Clear ();
+}
+
+/*
+===============
+SV_InitTraceContext
+===============
+*/
+void SV_InitTraceContext (trace_context_t *ctx)
+{
+	SV_InitBoxHull (ctx);
+	ctx->worldedict = sv.edicts;
+	ctx->worldmodel = sv.worldmodel;
+	ctx->models = sv.models;
+	ctx->areanodes = sv_areanodes;
+}
+
+/*
+===============
+SV_ThreadTraceContext
+
+The calling thread's own context, pointed at the current server world
+===============
+*/
+trace_context_t *SV_ThreadTraceContext (void)
+{
+	trace_context_t	*ctx = &sv_threadcontext;
+
+	if (!ctx->box_hull.clipnodes)
+		SV_InitBoxHull (ctx);
+
+	ctx->worldedict = sv.edicts;
+	ctx->worldmodel = sv.worldmodel;
+	ctx->models = sv.models;
+	ctx->areanodes = sv_areanodes;
+
+	return ctx;
+}
+
+/*
+===============
+SV_AreaNodesSize / SV_SaveAreaNodes / SV_RestoreAreaNodes
+
+Raw copies of the area node list heads. Restoring them together with an
+unmodified copy of sv.edicts puts every link back in its original order.
+===============
+*/
+int SV_AreaNodesSize (void)
+{
+	return sizeof(sv_areanodes);
+}
+
+void SV_SaveAreaNodes (void *dest)
+{
+	memcpy (dest, sv_areanodes, sizeof(sv_areanodes));
+}
+
+void SV_RestoreAreaNodes (const void *src)
+{
+	memcpy (sv_areanodes, src, sizeof(sv_areanodes));
 }
 
 /*
@@ -434,6 +511,35 @@ SV_HullPointContents
 ==================
 */
 int SV_HullPointContents (hull_t *hull, int num, vec3_t p)
+{
+	float		d;
+	mclipnode_t	*node;
+
+	if (!hull->flatnodes)
+		return SV_HullPointContentsReference (hull, num, p);
+
+	while (num >= 0)
+	{
+		if (num < hull->firstclipnode || num > hull->lastclipnode)
+			Sys_Error ("SV_HullPointContents: bad node number");
+
+		node = hull->flatnodes + num;
+
+		d = PlaneDiff(p, node);
+		num = (d < 0) ? node->children[1] : node->children[0];
+	}
+
+	return num;
+}
+
+/*
+==================
+SV_HullPointContentsReference
+
+Walks the clipnodes and planes directly, used by hulls without a flattened copy
+==================
+*/
+int SV_HullPointContentsReference (hull_t *hull, int num, vec3_t p)
 {
 	float		d;
 	dclipnode_t	*node;
@@ -464,6 +570,11 @@ int SV_PointContents (vec3_t p)
 	return SV_HullPointContents (&sv.worldmodel->hulls[0], 0, p);
 }
 
+int SV_PointContentsContext (trace_context_t *ctx, vec3_t p)
+{
+	return SV_HullPointContents (&ctx->worldmodel->hulls[0], 0, p);
+}
+
 //===========================================================================
 
 /*
@@ -498,10 +609,13 @@ LINE TESTING IN HULLS
 
 /*
 ==================
-SV_RecursiveHullCheck
+SV_RecursiveHullCheckReference
+
+The original recursive walk, used by hulls without a flattened copy and to
+verify SV_RecursiveHullCheck
 ==================
 */
-qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace)
+qboolean SV_RecursiveHullCheckReference (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace)
 {
 	int		i, side;
 	float		t1, t2, frac, midf;
@@ -546,9 +660,9 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 	}
 
 	if (t1 >= 0 && t2 >= 0)
-		return SV_RecursiveHullCheck (hull, node->children[0], p1f, p2f, p1, p2, trace);
+		return SV_RecursiveHullCheckReference (hull, node->children[0], p1f, p2f, p1, p2, trace);
 	if (t1 < 0 && t2 < 0)
-		return SV_RecursiveHullCheck (hull, node->children[1], p1f, p2f, p1, p2, trace);
+		return SV_RecursiveHullCheckReference (hull, node->children[1], p1f, p2f, p1, p2, trace);
 
 	// put the crosspoint DIST_EPSILON pixels on the near side
 	if (t1 < 0)
@@ -564,7 +678,7 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 	side = (t1 < 0);
 
 	// move up to the node
-	if (!SV_RecursiveHullCheck(hull, node->children[side], p1f, midf, p1, mid, trace))
+	if (!SV_RecursiveHullCheckReference(hull, node->children[side], p1f, midf, p1, mid, trace))
 		return false;
 
 #ifdef PARANOID
@@ -575,8 +689,8 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 	}
 #endif
 
-	if (SV_HullPointContents(hull, node->children[side^1], mid) != CONTENTS_SOLID)	// go past the node
-		return SV_RecursiveHullCheck (hull, node->children[side^1], midf, p2f, mid, p2, trace);
+	if (SV_HullPointContentsReference(hull, node->children[side^1], mid) != CONTENTS_SOLID)	// go past the node
+		return SV_RecursiveHullCheckReference (hull, node->children[side^1], midf, p2f, mid, p2, trace);
 
 	if (trace->allsolid)
 		return false;		// never got out of the solid area
@@ -593,7 +707,7 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 		trace->plane.dist = -plane->dist;
 	}
 
-	while (SV_HullPointContents(hull, hull->firstclipnode, mid) == CONTENTS_SOLID)
+	while (SV_HullPointContentsReference(hull, hull->firstclipnode, mid) == CONTENTS_SOLID)
 	{ // shouldn't really happen, but does occasionally
 		frac -= 0.1;
 		if (frac < 0)
@@ -614,6 +728,185 @@ qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec
 	return false;
 }
 
+// One level of SV_RecursiveHullCheckReference. The points are read through
+// pointers and the midpoint lives in memory, like the arguments and the mid
+// array of the recursive version, so values are rounded to float at the same
+// points on x87.
+typedef struct
+{
+	mclipnode_t	*node;
+	int		side;
+	qboolean	crossed;	// went on to the far side, which returns for this level
+	float		frac, p1f, p2f, midf;
+	float		*p1, *p2;
+	vec3_t		mid;
+} hullcheck_t;
+
+/*
+==================
+SV_RecursiveHullCheck
+
+Same walk as SV_RecursiveHullCheckReference over the flattened clipnodes.
+Each level is kept on a stack instead of the call stack, and every float
+operation is done in the same order as the recursive version.
+==================
+*/
+qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t start, vec3_t end, trace_t *trace)
+{
+	int		i, depth;
+	float		t1, t2, frac, midf;
+	float		*p1, *p2, *mid;
+	mclipnode_t	*node;
+	hullcheck_t	stack[MAX_FLAT_HULL_DEPTH], *split;
+
+	if (!hull->flatnodes)
+		return SV_RecursiveHullCheckReference (hull, num, p1f, p2f, start, end, trace);
+
+	depth = 0;
+	p1 = start;
+	p2 = end;
+
+descend:
+	while (num >= 0)
+	{
+		if (num < hull->firstclipnode || num > hull->lastclipnode)
+			Sys_Error ("SV_RecursiveHullCheck: bad node number");
+
+		// find the point distances
+		node = hull->flatnodes + num;
+
+		if (node->type < 3)
+		{
+			t1 = p1[node->type] - node->dist;
+			t2 = p2[node->type] - node->dist;
+		}
+		else
+		{
+			t1 = DotProduct(node->normal, p1) - node->dist;
+			t2 = DotProduct(node->normal, p2) - node->dist;
+		}
+
+		if (t1 >= 0 && t2 >= 0)
+		{
+			num = node->children[0];
+			continue;
+		}
+		if (t1 < 0 && t2 < 0)
+		{
+			num = node->children[1];
+			continue;
+		}
+
+		if (depth == MAX_FLAT_HULL_DEPTH)
+			Sys_Error ("SV_RecursiveHullCheck: stack overflow");
+		split = &stack[depth++];
+
+		// put the crosspoint DIST_EPSILON pixels on the near side
+		if (t1 < 0)
+			frac = (t1 + DIST_EPSILON) / (t1 - t2);
+		else
+			frac = (t1 - DIST_EPSILON) / (t1 - t2);
+		frac = bound(0, frac, 1);
+
+		split->midf = p1f + (p2f - p1f) * frac;
+		for (i=0 ; i<3 ; i++)
+			split->mid[i] = p1[i] + frac * (p2[i] - p1[i]);
+
+		split->side = (t1 < 0);
+		split->crossed = false;
+		split->node = node;
+		split->frac = frac;
+		split->p1f = p1f;
+		split->p2f = p2f;
+		split->p1 = p1;
+		split->p2 = p2;
+
+		// move up to the node
+		num = node->children[split->side];
+		p2f = split->midf;
+		p2 = split->mid;
+	}
+
+// check for empty
+	if (num != CONTENTS_SOLID)
+	{
+		trace->allsolid = false;
+		if (num == CONTENTS_EMPTY)
+			trace->inopen = true;
+		else
+			trace->inwater = true;
+	}
+	else
+	{
+		trace->startsolid = true;
+	}
+
+	// the innermost open level got an empty result from its near side
+	while (depth > 0)
+	{
+		split = &stack[depth - 1];
+		if (split->crossed)
+		{
+			depth--;
+			continue;
+		}
+
+		node = split->node;
+
+		if (SV_HullPointContents(hull, node->children[split->side^1], split->mid) != CONTENTS_SOLID)	// go past the node
+		{
+			split->crossed = true;
+			num = node->children[split->side^1];
+			p1f = split->midf;
+			p2f = split->p2f;
+			p1 = split->mid;
+			p2 = split->p2;
+			goto descend;
+		}
+
+		if (trace->allsolid)
+			return false;		// never got out of the solid area
+
+		// the other side of the node is solid, this is the impact point
+		if (!split->side)
+		{
+			VectorCopy (node->normal, trace->plane.normal);
+			trace->plane.dist = node->dist;
+		}
+		else
+		{
+			VectorNegate (node->normal, trace->plane.normal);
+			trace->plane.dist = -node->dist;
+		}
+
+		frac = split->frac;
+		midf = split->midf;
+		mid = split->mid;
+
+		while (SV_HullPointContents(hull, hull->firstclipnode, mid) == CONTENTS_SOLID)
+		{ // shouldn't really happen, but does occasionally
+			frac -= 0.1;
+			if (frac < 0)
+			{
+				trace->fraction = midf;
+				VectorCopy (mid, trace->endpos);
+				Con_DPrintf ("backup past 0\n");
+				return false;
+			}
+			midf = split->p1f + (split->p2f - split->p1f) * frac;
+			for (i=0 ; i<3 ; i++)
+				mid[i] = split->p1[i] + frac * (split->p2[i] - split->p1[i]);
+		}
+
+		trace->fraction = midf;
+		VectorCopy (mid, trace->endpos);
+
+		return false;
+	}
+
+	return true;		// empty
+}
+
 /*
 ==================
 SV_ClipMoveToEntity
@@ -622,11 +915,12 @@ Handles selection or creation of a clipping hull, and offseting (and
 eventually rotation) of the end points
 ==================
 */
-trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end)
+trace_t SV_ClipMoveToEntity (trace_context_t *ctx, edict_t *ent, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end)
 {
 	trace_t	trace;
 	vec3_t	offset, start_l, end_l;
 	hull_t	*hull;
+	qboolean	result;
 
 // fill in a default trace
 	memset (&trace, 0, sizeof(trace_t));
@@ -635,13 +929,19 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t max
 	VectorCopy (end, trace.endpos);
 
 // get the clipping hull
-	hull = SV_HullForEntity (ent, mins, maxs, offset);
+	hull = SV_HullForEntity (ctx, ent, mins, maxs, offset);
 
 	VectorSubtract (start, offset, start_l);
 	VectorSubtract (end, offset, end_l);
 
 // trace a line through the apropriate clipping hull
-	SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
+	if (tas_trace_record.value && hull->flatnodes)
+	{	// record what the original walk returns
+		result = SV_RecursiveHullCheckReference (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
+		TraceRecord_Store (hull, start_l, end_l, end, result, &trace);
+	}
+	else
+		SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
 
 // fix trace up by the offset
 	if (trace.fraction != 1)
@@ -654,6 +954,33 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t max
 	return trace;
 }
 
+/*
+==================
+SV_ClipMoveToWorld
+
+Clips against the world model only. With tas_trace_cache the result is
+remembered, the trace depends on nothing but the hull and the exact start,
+end and mins, so replays of the same frames get it back without a hull walk
+==================
+*/
+static trace_t SV_ClipMoveToWorld (trace_context_t *ctx, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end)
+{
+	trace_t	trace;
+	int	hullnum;
+
+	if (!tas_trace_cache.value)
+		return SV_ClipMoveToEntity (ctx, ctx->worldedict, start, mins, maxs, end);
+
+	hullnum = SV_HullIndexForSize (mins, maxs);
+	if (TraceCache_Lookup (ctx->worldmodel, start, mins, end, hullnum, &trace))
+		return trace;
+
+	trace = SV_ClipMoveToEntity (ctx, ctx->worldedict, start, mins, maxs, end);
+	TraceCache_Store (ctx->worldmodel, start, mins, end, hullnum, &trace);
+
+	return trace;
+}
+
 //===========================================================================
 
 /*
@@ -712,9 +1039,9 @@ void SV_ClipToLinks (areanode_t *node, moveclip_t *clip)
 		}
 
 		if ((int)touch->v.flags & FL_MONSTER)
-			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
+			trace = SV_ClipMoveToEntity (clip->ctx, touch, clip->start, clip->mins2, clip->maxs2, clip->end);
 		else
-			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
+			trace = SV_ClipMoveToEntity (clip->ctx, touch, clip->start, clip->mins, clip->maxs, clip->end);
 		if (trace.allsolid || trace.startsolid || trace.fraction < clip->trace.fraction)
 		{
 			trace.ent = touch;
@@ -776,6 +1103,16 @@ SV_Move
 ==================
 */
 trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict)
+{
+	return SV_MoveContext (SV_ThreadTraceContext(), start, mins, maxs, end, type, passedict);
+}
+
+/*
+==================
+SV_MoveContext
+==================
+*/
+trace_t SV_MoveContext (trace_context_t *ctx, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict)
 {
 	moveclip_t	clip;
 	int		i;
@@ -795,8 +1132,9 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 	}
 
 // clip to world
-	clip.trace = SV_ClipMoveToEntity (sv.edicts, start, mins, maxs, end);
+	clip.trace = SV_ClipMoveToWorld (ctx, start, mins, maxs, end);
 
+	clip.ctx = ctx;
 	clip.start = start;
 	clip.end = end;
 	clip.mins = mins;
@@ -822,7 +1160,7 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 	SV_MoveBounds (start, clip.mins2, clip.maxs2, end, clip.boxmins, clip.boxmaxs);
 
 // clip to entities
-	SV_ClipToLinks (sv_areanodes, &clip);
+	SV_ClipToLinks (ctx->areanodes, &clip);
 
 	return clip.trace;
 }
@@ -40,9 +40,32 @@ typedef struct
 #define	MOVE_NOMONSTERS	1
 #define	MOVE_MISSILE	2
 
+typedef struct trace_context_s
+{
+	edict_t		*worldedict;
+	model_t		*worldmodel;
+	model_t		**models;
+	struct areanode_s	*areanodes;
+	hull_t		box_hull;		// scratch hull for clipping against bounding boxes
+	dclipnode_t	box_clipnodes[6];
+	mplane_t	box_planes[6];
+} trace_context_t;
+// everything a trace reads or writes, the world is shared read only and
+// the box hull is private, so traces with different contexts can run in parallel
+
 void SV_ClearWorld (void);
 // called after the world model has been loaded, before linking any entities
 
+void SV_InitTraceContext (trace_context_t *ctx);
+trace_context_t *SV_ThreadTraceContext (void);
+// contexts point to the current server world and must be refreshed after
+// a new map is loaded, the thread context does that on every call
+
+int SV_AreaNodesSize (void);
+void SV_SaveAreaNodes (void *dest);
+void SV_RestoreAreaNodes (const void *src);
+// raw snapshot of the area links, only valid for the same server instance
+
 void SV_UnlinkEdict (edict_t *ent);
 // call before removing an entity, and before trying to move one,
 // so it doesn't clip against itself
@@ -55,15 +78,21 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers);
 // if touchtriggers, calls prog functions for the intersected triggers
 
 int SV_HullPointContents (hull_t *hull, int num, vec3_t p);
+int SV_HullPointContentsReference (hull_t *hull, int num, vec3_t p);
 int SV_PointContents (vec3_t p);
+int SV_PointContentsContext (trace_context_t *ctx, vec3_t p);
 // returns the CONTENTS_* value from the world at the given point.
 // does not check any entities at all
 // the non-true version remaps the water current contents to content_water
 
 qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace);
+qboolean SV_RecursiveHullCheckReference (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace);
+// the reference versions walk the clipnodes and planes recursively, the others
+// use the flattened clipnodes when the hull has them and give the same results
 edict_t	*SV_TestEntityPosition (edict_t *ent);
 
 trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict);
+trace_t SV_MoveContext (trace_context_t *ctx, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, edict_t *passedict);
 // mins and maxs are reletive
 
 // if the entire move stays in a solid volume, trace.allsolid will be set
@@ -469,6 +469,38 @@ void Hunk_FreeToLowMark (int mark)
 	hunk_low_used = mark;
 }
 
+/*
+===================
+Hunk_SaveLow
+===================
+*/
+void Hunk_SaveLow (int mark, void *data, int size)
+{
+	if (mark < 0 || size < 0 || mark + size > hunk_low_used)
+		Sys_Error ("Hunk_SaveLow: bad range %i, %i", mark, size);
+	memcpy (data, hunk_base + mark, size);
+}
+
+/*
+===================
+Hunk_RestoreLow
+
+Puts back a range of low blocks that was saved starting at mark, the
+headers are part of the data, so the blocks come back exactly as they were
+===================
+*/
+qboolean Hunk_RestoreLow (int mark, void *data, int size)
+{
+	if (mark != hunk_low_used || size < 0 || hunk_size - hunk_low_used - hunk_high_used < size)
+		return false;
+
+	hunk_low_used += size;
+	Cache_FreeLow (hunk_low_used);
+	memcpy (hunk_base + mark, data, size);
+
+	return true;
+}
+
 int Hunk_HighMark (void)
 {
 	if (hunk_tempactive)
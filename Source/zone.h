@@ -104,6 +104,9 @@ void *Hunk_HighAllocName (int size, char *name);
 
 int Hunk_LowMark (void);
 void Hunk_FreeToLowMark (int mark);
+void Hunk_SaveLow (int mark, void *data, int size);
+qboolean Hunk_RestoreLow (int mark, void *data, int size);
+// copies the low blocks from mark and later back to the same place, only if the low mark is there
 
 int Hunk_HighMark (void);
 void Hunk_FreeToHighMark (int mark);
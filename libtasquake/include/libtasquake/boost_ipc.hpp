@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <deque>
 #include <memory>
 #include <vector>
@@ -7,12 +10,98 @@
 
 namespace ipc {
 
+    // Messages are sent as a 4 byte length followed by the payload
+    const std::uint32_t MAX_MESSAGE_BYTES = 1 << 25;
+
     struct Message {
         void* address = nullptr;
         size_t length = 0;
         size_t connection_id = 0;
     };
 
+    // Received messages live in pooled buffers, hand them back with free_message instead of free
+    void* alloc_message_buffer(std::uint32_t size);
+    void free_message(Message& msg);
+
+    // Splits the byte stream from a socket into messages. Small messages are copied out of a staging buffer,
+    // the rest of a large message is read straight into its own buffer.
+    class message_reader
+    {
+    public:
+        ~message_reader();
+
+        template<typename Handler>
+        void async_read(boost::asio::ip::tcp::socket& socket, Handler&& handler) {
+            size_t remaining = m_currentMessage.length - m_uBytesWritten;
+            if(m_bInBody && m_currentMessage.address && remaining > sizeof(sockbuf)) {
+                m_bDirect = true;
+                auto buffer = boost::asio::buffer((std::uint8_t*)m_currentMessage.address + m_uBytesWritten, remaining);
+                boost::asio::async_read(socket, buffer, std::forward<Handler>(handler));
+            } else {
+                m_bDirect = false;
+                socket.async_read_some(boost::asio::buffer(sockbuf, sizeof(sockbuf)), std::forward<Handler>(handler));
+            }
+        }
+
+        // Processes the bytes from the last read, on_message is called for every finished message
+        template<typename OnMessage>
+        void consume(size_t length, OnMessage&& on_message) {
+            if(m_bDirect) {
+                m_uBytesWritten += length;
+                finish_message(on_message);
+                return;
+            }
+
+            const std::uint8_t* buffer = (const std::uint8_t*)sockbuf;
+            while(length > 0) {
+                if(!m_bInBody) {
+                    size_t bytes = std::min(sizeof(m_uHeader) - m_uHeaderBytes, length);
+                    memcpy((std::uint8_t*)&m_uHeader + m_uHeaderBytes, buffer, bytes);
+                    m_uHeaderBytes += bytes;
+                    buffer += bytes;
+                    length -= bytes;
+                    if(m_uHeaderBytes == sizeof(m_uHeader)) {
+                        start_message();
+                        finish_message(on_message);
+                    }
+                } else {
+                    size_t bytes = std::min(m_currentMessage.length - m_uBytesWritten, length);
+                    if(m_currentMessage.address)
+                        memcpy((std::uint8_t*)m_currentMessage.address + m_uBytesWritten, buffer, bytes);
+                    m_uBytesWritten += bytes;
+                    buffer += bytes;
+                    length -= bytes;
+                    finish_message(on_message);
+                }
+            }
+        }
+
+    private:
+        void start_message();
+
+        template<typename OnMessage>
+        void finish_message(OnMessage& on_message) {
+            if(!m_bInBody || m_uBytesWritten != m_currentMessage.length)
+                return;
+
+            // Oversized messages are skipped without a buffer
+            if(m_currentMessage.address)
+                on_message(m_currentMessage);
+            m_currentMessage = Message();
+            m_uBytesWritten = 0;
+            m_uHeaderBytes = 0;
+            m_bInBody = false;
+        }
+
+        char sockbuf[4096];
+        Message m_currentMessage;
+        size_t m_uBytesWritten = 0;
+        std::uint32_t m_uHeader = 0;
+        size_t m_uHeaderBytes = 0;
+        bool m_bInBody = false;
+        bool m_bDirect = false;
+    };
+
     class server;
 
     class session
@@ -26,9 +115,7 @@ namespace ipc {
 
     private:  
         void do_read();
-        char sockbuf[4096];
-        Message m_currentMessage;
-        size_t m_uBytesWritten = 0;
+        message_reader reader_;
         server* owner_ = nullptr;
     };
 
@@ -75,9 +162,7 @@ namespace ipc {
         boost::asio::ip::tcp::socket* socket_ = nullptr;
         bool m_bConnected = false;
     private:
-        char sockbuf[1024];
-        Message m_currentMessage;
-        size_t m_uBytesWritten = 0;
+        message_reader reader_;
         std::vector<Message> messages_;
         std::mutex message_mutex;
         std::thread receiveThread;
@@ -21,6 +21,21 @@ namespace TASQuakeIO
         static std::shared_ptr<Buffer> CreateFromCString(const char* str);
     };
 
+
+    // Read-only view of a whole file, memory mapped so large files are not copied on load
+    struct MappedFile {
+        void* ptr = nullptr;
+        std::uint32_t size = 0;
+
+        ~MappedFile();
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        static std::shared_ptr<MappedFile> Open(const char* filepath); // nullptr if the file could not be mapped
+    private:
+        void* m_pFileHandle = nullptr;
+        void* m_pMappingHandle = nullptr;
+    };
         
     template<typename T>
     void GetElemsFromBuffer(void* ptr, size_t size, std::vector<T>& vec) {
@@ -109,6 +124,9 @@ namespace TASQuakeIO
     class BufferWriteInterface : public WriteInterface {
     public:
         static BufferWriteInterface Init();
+        // Writes into a per-thread buffer that keeps its capacity between messages,
+        // the contents are only valid until the next InitArena call on the same thread
+        static BufferWriteInterface InitArena();
         virtual bool CanWrite() override;
         virtual bool WriteLine(const std::string& str) override;
         virtual std::uint32_t Write(const char* format, ...) override;
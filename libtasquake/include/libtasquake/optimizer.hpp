@@ -1,12 +1,17 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
 #include <memory>
 #include <random>
+#include <utility>
 #include <vector>
 #include "libtasquake/vector.hpp"
 #include "libtasquake/script_parse.hpp"
 #include "libtasquake/script_playback.hpp"
+#include "libtasquake/trajectory.hpp"
 
 namespace TASQuake {
     class Optimizer;
@@ -189,6 +194,20 @@ namespace TASQuake {
     const char* OptimizerGoalStr(OptimizerGoal goal);
     struct RunConditions;
 
+    // Per-iteration state of a run before a given frame, allows resuming an iteration from the middle
+    struct OptimizerRunCheckpoint {
+        std::uint32_t m_uFrame = 0;
+        bool m_bFinishedLevel = false;
+        bool m_bDied = false;
+        double m_dLevelTime = 0.0;
+        double m_dTeleportTime = 1000.0;
+        std::uint32_t m_uKills = 0;
+        std::uint32_t m_uSecrets = 0;
+        std::uint32_t m_uCenterPrints = 0;
+        float m_fHP = 100.0f;
+        float m_fAP = 0;
+    };
+
     struct OptimizerRun {
         double m_dEfficacy = std::numeric_limits<double>::lowest();
         PlaybackInfo playbackInfo;
@@ -204,12 +223,15 @@ namespace TASQuake {
         float m_fAP = 0;
 
         void ResetIteration();
+        OptimizerRunCheckpoint GetCheckpoint() const;
+        // Resets the iteration to the checkpoint, vecData contains the frame data of the run the checkpoint was taken from
+        void ResumeIteration(const OptimizerRunCheckpoint& checkpoint, const std::vector<FrameData>& vecData);
         void CalculateEfficacy(OptimizerGoal goal, const RunConditions* conditions);
         double RunEfficacy() const { return m_dEfficacy; };
         bool IsBetterThan(const OptimizerRun& run) const;
         void StrafeBounds(size_t blockIndex, float& min, float& max) const;
-        void WriteToBuffer(TASQuakeIO::BufferWriteInterface& writer) const;
-        void ReadFromBuffer(TASQuakeIO::BufferReadInterface& reader);
+        void WriteToBuffer(TASQuakeIO::BufferWriteInterface& writer, TrajectoryEncoding encoding = TrajectoryEncoding::Raw) const;
+        bool ReadFromBuffer(TASQuakeIO::BufferReadInterface& reader); // false if the trajectory or script is malformed
     };
 
     struct OptimizerSettings;
@@ -253,6 +275,7 @@ namespace TASQuake {
 
     struct Optimizer {
         void ResetIteration();
+        void ResumeIteration(const OptimizerRunCheckpoint& checkpoint, const std::vector<FrameData>& vecData);
         // Gets the current frame block or null if no block for current frame
         const FrameBlock* GetCurrentFrameBlock() const;
         // Runner calls this after every frame
@@ -278,4 +301,39 @@ namespace TASQuake {
         std::uint32_t m_uIterationsWithoutProgress = 0; // How many iterations have been ran without progress, determines when we should reset back to best
         RunConditions m_runConditions;
     };
+
+    // A candidate script the multi-game server has dealt out to a client
+    struct MultiGameCandidate {
+        TASScript script;
+        size_t connection_id = 0;
+        double sent_time = 0;
+        bool reassigned = false;
+    };
+
+    struct MultiGameClient {
+        double last_result_time = 0;
+        double seconds_per_candidate = 0; // Moving average of the time between results
+        bool slow = false; // Had candidates dealt out again, gets no new work until it sends a result
+    };
+
+    // Deals out batches of mutations of the best run to the clients of a multi-game optimizer run.
+    // Every client keeps a few batches in flight so it never waits for the server, candidates that
+    // a client sits on for too long are dealt out again to whoever asks next and the first result wins.
+    struct MultiGameCoordinator {
+        typedef std::vector<std::pair<size_t, std::vector<std::uint32_t>>> Batches;
+
+        std::uint32_t next_id = 1;
+        std::map<std::uint32_t, MultiGameCandidate> in_flight;
+        std::deque<std::uint32_t> reassign;
+        std::map<size_t, MultiGameClient> clients;
+
+        void Reset();
+        void Add_Client(size_t connection_id);
+        void Remove_Client(size_t connection_id); // Candidates the client had are dealt out again
+        // Returns the batches to send as connection id and candidate ids, next_candidate makes the scripts of new candidates
+        Batches Deal(double now, size_t batch_size, size_t max_in_flight, const std::function<TASScript()>& next_candidate);
+        void Reassign_Slow(double now, size_t max_in_flight);
+        std::vector<std::uint32_t> Take_Batch(size_t connection_id, size_t count, double now, const std::function<TASScript()>& next_candidate);
+        bool Receive_Result(size_t connection_id, std::uint32_t id, double now); // Returns false for duplicate results
+    };
 }
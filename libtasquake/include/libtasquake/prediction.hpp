@@ -1,6 +1,7 @@
 #pragma once
 
 #include "libtasquake/io.hpp"
+#include "libtasquake/trajectory.hpp"
 #include "libtasquake/vector.hpp"
 #include <cstdint>
 #include <vector>
@@ -18,8 +19,8 @@ namespace TASQuake
         std::int32_t m_iStartFrame = 0;
         std::int32_t m_iEndFrame = 0;
 
-        void Load_From_Memory(TASQuakeIO::BufferReadInterface& iface);
-        void Write_To_Memory(TASQuakeIO::BufferWriteInterface& iface) const;
+        bool Load_From_Memory(TASQuakeIO::BufferReadInterface& iface); // false if the trajectory is malformed
+        void Write_To_Memory(TASQuakeIO::BufferWriteInterface& iface, TrajectoryEncoding encoding = TrajectoryEncoding::Raw) const;
         int FindFrameBlock(const Trace& trace); // -1 if none matched, frameblock index otherwise
     };
 
@@ -3,6 +3,7 @@
 #include "libtasquake/insertion_order_map.hpp"
 #include <unordered_map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 enum class HookEnum
@@ -25,6 +26,30 @@ struct TestBlock
 	TestBlock();
 };
 
+enum class ScriptLineType
+{
+	Empty,
+	FrameNumber,
+	Convar,
+	Toggle,
+	Command
+};
+
+// A classified .qtas line, name points into the line that was tokenized
+struct ScriptLineToken
+{
+	ScriptLineType type = ScriptLineType::Empty;
+	std::string_view name; // Cvar or toggle name, or the whole command
+	float value = 0; // Cvar value
+	bool state = false; // Toggle state
+	bool relative = false; // Frame number starts with +
+	bool frame_valid = true; // Frame number fits in an int
+	int frame = 0;
+};
+
+std::string_view Strip_Script_Line(std::string_view line); // Removes comments and surrounding whitespace
+ScriptLineToken Tokenize_Script_Line(std::string_view line); // Does not allocate
+
 struct FrameBlock
 {
 	FrameBlock();
@@ -37,17 +62,15 @@ struct FrameBlock
 	void Stack(const FrameBlock& new_block);
 	std::string GetCommand() const;
 	void Add_Command(const std::string& line);
-	void Parse_Frame_No(const std::string& line, int& running_frame);
-	void Parse_Convar(const std::string& line, size_t& spaceIndex, size_t& startIndex);
-	void Parse_Toggle(const std::string& line);
-	void Parse_Command(const std::string& line);
-	void Parse_Line(const std::string& line, int& running_frame);
+	void Parse_Token(const ScriptLineToken& token, int& running_frame);
+	void Parse_Line(std::string_view line, int& running_frame);
 	void Reset();
 
 	bool HasToggleValue(const std::string& cmd, bool value) const;
 	bool HasCvarValue(const std::string& cmd, float value) const;
 	bool HasToggle(const std::string& cmd) const;
 	bool HasConvar(const std::string& cvar) const;
+	bool operator==(const FrameBlock& other) const; // Same frame and the same cvars, toggles and commands in the same order
 };
 
 class TASScript
@@ -56,15 +79,21 @@ public:
 	TASScript();
 	TASScript(const char* file_name);
 	void ApplyChanges(const TASScript* script, int& first_changed_frame);
-	bool Load_From_Memory(TASQuakeIO::BufferReadInterface& iface);
+	int FirstChangedFrame(const TASScript* script) const; // INT_MAX if the scripts are identical
+	int FirstEffectiveChange(const TASScript* script) const; // Ignores edits that leave every frame's cvars the same and run no toggle or command
+	bool Load_From_Memory(TASQuakeIO::BufferReadInterface& iface); // Accepts both text and binary scripts
 	void Write_To_Memory(TASQuakeIO::BufferWriteInterface& iface) const;
+	void Write_To_Memory_Binary(TASQuakeIO::BufferWriteInterface& iface) const; // Size prefixed binary script for IPC
+	bool Load_From_Binary(const void* data, std::uint32_t size);
+	void Write_To_Binary(TASQuakeIO::BufferWriteInterface& iface) const;
+	static bool Is_Binary_File_Name(const std::string& name); // .qtb files are binary, everything else is text
 	bool Load_From_File();
 	void Write_To_File() const;
 	bool Load_From_String(const char* input);
 	std::vector<FrameBlock> blocks;
 	std::string file_name;
 	std::string ToString() const;
-	mutable int prev_block_number = 0;
+	mutable int prev_block_number = 0; // Cursor for sequential GetBlockIndex calls
 	void Prune(int min_frame, int max_frame);
 	void Prune(int min_frame);
 	void RemoveBlocksAfterFrame(int frame);
@@ -73,18 +102,46 @@ public:
 	void AddScript(const TASScript* script, int frame);
 	bool ShiftSingleBlock(size_t blockIndex, int delta);
 	bool ShiftBlocks(size_t blockIndex, int delta);
-	int GetBlockIndex(int frame) const;
+	int GetBlockIndex(int frame) const; // Index of the first block at or after frame, blocks.size() if there is none
 	void AddCvar(const std::string& cmd, float value, int frame);
 	void AddToggle(const std::string& cmd, bool state, int frame);
 	void AddCommand(const std::string& cmd, int frame);
 	bool AddShot(float pitch, float yaw, int frame, int turn_frames); // Returns true if script changed
 	void RemoveShot(int frame, int turn_frames);
 	const FrameBlock* Get_Frameblock(int frame) const;
+	std::uint64_t Checksum() const; // Hash of the block contents, used to detect desync between IPC peers
 private:
 	bool _Load_From_File(TASQuakeIO::ReadInterface& readInterface);
 	void _Write_To_File(TASQuakeIO::WriteInterface& writeInterface) const;
 };
 
+// Block level edit that turns one script into another, sent over IPC instead of the whole script
+struct ScriptPatch
+{
+	enum class OpType : std::uint8_t { Insert, Delete, Modify };
+
+	struct Op
+	{
+		OpType type;
+		std::uint32_t index; // Block index at the time the op is applied, ops are applied in order
+	};
+
+	std::uint64_t base_checksum = 0; // Checksum of the script the patch applies to
+	std::uint64_t result_checksum = 0; // Checksum after applying the patch
+	std::vector<Op> ops;
+	std::vector<FrameBlock> blocks; // New contents for each insert and modify op, in op order
+
+	static ScriptPatch Diff(const TASScript& from, const TASScript& to);
+	bool Apply(TASScript& script, int& first_changed_frame) const; // Returns false if the script is not the base of the patch
+	void Write_To_Memory(TASQuakeIO::BufferWriteInterface& iface) const; // Size prefixed like Write_To_Memory_Binary
+	bool Load_From_Memory(TASQuakeIO::BufferReadInterface& iface);
+
+	// Writes a patch from baseline to script, or the full script if there is no baseline or the patch isn't smaller
+	static void Write_Update(const TASScript* baseline, const TASScript& script, TASQuakeIO::BufferWriteInterface& iface);
+	// Applies a patch or a full script written by Write_Update, returns false if a patch didn't match the script
+	static bool Apply_Update(TASScript& script, TASQuakeIO::BufferReadInterface& iface, int& first_changed_frame);
+};
+
 class TestScript
 {
 public:
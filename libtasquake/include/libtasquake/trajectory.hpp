@@ -0,0 +1,26 @@
+#pragma once
+
+#include "libtasquake/io.hpp"
+#include "libtasquake/vector.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace TASQuake {
+    struct FrameData;
+
+    // Written in front of every trajectory so the reader knows how to decode it
+    enum class TrajectoryEncoding : std::uint8_t {
+        Raw = 0, // Plain array of the structs
+        Compact = 1 // Quantized, delta encoded varints
+    };
+
+    // Powers of two so that whole values and the 999 no velocity marker decode exactly
+    constexpr float TRAJECTORY_POSITION_STEP = 1.0f / 32; // Error is at most half a step per axis
+    constexpr double TRAJECTORY_ANGLE_STEP = 1.0 / 65536; // Radians
+
+    // Compact falls back to raw if some value is out of the quantized range
+    void Write_Trajectory(TASQuakeIO::BufferWriteInterface& writer, const std::vector<Vector>& points, TrajectoryEncoding encoding);
+    bool Read_Trajectory(TASQuakeIO::BufferReadInterface& reader, std::vector<Vector>& points);
+    void Write_Trajectory(TASQuakeIO::BufferWriteInterface& writer, const std::vector<FrameData>& frames, TrajectoryEncoding encoding);
+    bool Read_Trajectory(TASQuakeIO::BufferReadInterface& reader, std::vector<FrameData>& frames);
+}
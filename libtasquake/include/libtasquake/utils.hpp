@@ -33,6 +33,8 @@ namespace TASQuake {
 
 // desc: Prints the edict index that the player is looking at.
 void Cmd_TAS_Trace_Edict();
+// desc: Usage: tas_trace_verify [count]. Runs random traces through the loaded map with both hull trace implementations and reports any difference.
+void Cmd_TAS_Trace_Verify();
 bool IsZero(double number);
 double NormalizeRad(double rad);   // [-pi, pi]
 double NormalizeDeg(double angle); // [-180, 180]
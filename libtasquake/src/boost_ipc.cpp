@@ -3,10 +3,115 @@
 #include <array>
 #include <chrono>
 #include <iostream>
+#include <mutex>
 #include <thread>
 
 using namespace ipc;
 
+namespace {
+    // Buffers are handed out in power of two size classes so they can be reused across messages
+    const size_t MIN_CLASS_SHIFT = 8;
+    const size_t CLASS_COUNT = 18; // 256 B up to MAX_MESSAGE_BYTES
+    const size_t MAX_CACHED_PER_CLASS = 8;
+    const size_t MAX_CACHED_BYTES = 1 << 26;
+
+    struct BufferPool {
+        std::mutex mutex;
+        std::vector<void*> free_lists[CLASS_COUNT];
+        size_t cached_bytes = 0;
+
+        ~BufferPool() {
+            for(auto& list : free_lists) {
+                for(void* ptr : list)
+                    free(ptr);
+            }
+        }
+
+        static size_t Get_Class(size_t size) {
+            size_t index = 0;
+            while(((size_t)1 << (index + MIN_CLASS_SHIFT)) < size)
+                ++index;
+            return index;
+        }
+
+        static size_t Class_Bytes(size_t index) {
+            return (size_t)1 << (index + MIN_CLASS_SHIFT);
+        }
+
+        void* Alloc(size_t size) {
+            size_t index = Get_Class(size);
+            if(index >= CLASS_COUNT)
+                return malloc(size);
+
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                auto& list = free_lists[index];
+                if(!list.empty()) {
+                    void* ptr = list.back();
+                    list.pop_back();
+                    cached_bytes -= Class_Bytes(index);
+                    return ptr;
+                }
+            }
+
+            return malloc(Class_Bytes(index));
+        }
+
+        void Free(void* ptr, size_t size) {
+            size_t index = Get_Class(size);
+            if(index >= CLASS_COUNT) {
+                free(ptr);
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                auto& list = free_lists[index];
+                if(list.size() < MAX_CACHED_PER_CLASS && cached_bytes + Class_Bytes(index) <= MAX_CACHED_BYTES) {
+                    list.push_back(ptr);
+                    cached_bytes += Class_Bytes(index);
+                    return;
+                }
+            }
+
+            free(ptr);
+        }
+    };
+
+    BufferPool& Get_Pool() {
+        static BufferPool pool;
+        return pool;
+    }
+}
+
+void* ipc::alloc_message_buffer(std::uint32_t size) {
+    return Get_Pool().Alloc(size);
+}
+
+void ipc::free_message(Message& msg) {
+    if(msg.address) {
+        Get_Pool().Free(msg.address, msg.length);
+        msg.address = nullptr;
+    }
+}
+
+ipc::message_reader::~message_reader() {
+    free_message(m_currentMessage);
+}
+
+void ipc::message_reader::start_message() {
+    m_bInBody = true;
+    m_uBytesWritten = 0;
+    m_currentMessage.length = m_uHeader;
+
+    if(m_uHeader > MAX_MESSAGE_BYTES) {
+        TASQuake::Log("Message exceeded the maximum size: %u > %u\n", m_uHeader, MAX_MESSAGE_BYTES);
+        m_currentMessage.address = nullptr;
+    } else {
+        m_currentMessage.address = alloc_message_buffer(m_uHeader);
+    }
+}
+
 ipc::session::session(boost::asio::ip::tcp::socket socket, size_t connection_id, ipc::server* owner)
 : socket_(std::move(socket)), connection_id(connection_id), owner_(owner)
  { }
@@ -15,68 +120,26 @@ void ipc::session::start() {
     do_read();
 }
 
-static void write_to_socket(boost::asio::ip::tcp::socket& socket, void* data, size_t size) {
-    uint8_t* ptr = (uint8_t*)data;
-    int32_t total_bytes = size;
-    size_t written = 0;
-    while(total_bytes > 0) {
-        size_t bytes = socket.write_some(boost::asio::buffer(ptr + written, total_bytes));
-        total_bytes -= bytes;
-        written += bytes;
-    }
+// Sends the length and the payload with a single gathered write
+static void write_to_socket(boost::asio::ip::tcp::socket& socket, void* data, uint32_t size) {
+    std::array<boost::asio::const_buffer, 2> buffers = {
+        boost::asio::buffer(&size, sizeof(size)),
+        boost::asio::buffer(data, size)
+    };
+    boost::asio::write(socket, buffers);
 }
 
 void ipc::session::do_read() {
     auto self(shared_from_this());
-    socket_.async_read_some(boost::asio::buffer(sockbuf, sizeof(sockbuf)),
+    reader_.async_read(socket_,
     [this, self](boost::system::error_code ec, std::size_t length)
     {
     if (!ec)
     {
-        uint8_t* buffer = (uint8_t*)sockbuf;
-        while(length > 0) {
-            if(this->m_currentMessage.length == 0) {
-                if(length < 4) {
-                    TASQuake::Log("Message was too short, did not contain length!\n");
-                    goto end;
-                } 
-
-                uint32_t size_bytes;
-                memcpy(&size_bytes, buffer, sizeof(uint32_t));
-                const uint32_t MAX_BYTES = 1 << 25;
-                if(size_bytes > MAX_BYTES) {
-                    TASQuake::Log("Message exceeded the maximum size: %u > %u\n", size_bytes, MAX_BYTES);
-                    this->m_currentMessage.address = nullptr;
-                } else {
-                    this->m_currentMessage.address = malloc(size_bytes);
-                }
-                this->m_currentMessage.connection_id = this->connection_id;
-                this->m_currentMessage.length = size_bytes;
-                buffer += sizeof(uint32_t);
-                length -= 4;
-            } else {
-                size_t bytesToRead = std::min(this->m_currentMessage.length - this->m_uBytesWritten, length);
-                if(this->m_currentMessage.address)
-                        memcpy((uint8_t*)this->m_currentMessage.address + this->m_uBytesWritten, buffer, bytesToRead);
-                this->m_uBytesWritten += bytesToRead;
-                length -= bytesToRead;
-                buffer += bytesToRead;
-
-                if(this->m_currentMessage.length == this->m_uBytesWritten) {
-                    if(this->m_currentMessage.address) {
-                        this->owner_->message_from_connection(this->m_currentMessage);
-                    }
-                    this->m_currentMessage.address = nullptr;
-                    this->m_currentMessage.connection_id = 0;
-                    this->m_currentMessage.length = 0;
-                    this->m_uBytesWritten = 0;
-                } else if (this->m_currentMessage.length < this->m_uBytesWritten) {
-                    TASQuake::Log("A bad happened\n");
-                    abort();
-                }
-            }
-        }
-        end:
+        reader_.consume(length, [this](Message& msg) {
+            msg.connection_id = this->connection_id;
+            this->owner_->message_from_connection(msg);
+        });
         this->do_read();
     }
     else {
@@ -131,13 +194,14 @@ std::shared_ptr<session> ipc::server::get_session(size_t connection_id) {
 
 void ipc::server::get_messages(std::vector<Message>& messages) {
     std::lock_guard<std::mutex> guard(message_mutex);
-    messages = this->messages;
-    this->messages.clear();
+    messages.clear();
+    messages.swap(this->messages);
 }
 
 void ipc::server::send_message(size_t connection_id, void* data, uint32_t size) {
     auto sess = get_session(connection_id);
-    write_to_socket(sess->socket_, &size, sizeof(uint32_t));
+    if(!sess)
+        return;
     write_to_socket(sess->socket_, data, size);
 }
 
@@ -204,56 +268,15 @@ void ipc::client::get_messages(std::vector<Message>& messages, size_t timeoutMse
 }
 
 void ipc::client::do_read() {
-    socket_->async_read_some(boost::asio::buffer(sockbuf, sizeof(sockbuf)),
+    reader_.async_read(*socket_,
     [this](boost::system::error_code ec, std::size_t length)
     {
         if (!ec)
         {
-            uint8_t* buffer = (uint8_t*)sockbuf;
-            while(length > 0) {
-                if(this->m_currentMessage.length == 0) {
-                    if(length < 4) {
-                        TASQuake::Log("Message was too short, did not contain length!\n");
-                        goto end;
-                    } 
-
-                    uint32_t size_bytes;
-                    memcpy(&size_bytes, buffer, sizeof(uint32_t));
-                    const uint32_t MAX_BYTES = 1 << 25;
-                    if(size_bytes > MAX_BYTES) {
-                        TASQuake::Log("Message exceeded the maximum size: %u > %u\n", size_bytes, MAX_BYTES);
-                        this->m_currentMessage.address = nullptr;
-                    } else {
-                        this->m_currentMessage.address = malloc(size_bytes);
-                    }
-                    this->m_currentMessage.connection_id = 0;
-                    this->m_currentMessage.length = size_bytes;
-                    buffer += sizeof(uint32_t);
-                    length -= 4;
-                } else {
-                    size_t bytesToRead = std::min(this->m_currentMessage.length - this->m_uBytesWritten, length);
-                    if(this->m_currentMessage.address)
-                        memcpy((uint8_t*)this->m_currentMessage.address + this->m_uBytesWritten, buffer, bytesToRead);
-                    this->m_uBytesWritten += bytesToRead;
-                    length -= bytesToRead;
-                    buffer += bytesToRead;
-
-                    if(this->m_currentMessage.length == this->m_uBytesWritten) {
-                        if(this->m_currentMessage.address) {
-                            std::lock_guard<std::mutex> guard(this->message_mutex);
-                            this->messages_.push_back(this->m_currentMessage);
-                        }
-                        this->m_currentMessage.address = nullptr;
-                        this->m_currentMessage.connection_id = 0;
-                        this->m_currentMessage.length = 0;
-                        this->m_uBytesWritten = 0;
-                    } else if (this->m_currentMessage.length < this->m_uBytesWritten) {
-                        TASQuake::Log("A bad happened\n");
-                        abort();
-                    }
-                }
-            }
-            end:
+            reader_.consume(length, [this](Message& msg) {
+                std::lock_guard<std::mutex> guard(this->message_mutex);
+                this->messages_.push_back(msg);
+            });
             this->do_read();
         }
         else {
@@ -265,7 +288,6 @@ void ipc::client::do_read() {
 void ipc::client::send_message(void* data, uint32_t size) {
     if(!m_bConnected)
         return;
-    write_to_socket(*socket_, &size, sizeof(uint32_t));
     write_to_socket(*socket_, data, size);
 }
 
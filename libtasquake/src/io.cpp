@@ -3,6 +3,16 @@
 #include <cstring>
 #include <cstdarg>
 
+#ifdef _WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace TASQuakeIO;
 
 Buffer::~Buffer() {
@@ -41,6 +51,64 @@ std::shared_ptr<Buffer> Buffer::CreateFromCString(const char* str) {
     return ptr;
 }
 
+MappedFile::~MappedFile() {
+#ifdef _WINDOWS
+    if(ptr)
+        UnmapViewOfFile(ptr);
+    if(m_pMappingHandle)
+        CloseHandle(m_pMappingHandle);
+    if(m_pFileHandle)
+        CloseHandle(m_pFileHandle);
+#else
+    if(ptr)
+        munmap(ptr, size);
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::Open(const char* filepath) {
+    auto file = std::make_shared<MappedFile>();
+
+#ifdef _WINDOWS
+    HANDLE handle = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(handle == INVALID_HANDLE_VALUE)
+        return nullptr;
+    file->m_pFileHandle = handle;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(handle, &size) || size.QuadPart == 0 || size.QuadPart > UINT32_MAX)
+        return nullptr;
+    file->size = (std::uint32_t)size.QuadPart;
+
+    file->m_pMappingHandle = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!file->m_pMappingHandle)
+        return nullptr;
+
+    file->ptr = MapViewOfFile(file->m_pMappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if(!file->ptr)
+        return nullptr;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if(fd < 0)
+        return nullptr;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0 || (std::uint64_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping stays valid after the descriptor is closed
+    if(ptr == MAP_FAILED)
+        return nullptr;
+
+    file->ptr = ptr;
+    file->size = (std::uint32_t)st.st_size;
+#endif
+
+    return file;
+}
+
 FileReadInterface FileReadInterface::Init(const char* filepath) {
     FileReadInterface iface;
     iface.m_pStream.open(filepath);
@@ -148,6 +216,19 @@ BufferWriteInterface BufferWriteInterface::Init() {
     return iface;
 }
 
+BufferWriteInterface BufferWriteInterface::InitArena() {
+    thread_local std::shared_ptr<Buffer> arena;
+
+    // Someone still holds on to the previous contents, leave them alone
+    if(!arena || arena.use_count() > 1) {
+        arena = Buffer::CreateBuffer(128);
+    }
+
+    BufferWriteInterface iface;
+    iface.m_pBuffer = arena;
+    return iface;
+}
+
 bool BufferWriteInterface::CanWrite() {
     return true;
 }
@@ -160,15 +241,18 @@ bool BufferWriteInterface::WriteLine(const std::string& str) {
 std::uint32_t BufferWriteInterface::Write(const char* format, ...) {
     std::uint32_t bytesLeft = m_pBuffer->size - m_uFileOffset;
     va_list args;
+    va_list retry_args;
     va_start(args, format);
+    va_copy(retry_args, args); // args can't be reused after the first vsnprintf
     auto bytes = vsnprintf((char*)m_pBuffer->ptr + m_uFileOffset, bytesLeft, format, args);
-    if(bytes != bytesLeft) {
-        AllocateSpaceForWrite(bytes);
+    if((std::uint32_t)bytes >= bytesLeft) {
+        AllocateSpaceForWrite(bytes + 1); // vsnprintf needs room for the null terminator
         bytesLeft = m_pBuffer->size - m_uFileOffset;
         // Now we have enough space
-        bytes = vsnprintf((char*)m_pBuffer->ptr + m_uFileOffset, bytesLeft, format, args);
+        bytes = vsnprintf((char*)m_pBuffer->ptr + m_uFileOffset, bytesLeft, format, retry_args);
     }
 
+    va_end(retry_args);
     va_end(args);
 
     m_uFileOffset += bytes;
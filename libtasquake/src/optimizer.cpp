@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <functional>
 #include <limits>
@@ -13,6 +14,11 @@ void Optimizer::ResetIteration()
 	m_currentRun.ResetIteration();
 }
 
+void Optimizer::ResumeIteration(const OptimizerRunCheckpoint& checkpoint, const std::vector<FrameData>& vecData)
+{
+	m_currentRun.ResumeIteration(checkpoint, vecData);
+}
+
 const FrameBlock* Optimizer::GetCurrentFrameBlock() const
 {
 	auto block = m_currentRun.playbackInfo.Get_Current_Block();
@@ -391,6 +397,40 @@ void OptimizerRun::ResetIteration()
 	m_dEfficacy = std::numeric_limits<double>::lowest();
 }
 
+OptimizerRunCheckpoint OptimizerRun::GetCheckpoint() const
+{
+	OptimizerRunCheckpoint checkpoint;
+	checkpoint.m_uFrame = playbackInfo.current_frame;
+	checkpoint.m_bFinishedLevel = m_bFinishedLevel;
+	checkpoint.m_bDied = m_bDied;
+	checkpoint.m_dLevelTime = m_dLevelTime;
+	checkpoint.m_dTeleportTime = m_dTeleportTime;
+	checkpoint.m_uKills = m_uKills;
+	checkpoint.m_uSecrets = m_uSecrets;
+	checkpoint.m_uCenterPrints = m_uCenterPrints;
+	checkpoint.m_fHP = m_fHP;
+	checkpoint.m_fAP = m_fAP;
+
+	return checkpoint;
+}
+
+void OptimizerRun::ResumeIteration(const OptimizerRunCheckpoint& checkpoint, const std::vector<FrameData>& vecData)
+{
+	ResetIteration();
+	size_t frames = std::min<size_t>(checkpoint.m_uFrame, vecData.size());
+	playbackInfo.current_frame = frames;
+	m_vecData.assign(vecData.begin(), vecData.begin() + frames);
+	m_bFinishedLevel = checkpoint.m_bFinishedLevel;
+	m_bDied = checkpoint.m_bDied;
+	m_dLevelTime = checkpoint.m_dLevelTime;
+	m_dTeleportTime = checkpoint.m_dTeleportTime;
+	m_uKills = checkpoint.m_uKills;
+	m_uSecrets = checkpoint.m_uSecrets;
+	m_uCenterPrints = checkpoint.m_uCenterPrints;
+	m_fHP = checkpoint.m_fHP;
+	m_fAP = checkpoint.m_fAP;
+}
+
 void RunConditions::Init(const OptimizerRun* run, const OptimizerSettings* settings)
 {
 	if(settings->m_bUseNodes)
@@ -588,7 +628,7 @@ void OptimizerRun::StrafeBounds(size_t blockIndex, float& min, float& max) const
 	}
 }
 
-void OptimizerRun::WriteToBuffer(TASQuakeIO::BufferWriteInterface& writer) const
+void OptimizerRun::WriteToBuffer(TASQuakeIO::BufferWriteInterface& writer, TrajectoryEncoding encoding) const
 {
 	writer.WriteBytes(&m_dEfficacy, sizeof(m_dEfficacy));
 	writer.WriteBytes(&m_bFinishedLevel, sizeof(m_bFinishedLevel));
@@ -598,11 +638,11 @@ void OptimizerRun::WriteToBuffer(TASQuakeIO::BufferWriteInterface& writer) const
 	writer.WriteBytes(&m_uSecrets, sizeof(m_uSecrets));
 	writer.Write(&m_bDied);
 	writer.Write(&m_dTeleportTime);
-	writer.WritePODVec(m_vecData);
-	playbackInfo.current_script.Write_To_Memory(writer);
+	Write_Trajectory(writer, m_vecData, encoding);
+	playbackInfo.current_script.Write_To_Memory_Binary(writer);
 }
 
-void OptimizerRun::ReadFromBuffer(TASQuakeIO::BufferReadInterface& reader)
+bool OptimizerRun::ReadFromBuffer(TASQuakeIO::BufferReadInterface& reader)
 {
 	reader.Read(&m_dEfficacy, sizeof(m_dEfficacy));
 	reader.Read(&m_bFinishedLevel, sizeof(m_bFinishedLevel));
@@ -612,9 +652,10 @@ void OptimizerRun::ReadFromBuffer(TASQuakeIO::BufferReadInterface& reader)
 	reader.Read(&m_uSecrets, sizeof(m_uSecrets));
 	reader.Read(&m_bDied);
 	reader.Read(&m_dTeleportTime);
-	reader.ReadPODVec(m_vecData);
+	if (!Read_Trajectory(reader, m_vecData))
+		return false;
 	playbackInfo.current_script.blocks.clear();
-	playbackInfo.current_script.Load_From_Memory(reader);
+	return playbackInfo.current_script.Load_From_Memory(reader);
 }
 
 void BinSearcher::Init(double orig, double orig_efficacy, double max, double eps)
@@ -1407,3 +1448,160 @@ const char* TASQuake::OptimizerGoalStr(OptimizerGoal goal)
 		return "Undetermined";
 	}
 }
+
+void MultiGameCoordinator::Reset()
+{
+	next_id = 1;
+	in_flight.clear();
+	reassign.clear();
+	clients.clear();
+}
+
+void MultiGameCoordinator::Add_Client(size_t connection_id)
+{
+	clients[connection_id];
+}
+
+void MultiGameCoordinator::Remove_Client(size_t connection_id)
+{
+	clients.erase(connection_id);
+
+	for (auto& pair : in_flight)
+	{
+		auto& candidate = pair.second;
+		if (candidate.connection_id == connection_id && !candidate.reassigned)
+		{
+			candidate.reassigned = true;
+			reassign.push_back(pair.first);
+		}
+	}
+}
+
+MultiGameCoordinator::Batches MultiGameCoordinator::Deal(double now, size_t batch_size, size_t max_in_flight, const std::function<TASScript()>& next_candidate)
+{
+	Batches batches;
+	Reassign_Slow(now, max_in_flight);
+
+	// Reassigned candidates still count for the client that has them, it will get to them eventually
+	std::map<size_t, size_t> counts;
+	for (auto& pair : in_flight)
+		++counts[pair.second.connection_id];
+
+	for (auto& pair : clients)
+	{
+		if (pair.second.slow)
+			continue;
+
+		size_t& count = counts[pair.first];
+		while (count + batch_size <= max_in_flight)
+		{
+			batches.emplace_back(pair.first, Take_Batch(pair.first, batch_size, now, next_candidate));
+			count += batch_size;
+		}
+	}
+
+	return batches;
+}
+
+void MultiGameCoordinator::Reassign_Slow(double now, size_t max_in_flight)
+{
+	double total = 0;
+	size_t measured = 0;
+
+	for (auto& pair : clients)
+	{
+		if (pair.second.seconds_per_candidate > 0)
+		{
+			total += pair.second.seconds_per_candidate;
+			++measured;
+		}
+	}
+
+	if (measured == 0)
+		return;
+
+	double average = total / measured;
+
+	for (auto& pair : in_flight)
+	{
+		auto& candidate = pair.second;
+		auto client = clients.find(candidate.connection_id);
+		if (candidate.reassigned || client == clients.end())
+			continue;
+
+		double estimate = client->second.seconds_per_candidate;
+		if (estimate <= 0)
+			estimate = average; // Client hasn't answered anything yet
+
+		// Late if the client has had time to work through its whole queue three times over
+		if (now - candidate.sent_time > 3 * estimate * max_in_flight + 1)
+		{
+			candidate.reassigned = true;
+			client->second.slow = true;
+			reassign.push_back(pair.first);
+		}
+	}
+}
+
+std::vector<std::uint32_t> MultiGameCoordinator::Take_Batch(size_t connection_id, size_t count, double now, const std::function<TASScript()>& next_candidate)
+{
+	std::vector<std::uint32_t> ids;
+
+	// The client that was late with a candidate already has it, leave it for someone else
+	for (auto it = reassign.begin(); it != reassign.end() && ids.size() < count;)
+	{
+		auto candidate = in_flight.find(*it);
+		if (candidate == in_flight.end())
+		{
+			it = reassign.erase(it); // The slow client finished it after all
+		}
+		else if (candidate->second.connection_id == connection_id)
+		{
+			++it;
+		}
+		else
+		{
+			ids.push_back(*it);
+			it = reassign.erase(it);
+		}
+	}
+
+	while (ids.size() < count)
+	{
+		std::uint32_t id = next_id++;
+		in_flight[id].script = next_candidate();
+		ids.push_back(id);
+	}
+
+	for (auto id : ids)
+	{
+		auto& candidate = in_flight[id];
+		candidate.connection_id = connection_id;
+		candidate.sent_time = now;
+		candidate.reassigned = false;
+	}
+
+	return ids;
+}
+
+bool MultiGameCoordinator::Receive_Result(size_t connection_id, std::uint32_t id, double now)
+{
+	auto it = clients.find(connection_id);
+
+	if (it != clients.end())
+	{
+		auto& client = it->second;
+		if (client.last_result_time > 0)
+		{
+			double elapsed = now - client.last_result_time;
+			if (client.seconds_per_candidate > 0)
+				client.seconds_per_candidate = 0.8 * client.seconds_per_candidate + 0.2 * elapsed;
+			else
+				client.seconds_per_candidate = elapsed;
+		}
+		client.last_result_time = now;
+		client.slow = false;
+	}
+
+	return in_flight.erase(id) != 0;
+}
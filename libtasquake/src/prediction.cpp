@@ -3,20 +3,20 @@
 
 using namespace TASQuake;
 
-void PredictionData::Load_From_Memory(TASQuakeIO::BufferReadInterface& iface)
+bool PredictionData::Load_From_Memory(TASQuakeIO::BufferReadInterface& iface)
 {
     iface.Read(&m_iStartFrame);
     iface.Read(&m_iEndFrame);
     iface.ReadPODVec(m_vecFBdata);
-    iface.ReadPODVec(m_vecPoints);
+    return Read_Trajectory(iface, m_vecPoints);
 }
 
-void PredictionData::Write_To_Memory(TASQuakeIO::BufferWriteInterface& iface) const
+void PredictionData::Write_To_Memory(TASQuakeIO::BufferWriteInterface& iface, TrajectoryEncoding encoding) const
 {
     iface.Write(&m_iStartFrame);
     iface.Write(&m_iEndFrame);
     iface.WritePODVec(m_vecFBdata);
-    iface.WritePODVec(m_vecPoints);
+    Write_Trajectory(iface, m_vecPoints, encoding);
 }
 
 int PredictionData::FindFrameBlock(const Trace& trace)
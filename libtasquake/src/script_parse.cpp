@@ -1,24 +1,25 @@
 #include <algorithm>
+#include <charconv>
+#include <climits>
 #include <filesystem>
 #include <fstream>
 #include <map>
 #include <regex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <cstring>
+#include <unordered_map>
 #include <vector>
 #include "libtasquake/script_parse.hpp"
 #include "libtasquake/utils.hpp"
 
-std::regex FRAME_NO_REGEX(R"#((\+?)(\d+):)#");
-std::regex TOGGLE_REGEX(R"#(([\+\-])(\w+))#");
-std::regex CONVAR_REGEX(R"#((\w+) "?(-?\d+(\.\d+)?)"?)#");
-
 static TASScript script;
 
-static void Parse_Newline(TASQuakeIO::ReadInterface& is, std::string& str)
+
+static void Parse_Newline(std::istream& is, std::string& str)
 {
-	is.GetLine(str);
+	std::getline(is, str);
 	auto comment_pos = str.find("//");
 	if (comment_pos != std::string::npos)
 	{
@@ -27,54 +28,142 @@ static void Parse_Newline(TASQuakeIO::ReadInterface& is, std::string& str)
 	trim(str);
 }
 
+static bool Is_Space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
 
-static void Parse_Newline(std::istream& is, std::string& str)
+static bool Is_Digit(char c)
 {
-	std::getline(is, str);
-	auto comment_pos = str.find("//");
-	if (comment_pos != std::string::npos)
-	{
-		str = str.substr(0, comment_pos);
-	}
-	trim(str);
+	return c >= '0' && c <= '9';
+}
+
+static bool Is_Word_Char(char c)
+{
+	return Is_Digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static std::string_view Trim_View(std::string_view line)
+{
+	size_t start = 0;
+	size_t end = line.size();
+
+	while (start < end && Is_Space(line[start]))
+		++start;
+	while (end > start && Is_Space(line[end - 1]))
+		--end;
+
+	return line.substr(start, end - start);
 }
 
-static bool Is_Frame_Number(const std::string& line)
+std::string_view Strip_Script_Line(std::string_view line)
 {
-	return std::regex_match(line, FRAME_NO_REGEX);
+	auto comment_pos = line.find("//");
+	if (comment_pos != std::string_view::npos)
+		line = line.substr(0, comment_pos);
+
+	return Trim_View(line);
 }
 
-static bool Is_Convar(const std::string& line, size_t& spaceIndex, size_t& startIndex)
+// Matches +?\d+: exactly
+static bool Tokenize_Frame_Number(std::string_view line, ScriptLineToken& token)
 {
-	spaceIndex = 0;
+	size_t start = line.empty() || line[0] != '+' ? 0 : 1;
+	size_t end = line.size() - 1;
+
+	if (line.size() < start + 2 || line[end] != ':')
+		return false;
+
+	for (size_t i = start; i < end; ++i)
+	{
+		if (!Is_Digit(line[i]))
+			return false;
+	}
+
+	token.type = ScriptLineType::FrameNumber;
+	token.relative = start == 1;
+	auto result = std::from_chars(line.data() + start, line.data() + end, token.frame);
+	token.frame_valid = result.ec == std::errc();
+	return true;
+}
+
+// A name followed by whitespace and a number that is anywhere after the whitespace, the name has to be a cvar
+static bool Tokenize_Convar(std::string_view line, ScriptLineToken& token)
+{
+	size_t spaceIndex = 0;
+	size_t startIndex;
 	bool hasSpace = false;
 
-	for(startIndex=0; startIndex < line.size(); ++startIndex) {
-		int num = line[startIndex] - '0';
-		if(hasSpace && (num <= 9 && num >= 0)) {
-			break;
-		} else if(hasSpace && (line[startIndex] == '.' || line[startIndex] == '-')) {
+	for (startIndex = 0; startIndex < line.size(); ++startIndex)
+	{
+		char c = line[startIndex];
+		if (hasSpace && (Is_Digit(c) || c == '.' || c == '-'))
 			break;
-		} else if(!hasSpace && iswspace(line[startIndex])) {
+		else if (!hasSpace && Is_Space(c))
+		{
 			hasSpace = true;
 			spaceIndex = startIndex;
 		}
 	}
 
-	if(startIndex == line.size()) {
+	if (startIndex == line.size())
 		return false;
-	} else {
-		std::string name;
-		name.assign(line.c_str(), spaceIndex);
-		trim(name);
 
-		return TASQuake::IsConvar((char*)name.c_str());
+	std::string_view name = line.substr(0, spaceIndex);
+	char nameBuffer[256];
+
+	if (name.size() < sizeof(nameBuffer))
+	{
+		memcpy(nameBuffer, name.data(), name.size());
+		nameBuffer[name.size()] = '\0';
+		if (!TASQuake::IsConvar(nameBuffer))
+			return false;
+	}
+	else
+	{
+		std::string longName(name);
+		if (!TASQuake::IsConvar(&longName[0]))
+			return false;
 	}
+
+	token.type = ScriptLineType::Convar;
+	token.name = name;
+	token.value = 0;
+	std::from_chars(line.data() + startIndex, line.data() + line.size(), token.value);
+	return true;
+}
+
+// Matches [+-]\w+ exactly
+static bool Tokenize_Toggle(std::string_view line, ScriptLineToken& token)
+{
+	if (line.size() < 2 || (line[0] != '+' && line[0] != '-'))
+		return false;
+
+	for (size_t i = 1; i < line.size(); ++i)
+	{
+		if (!Is_Word_Char(line[i]))
+			return false;
+	}
+
+	token.type = ScriptLineType::Toggle;
+	token.state = line[0] == '+';
+	token.name = line.substr(1);
+	return true;
 }
 
-static bool Is_Toggle(const std::string& line)
+ScriptLineToken Tokenize_Script_Line(std::string_view line)
 {
-	return std::regex_match(line, TOGGLE_REGEX);
+	ScriptLineToken token;
+	line = Trim_View(line);
+
+	if (line.empty())
+		return token;
+	else if (Tokenize_Frame_Number(line, token) || Tokenize_Convar(line, token) || Tokenize_Toggle(line, token))
+		return token;
+
+	token.type = ScriptLineType::Command;
+	token.name = line;
+	return token;
 }
 
 static bool Is_Whitespace(const std::string& s)
@@ -130,62 +219,37 @@ void FrameBlock::Add_Command(const std::string& line)
 	commands.push_back(line);
 }
 
-void FrameBlock::Parse_Frame_No(const std::string& line, int& running_frame)
-{
-	std::smatch sm;
-	std::regex_match(line, sm, FRAME_NO_REGEX);
-
-	// No + in the frame number, take number as absolute
-	if (sm[1].str().empty())
-		running_frame = 0;
-	frame = std::stoi(sm[2].str()) + running_frame;
-	running_frame = frame;
-	parsed = true;
-}
-
-void FrameBlock::Parse_Convar(const std::string& line, size_t& spaceIndex, size_t& startIndex)
+void FrameBlock::Parse_Token(const ScriptLineToken& token, int& running_frame)
 {
-	std::string cmd = line.substr(0, spaceIndex);
-	std::string value_str = line.substr(startIndex);
-	float val = TASQuake::FloatFromString(value_str.c_str());
-
-	convars[cmd] = val;
-}
-
-void FrameBlock::Parse_Toggle(const std::string& line)
-{
-	std::smatch sm;
-	std::regex_match(line, sm, TOGGLE_REGEX);
-	std::string cmd = sm[2].str();
-
-	if (sm[1].str() == "+")
+	switch (token.type)
 	{
-		toggles[cmd] = true;
-	}
-	else
-	{
-		toggles[cmd] = false;
+	case ScriptLineType::FrameNumber:
+		if (!token.frame_valid)
+			throw std::out_of_range("frame number out of range");
+		// No + in the frame number, take number as absolute
+		if (!token.relative)
+			running_frame = 0;
+		frame = token.frame + running_frame;
+		running_frame = frame;
+		parsed = true;
+		break;
+	case ScriptLineType::Convar:
+		convars[std::string(token.name)] = token.value;
+		break;
+	case ScriptLineType::Toggle:
+		toggles[std::string(token.name)] = token.state;
+		break;
+	case ScriptLineType::Command:
+		Add_Command(std::string(token.name));
+		break;
+	default:
+		break;
 	}
 }
 
-void FrameBlock::Parse_Command(const std::string& line)
-{
-	Add_Command(line);
-}
-
-void FrameBlock::Parse_Line(const std::string& line, int& running_frame)
+void FrameBlock::Parse_Line(std::string_view line, int& running_frame)
 {
-	size_t startIndex, spaceIndex;
-	if (Is_Whitespace(line))
-		return;
-	else if (Is_Frame_Number(line))
-		Parse_Frame_No(line, running_frame);
-	else if (Is_Convar(line, spaceIndex, startIndex))
-		Parse_Convar(line, spaceIndex, startIndex);
-	else if (Is_Toggle(line))
-		Parse_Toggle(line);
-	else
-		Parse_Command(line);
+	Parse_Token(Tokenize_Script_Line(line), running_frame);
 }
 
 void FrameBlock::Reset()
@@ -222,6 +286,12 @@ bool FrameBlock::HasConvar(const std::string& cvar) const
 	return convars.find(cvar) != convars.end();
 }
 
+bool FrameBlock::operator==(const FrameBlock& other) const
+{
+	return frame == other.frame && convars.values == other.convars.values && toggles.values == other.toggles.values
+		&& commands == other.commands;
+}
+
 TASScript::TASScript() {}
 
 TASScript::TASScript(const char* file_name)
@@ -258,9 +328,282 @@ void TASScript::ApplyChanges(const TASScript* script, int& first_changed_frame)
 	}
 }
 
+int TASScript::FirstChangedFrame(const TASScript* script) const {
+	size_t commonBlocks = std::min(blocks.size(), script->blocks.size());
+
+	for(size_t i=0; i < commonBlocks; ++i) {
+		const FrameBlock* blockOrig = &blocks[i];
+		const FrameBlock* blockNew = &script->blocks[i];
+
+		if(blockOrig->frame != blockNew->frame || blockOrig->GetCommand() != blockNew->GetCommand()) {
+			return std::min(blockOrig->frame, blockNew->frame);
+		}
+	}
+
+	if(blocks.size() > commonBlocks) {
+		return blocks[commonBlocks].frame;
+	} else if(script->blocks.size() > commonBlocks) {
+		return script->blocks[commonBlocks].frame;
+	} else {
+		return INT_MAX;
+	}
+}
+
+namespace {
+	// Cvars carry over, toggles and commands only count on the frame they run. The game and the
+	// simulator release toggles on their own (tas_jump, lgagst), so repeating one is a change.
+	struct EffectiveState {
+		std::map<std::string, float> convars;
+		std::vector<std::pair<std::string, bool>> toggles;
+		std::vector<std::string> commands;
+
+		void Apply(const FrameBlock& block) {
+			for(auto& pair : block.convars)
+				convars[pair.first] = pair.second;
+			toggles.insert(toggles.end(), block.toggles.begin(), block.toggles.end());
+			commands.insert(commands.end(), block.commands.begin(), block.commands.end());
+		}
+
+		bool operator==(const EffectiveState& other) const {
+			return convars == other.convars && toggles == other.toggles && commands == other.commands;
+		}
+	};
+}
+
+int TASScript::FirstEffectiveChange(const TASScript* script) const {
+	EffectiveState stateOrig;
+	EffectiveState stateNew;
+	size_t i = 0;
+	size_t j = 0;
+
+	while(i < blocks.size() || j < script->blocks.size()) {
+		int frame = INT_MAX;
+		if(i < blocks.size())
+			frame = std::min(frame, blocks[i].frame);
+		if(j < script->blocks.size())
+			frame = std::min(frame, script->blocks[j].frame);
+
+		stateOrig.toggles.clear();
+		stateOrig.commands.clear();
+		stateNew.toggles.clear();
+		stateNew.commands.clear();
+
+		for(; i < blocks.size() && blocks[i].frame == frame; ++i)
+			stateOrig.Apply(blocks[i]);
+		for(; j < script->blocks.size() && script->blocks[j].frame == frame; ++j)
+			stateNew.Apply(script->blocks[j]);
+
+		if(!(stateOrig == stateNew)) {
+			return frame;
+		}
+	}
+
+	return INT_MAX;
+}
+
+/*
+Binary script layout, all values in native byte order:
+	char[4] magic "QTB1"
+	uint32 string count, then per string: uint32 length and the characters without a terminator
+	uint32 block count, then per block:
+		int32 frame, uint32 cvar count, uint32 toggle count, uint32 command count
+		per cvar: uint32 string index, float value
+		per toggle: uint32 string index, uint8 value
+		per command: uint32 string index
+Cvar names, toggle names and commands share the string table so each name is stored once.
+*/
+static const char BINARY_MAGIC[4] = {'Q', 'T', 'B', '1'};
+
+namespace {
+	struct BinaryReader {
+		const uint8_t* data;
+		uint32_t size;
+		uint32_t offset = 0;
+
+		template<typename T>
+		bool Read(T& out) {
+			if(size - offset < sizeof(T))
+				return false;
+			memcpy(&out, data + offset, sizeof(T));
+			offset += sizeof(T);
+			return true;
+		}
+	};
+
+	struct StringInterner {
+		std::unordered_map<std::string, uint32_t> ids;
+		std::vector<const std::string*> strings;
+
+		void Add(const std::string& str) {
+			auto result = ids.emplace(str, (uint32_t)strings.size());
+			if(result.second)
+				strings.push_back(&result.first->first);
+		}
+	};
+}
+
+static bool Is_Binary_Script(const void* data, uint32_t size) {
+	return size >= sizeof(BINARY_MAGIC) && memcmp(data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
+
+bool TASScript::Is_Binary_File_Name(const std::string& name) {
+	const char* ext = strrchr(name.c_str(), '.');
+	return ext && strcmp(ext, ".qtb") == 0;
+}
+
+bool TASScript::Load_From_Binary(const void* data, std::uint32_t size) {
+	if(!Is_Binary_Script(data, size)) {
+		TASQuake::Log("Not a binary script\n");
+		return false;
+	}
+
+	BinaryReader reader{(const uint8_t*)data, size, sizeof(BINARY_MAGIC)};
+	std::vector<std::string> strings;
+	uint32_t count;
+
+	// Every string has at least its length, every block its frame and counts
+	if(!reader.Read(count) || count > (size - reader.offset) / sizeof(uint32_t)) {
+		TASQuake::Log("Binary script is truncated\n");
+		return false;
+	}
+
+	strings.resize(count);
+	for(auto& str : strings) {
+		uint32_t length;
+		if(!reader.Read(length) || size - reader.offset < length) {
+			TASQuake::Log("Binary script is truncated\n");
+			return false;
+		}
+		str.assign((const char*)reader.data + reader.offset, length);
+		reader.offset += length;
+	}
+
+	if(!reader.Read(count) || count > (size - reader.offset) / (4 * sizeof(uint32_t))) {
+		TASQuake::Log("Binary script is truncated\n");
+		return false;
+	}
+
+	blocks.clear();
+	blocks.resize(count);
+
+	for(auto& block : blocks) {
+		uint32_t cvars, toggles, commands;
+		if(!reader.Read(block.frame) || !reader.Read(cvars) || !reader.Read(toggles) || !reader.Read(commands)) {
+			TASQuake::Log("Binary script is truncated\n");
+			blocks.clear();
+			return false;
+		}
+
+		block.parsed = true;
+		uint32_t id;
+		bool ok = true;
+
+		for(uint32_t i=0; i < cvars && ok; ++i) {
+			float value;
+			ok = reader.Read(id) && reader.Read(value) && id < strings.size();
+			if(ok)
+				block.convars.values.emplace_back(strings[id], value);
+		}
+
+		for(uint32_t i=0; i < toggles && ok; ++i) {
+			uint8_t value;
+			ok = reader.Read(id) && reader.Read(value) && id < strings.size();
+			if(ok)
+				block.toggles.values.emplace_back(strings[id], value != 0);
+		}
+
+		for(uint32_t i=0; i < commands && ok; ++i) {
+			ok = reader.Read(id) && id < strings.size();
+			if(ok)
+				block.commands.push_back(strings[id]);
+		}
+
+		if(!ok) {
+			TASQuake::Log("Binary script is corrupt\n");
+			blocks.clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void TASScript::Write_To_Binary(TASQuakeIO::BufferWriteInterface& iface) const {
+	StringInterner interner;
+
+	for(auto& block : blocks) {
+		for(auto& cvar : block.convars)
+			interner.Add(cvar.first);
+		for(auto& toggle : block.toggles)
+			interner.Add(toggle.first);
+		for(auto& cmd : block.commands)
+			interner.Add(cmd);
+	}
+
+	iface.WriteBytes(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+	uint32_t count = interner.strings.size();
+	iface.Write(&count);
+
+	for(auto str : interner.strings) {
+		uint32_t length = str->size();
+		iface.Write(&length);
+		iface.WriteBytes(str->data(), length);
+	}
+
+	count = blocks.size();
+	iface.Write(&count);
+
+	for(auto& block : blocks) {
+		uint32_t cvars = block.convars.size();
+		uint32_t toggles = block.toggles.size();
+		uint32_t commands = block.commands.size();
+		iface.Write(&block.frame);
+		iface.Write(&cvars);
+		iface.Write(&toggles);
+		iface.Write(&commands);
+
+		for(auto& cvar : block.convars) {
+			iface.Write(&interner.ids[cvar.first]);
+			iface.Write(&cvar.second);
+		}
+
+		for(auto& toggle : block.toggles) {
+			uint8_t value = toggle.second ? 1 : 0;
+			iface.Write(&interner.ids[toggle.first]);
+			iface.Write(&value);
+		}
+
+		for(auto& cmd : block.commands) {
+			iface.Write(&interner.ids[cmd]);
+		}
+	}
+}
+
+void TASScript::Write_To_Memory_Binary(TASQuakeIO::BufferWriteInterface& iface) const {
+	uint32_t offset = iface.m_uFileOffset;
+	uint32_t length = 0;
+	iface.Write(&length); // Filled in after the script is written
+
+	Write_To_Binary(iface);
+
+	length = iface.m_uFileOffset - offset - 4;
+	memcpy((uint8_t*)iface.m_pBuffer->ptr + offset, &length, 4);
+}
+
 bool TASScript::Load_From_Memory(TASQuakeIO::BufferReadInterface& iface) {
 	uint32_t bytes;
-	iface.Read(&bytes, 4);
+	if(iface.Read(&bytes, 4) != 4 || bytes > iface.m_uSize - iface.m_uFileOffset) {
+		TASQuake::Log("Script in message is truncated\n");
+		return false;
+	}
+
+	uint8_t* start = (uint8_t*)iface.m_pBuffer + iface.m_uFileOffset;
+	if(Is_Binary_Script(start, bytes)) {
+		bool rval = Load_From_Binary(start, bytes);
+		iface.m_uFileOffset += bytes;
+		return rval;
+	}
+
 	TASQuakeIO::BufferReadInterface temp;
 	temp.m_pBuffer = iface.m_pBuffer;
 	temp.m_uFileOffset = iface.m_uFileOffset;
@@ -286,6 +629,18 @@ void TASScript::Write_To_Memory(TASQuakeIO::BufferWriteInterface& iface) const {
 
 bool TASScript::Load_From_File()
 {
+	if (Is_Binary_File_Name(file_name))
+	{
+		auto mapped = TASQuakeIO::MappedFile::Open(file_name.c_str());
+		if (!mapped)
+		{
+			TASQuake::Log("Unable to open script %s\n", file_name.c_str());
+			return false;
+		}
+
+		return Load_From_Binary(mapped->ptr, mapped->size);
+	}
+
 	TASQuakeIO::FileReadInterface iface = TASQuakeIO::FileReadInterface::Init(file_name.c_str());
 
 	if (!iface.CanRead())
@@ -315,14 +670,15 @@ bool TASScript::_Load_From_File(TASQuakeIO::ReadInterface& readInterface) {
 	{
 		while (readInterface.CanRead())
 		{
-			Parse_Newline(readInterface, current_line);
+			readInterface.GetLine(current_line);
 			++line_number;
-			if (Is_Frame_Number(current_line) && fb.parsed)
+			auto token = Tokenize_Script_Line(Strip_Script_Line(current_line));
+			if (token.type == ScriptLineType::FrameNumber && fb.parsed)
 			{
 				blocks.push_back(fb);
 				fb.Reset();
 			}
-			fb.Parse_Line(current_line, running_frame);
+			fb.Parse_Token(token, running_frame);
 		}
 		if (fb.parsed)
 			blocks.push_back(fb);
@@ -392,7 +748,7 @@ static bool Get_Backup_Save(char* buffer, const char* file_name, int backup)
 	}
 
 	without_ext[i] = '\0';
-	sprintf(buffer, "%s-%d.qtas", without_ext, backup);
+	sprintf(buffer, "%s-%d%s", without_ext, backup, ext);
 	return true;
 }
 
@@ -446,6 +802,23 @@ void TASScript::Write_To_File() const
 		return;
 	}
 
+	if (Is_Binary_File_Name(file_name))
+	{
+		auto writer = TASQuakeIO::BufferWriteInterface::Init();
+		Write_To_Binary(writer);
+
+		std::ofstream out(file_name, std::ios::binary);
+		if (!out.good())
+		{
+			TASQuake::Log("Cannot open file %s\n", file_name.c_str());
+			return;
+		}
+
+		out.write((const char*)writer.m_pBuffer->ptr, writer.m_uFileOffset);
+		TASQuake::Log("Wrote script to file %s\n", file_name.c_str());
+		return;
+	}
+
 	TASQuakeIO::FileWriteInterface iface = TASQuakeIO::FileWriteInterface::Init(file_name.c_str());
 	if(!iface.CanWrite()) {
 		TASQuake::Log("Cannot open file %s\n", file_name.c_str());
@@ -554,70 +927,31 @@ void TASScript::AddScript(const TASScript* script, int frame) {
 	}
 }
 
-int TASScript::GetBlockIndex(int frame) const {
-	const size_t MAX_LINEAR_SEARCH_SIZE = UINT32_MAX;
-	size_t blockCount = blocks.size();
-
-	if(blockCount == 0) {
-		return blockCount;
-	}
-#if 1
-	// There's still some bugs with the fast implementation
-	for (int i = 0; i < blockCount; ++i)
-	{
-		if (blocks[i].frame >= frame)
-		{
-			return i;
-		}
-	}
+// Blocks are kept sorted by frame, so i is the answer for frame when it is the first block at or after the frame
+static bool Is_Block_Index(const std::vector<FrameBlock>& blocks, int i, int frame) {
+	return (i == (int)blocks.size() || blocks[i].frame >= frame) && (i == 0 || blocks[i - 1].frame < frame);
+}
 
-	return blocks.size();
-#else
-	if(blockCount < MAX_LINEAR_SEARCH_SIZE) {
-		for (int i = 0; i < blockCount; ++i)
-		{
-			if (blocks[i].frame >= frame)
-			{
+int TASScript::GetBlockIndex(int frame) const {
+	int blockCount = blocks.size();
+
+	// Playback and simulation walk the script one frame at a time, so the answer is usually the
+	// previous one or the block after it. The cursor is validated before use, edits can't make it stale.
+	if(prev_block_number >= 0 && prev_block_number <= blockCount) {
+		int last = std::min(prev_block_number + 1, blockCount);
+		for(int i = prev_block_number; i <= last; ++i) {
+			if(Is_Block_Index(blocks, i, frame)) {
+				prev_block_number = i;
 				return i;
 			}
 		}
-	} else {
-		size_t low = 0;
-		size_t high = blockCount;
-
-		if(prev_block_number < blocks.size() && blocks[prev_block_number].frame >= frame) {
-			if(prev_block_number == 0) {
-				return prev_block_number;
-			} else if(blocks[prev_block_number-1].frame < frame) {
-				return prev_block_number;
-			}
-		}
-
-		// Binary search for higher block counts
-		while(low < high - 1) {
-			size_t mid = (low + high) / 2;
-			if (blocks[mid].frame == frame) {
-				low = mid;
-				break;
-			} else if (blocks[mid].frame > frame) {
-				high = mid;
-			} else {
-				low = mid;
-			}
-		}
-
-		// Fix up the index
-		if(blocks[low].frame < frame) {
-			prev_block_number = low + 1;
-		} else {
-			prev_block_number = low;
-		}
-
-		return prev_block_number;
 	}
 
-	return blocks.size();
-#endif
+	auto it = std::lower_bound(blocks.begin(), blocks.end(), frame,
+		[](const FrameBlock& block, int value) { return block.frame < value; });
+	prev_block_number = it - blocks.begin();
+
+	return prev_block_number;
 }
 
 static int GetBlockForInsertion(TASScript* script, int frame)
@@ -731,6 +1065,252 @@ const FrameBlock* TASScript::Get_Frameblock(int frame) const
 	}
 }
 
+namespace {
+	// FNV-1a
+	struct Hasher {
+		uint64_t hash = 14695981039346656037ULL;
+
+		void Add(const void* data, size_t size) {
+			const uint8_t* bytes = (const uint8_t*)data;
+			for(size_t i=0; i < size; ++i) {
+				hash ^= bytes[i];
+				hash *= 1099511628211ULL;
+			}
+		}
+
+		void Add(const std::string& str) {
+			uint32_t length = str.size();
+			Add(&length, sizeof(length));
+			Add(str.data(), str.size());
+		}
+	};
+}
+
+std::uint64_t TASScript::Checksum() const
+{
+	Hasher hasher;
+	uint32_t count = blocks.size();
+	hasher.Add(&count, sizeof(count));
+
+	for(auto& block : blocks) {
+		uint32_t counts[3] = {(uint32_t)block.convars.size(), (uint32_t)block.toggles.size(), (uint32_t)block.commands.size()};
+		hasher.Add(&block.frame, sizeof(block.frame));
+		hasher.Add(counts, sizeof(counts));
+
+		for(auto& cvar : block.convars) {
+			hasher.Add(cvar.first);
+			hasher.Add(&cvar.second, sizeof(cvar.second));
+		}
+
+		for(auto& toggle : block.toggles) {
+			uint8_t value = toggle.second ? 1 : 0;
+			hasher.Add(toggle.first);
+			hasher.Add(&value, sizeof(value));
+		}
+
+		for(auto& cmd : block.commands)
+			hasher.Add(cmd);
+	}
+
+	return hasher.hash;
+}
+
+/*
+Script patch layout inside the size prefix, all values in native byte order:
+	char[4] magic "QTP1"
+	uint64 base checksum, uint64 result checksum
+	uint32 op count, then per op: uint8 type, uint32 block index
+	binary script holding the blocks of the insert and modify ops
+*/
+static const char PATCH_MAGIC[4] = {'Q', 'T', 'P', '1'};
+
+ScriptPatch ScriptPatch::Diff(const TASScript& from, const TASScript& to)
+{
+	ScriptPatch patch;
+	patch.base_checksum = from.Checksum();
+	patch.result_checksum = to.Checksum();
+
+	// Edits touch a contiguous range of blocks, everything before and after it is shared
+	size_t prefix = 0;
+	size_t commonBlocks = std::min(from.blocks.size(), to.blocks.size());
+	while(prefix < commonBlocks && from.blocks[prefix] == to.blocks[prefix])
+		++prefix;
+
+	size_t suffix = 0;
+	while(suffix < commonBlocks - prefix
+		  && from.blocks[from.blocks.size() - 1 - suffix] == to.blocks[to.blocks.size() - 1 - suffix])
+		++suffix;
+
+	size_t oldCount = from.blocks.size() - prefix - suffix;
+	size_t newCount = to.blocks.size() - prefix - suffix;
+	size_t modified = std::min(oldCount, newCount);
+
+	for(size_t i=0; i < modified; ++i) {
+		patch.ops.push_back({OpType::Modify, (uint32_t)(prefix + i)});
+		patch.blocks.push_back(to.blocks[prefix + i]);
+	}
+
+	for(size_t i=modified; i < oldCount; ++i)
+		patch.ops.push_back({OpType::Delete, (uint32_t)(prefix + modified)});
+
+	for(size_t i=modified; i < newCount; ++i) {
+		patch.ops.push_back({OpType::Insert, (uint32_t)(prefix + i)});
+		patch.blocks.push_back(to.blocks[prefix + i]);
+	}
+
+	return patch;
+}
+
+bool ScriptPatch::Apply(TASScript& script, int& first_changed_frame) const
+{
+	first_changed_frame = INT_MAX;
+
+	if(script.Checksum() != base_checksum) {
+		TASQuake::Log("Script patch does not match the script\n");
+		return false;
+	}
+
+	size_t blockIndex = 0;
+	for(auto& op : ops) {
+		if(op.type == OpType::Delete) {
+			if(op.index >= script.blocks.size())
+				return false;
+			first_changed_frame = std::min(first_changed_frame, script.blocks[op.index].frame);
+			script.blocks.erase(script.blocks.begin() + op.index);
+			continue;
+		}
+
+		if(blockIndex >= blocks.size())
+			return false;
+		const FrameBlock& block = blocks[blockIndex++];
+		first_changed_frame = std::min(first_changed_frame, block.frame);
+
+		if(op.type == OpType::Insert) {
+			if(op.index > script.blocks.size())
+				return false;
+			script.blocks.insert(script.blocks.begin() + op.index, block);
+		} else {
+			if(op.index >= script.blocks.size())
+				return false;
+			first_changed_frame = std::min(first_changed_frame, script.blocks[op.index].frame);
+			script.blocks[op.index] = block;
+		}
+	}
+
+	if(script.Checksum() != result_checksum) {
+		TASQuake::Log("Script patch produced the wrong script\n");
+		return false;
+	}
+
+	return true;
+}
+
+void ScriptPatch::Write_To_Memory(TASQuakeIO::BufferWriteInterface& iface) const
+{
+	uint32_t offset = iface.m_uFileOffset;
+	uint32_t length = 0;
+	iface.Write(&length); // Filled in after the patch is written
+
+	iface.WriteBytes(PATCH_MAGIC, sizeof(PATCH_MAGIC));
+	iface.Write(&base_checksum);
+	iface.Write(&result_checksum);
+	uint32_t count = ops.size();
+	iface.Write(&count);
+
+	for(auto& op : ops) {
+		uint8_t type = (uint8_t)op.type;
+		iface.Write(&type);
+		iface.Write(&op.index);
+	}
+
+	TASScript script;
+	script.blocks = blocks;
+	script.Write_To_Binary(iface);
+
+	length = iface.m_uFileOffset - offset - 4;
+	memcpy((uint8_t*)iface.m_pBuffer->ptr + offset, &length, 4);
+}
+
+bool ScriptPatch::Load_From_Memory(TASQuakeIO::BufferReadInterface& iface)
+{
+	uint32_t bytes;
+	if(iface.Read(&bytes) != sizeof(bytes) || iface.m_uSize - iface.m_uFileOffset < bytes) {
+		TASQuake::Log("Script patch is truncated\n");
+		return false;
+	}
+
+	BinaryReader reader{(const uint8_t*)iface.m_pBuffer + iface.m_uFileOffset, bytes};
+	iface.m_uFileOffset += bytes;
+
+	char magic[4];
+	uint32_t count;
+	if(!reader.Read(magic) || memcmp(magic, PATCH_MAGIC, sizeof(PATCH_MAGIC)) != 0) {
+		TASQuake::Log("Not a script patch\n");
+		return false;
+	}
+
+	if(!reader.Read(base_checksum) || !reader.Read(result_checksum) || !reader.Read(count) || count > bytes) {
+		TASQuake::Log("Script patch is truncated\n");
+		return false;
+	}
+
+	ops.resize(count);
+	for(auto& op : ops) {
+		uint8_t type;
+		if(!reader.Read(type) || !reader.Read(op.index) || type > (uint8_t)OpType::Modify) {
+			TASQuake::Log("Script patch is corrupt\n");
+			return false;
+		}
+		op.type = (OpType)type;
+	}
+
+	TASScript script;
+	if(!script.Load_From_Binary(reader.data + reader.offset, reader.size - reader.offset))
+		return false;
+	blocks = std::move(script.blocks);
+
+	return true;
+}
+
+void ScriptPatch::Write_Update(const TASScript* baseline, const TASScript& script, TASQuakeIO::BufferWriteInterface& iface)
+{
+	if(baseline) {
+		ScriptPatch patch = Diff(*baseline, script);
+		if(patch.ops.size() * 2 <= script.blocks.size()) {
+			patch.Write_To_Memory(iface);
+			return;
+		}
+	}
+
+	script.Write_To_Memory_Binary(iface);
+}
+
+bool ScriptPatch::Apply_Update(TASScript& script, TASQuakeIO::BufferReadInterface& iface, int& first_changed_frame)
+{
+	uint32_t bytes = 0;
+	const uint8_t* start = (const uint8_t*)iface.m_pBuffer + iface.m_uFileOffset;
+	uint32_t available = iface.m_uSize - iface.m_uFileOffset;
+	if(available >= 4)
+		memcpy(&bytes, start, 4);
+
+	if(available >= 4 + sizeof(PATCH_MAGIC) && bytes >= sizeof(PATCH_MAGIC)
+	   && memcmp(start + 4, PATCH_MAGIC, sizeof(PATCH_MAGIC)) == 0) {
+		ScriptPatch patch;
+		return patch.Load_From_Memory(iface) && patch.Apply(script, first_changed_frame);
+	}
+
+	TASScript full;
+	if(!full.Load_From_Memory(iface)) {
+		first_changed_frame = INT_MAX;
+		return false;
+	}
+
+	int applied_frame;
+	first_changed_frame = script.FirstChangedFrame(&full);
+	script.ApplyChanges(&full, applied_frame);
+	return true;
+}
+
 
 bool TASScript::ShiftSingleBlock(size_t blockIndex, int delta) {
 	int current_frame = blocks[blockIndex].frame;
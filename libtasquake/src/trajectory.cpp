@@ -0,0 +1,195 @@
+#include "libtasquake/trajectory.hpp"
+#include "libtasquake/optimizer.hpp"
+#include "libtasquake/utils.hpp"
+#include <cmath>
+
+using namespace TASQuake;
+
+/*
+Compact layout:
+    uint32 frame count
+    uint32 byte count, then a stream of LEB128 varints
+    per frame: zigzag delta of the quantized x, y and z from the previous frame,
+    followed by the zigzag delta of the quantized velocity angle for frame data
+Deltas are taken between quantized values so the error doesn't accumulate along the trajectory.
+*/
+
+namespace {
+    const double MAX_QUANTIZED = 1 << 30;
+
+    struct VarintWriter {
+        std::vector<std::uint8_t> bytes;
+
+        void Write(std::int64_t value) {
+            std::uint64_t zigzag = ((std::uint64_t)value << 1) ^ (std::uint64_t)(value >> 63);
+            while(zigzag >= 0x80) {
+                bytes.push_back((std::uint8_t)(zigzag | 0x80));
+                zigzag >>= 7;
+            }
+            bytes.push_back((std::uint8_t)zigzag);
+        }
+    };
+
+    struct VarintReader {
+        const std::vector<std::uint8_t>& bytes;
+        size_t offset = 0;
+
+        bool Read(std::int64_t& value) {
+            std::uint64_t zigzag = 0;
+            for(int shift = 0; shift < 64; shift += 7) {
+                if(offset >= bytes.size())
+                    return false;
+                std::uint8_t byte = bytes[offset++];
+                zigzag |= (std::uint64_t)(byte & 0x7f) << shift;
+                if((byte & 0x80) == 0) {
+                    value = (std::int64_t)(zigzag >> 1) ^ -(std::int64_t)(zigzag & 1);
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    bool Quantize(double value, double step, std::int64_t& out) {
+        double scaled = value / step;
+        if(!std::isfinite(scaled) || std::abs(scaled) > MAX_QUANTIZED)
+            return false;
+        out = std::llround(scaled);
+        return true;
+    }
+
+    bool Quantize_Point(const Vector& point, std::int64_t out[3]) {
+        for(int i=0; i < 3; ++i) {
+            if(!Quantize(point[i], TRAJECTORY_POSITION_STEP, out[i]))
+                return false;
+        }
+        return true;
+    }
+
+    // NaN and 999 both mean the velocity angle wasn't available
+    double Vel_Theta(const FrameData& frame) {
+        return std::isnan(frame.m_dVelTheta) ? 999.0 : frame.m_dVelTheta;
+    }
+
+    bool Encode(const std::vector<Vector>& points, const std::vector<FrameData>* frames, VarintWriter& out) {
+        std::int64_t prev[4] = {};
+        std::int64_t current[4];
+        size_t count = frames ? frames->size() : points.size();
+
+        for(size_t i=0; i < count; ++i) {
+            const Vector& point = frames ? (*frames)[i].pos : points[i];
+            if(!Quantize_Point(point, current))
+                return false;
+            if(frames && !Quantize(Vel_Theta((*frames)[i]), TRAJECTORY_ANGLE_STEP, current[3]))
+                return false;
+
+            int values = frames ? 4 : 3;
+            for(int j=0; j < values; ++j) {
+                out.Write(current[j] - prev[j]);
+                prev[j] = current[j];
+            }
+        }
+
+        return true;
+    }
+
+    bool Read_Compact(TASQuakeIO::BufferReadInterface& reader, std::vector<Vector>& points, std::vector<FrameData>* frames) {
+        std::uint32_t count;
+        std::vector<std::uint8_t> bytes;
+        if(reader.Read(&count) != sizeof(count)) {
+            TASQuake::Log("Trajectory is truncated\n");
+            return false;
+        }
+        reader.ReadPODVec(bytes);
+
+        // Every value takes at least a byte
+        int values = frames ? 4 : 3;
+        if(count > bytes.size() / values) {
+            TASQuake::Log("Trajectory is truncated\n");
+            return false;
+        }
+
+        VarintReader varints{bytes};
+        std::int64_t current[4] = {};
+        if(frames)
+            frames->resize(count);
+        else
+            points.resize(count);
+
+        for(std::uint32_t i=0; i < count; ++i) {
+            for(int j=0; j < values; ++j) {
+                std::int64_t delta;
+                if(!varints.Read(delta)) {
+                    TASQuake::Log("Trajectory is corrupt\n");
+                    return false;
+                }
+                current[j] += delta;
+            }
+
+            Vector point(current[0] * TRAJECTORY_POSITION_STEP, current[1] * TRAJECTORY_POSITION_STEP, current[2] * TRAJECTORY_POSITION_STEP);
+            if(frames) {
+                (*frames)[i].pos = point;
+                (*frames)[i].m_dVelTheta = current[3] * TRAJECTORY_ANGLE_STEP;
+            } else {
+                points[i] = point;
+            }
+        }
+
+        return true;
+    }
+
+    template<typename T>
+    void Write_Impl(TASQuakeIO::BufferWriteInterface& writer, const std::vector<T>& raw, const std::vector<Vector>& points,
+                    const std::vector<FrameData>* frames, TrajectoryEncoding encoding) {
+        VarintWriter varints;
+        if(encoding == TrajectoryEncoding::Compact && Encode(points, frames, varints)) {
+            std::uint8_t tag = (std::uint8_t)TrajectoryEncoding::Compact;
+            std::uint32_t count = raw.size();
+            writer.Write(&tag);
+            writer.Write(&count);
+            writer.WritePODVec(varints.bytes);
+        } else {
+            std::uint8_t tag = (std::uint8_t)TrajectoryEncoding::Raw;
+            writer.Write(&tag);
+            writer.WritePODVec(raw);
+        }
+    }
+
+    template<typename T>
+    bool Read_Impl(TASQuakeIO::BufferReadInterface& reader, std::vector<T>& raw, std::vector<Vector>& points, std::vector<FrameData>* frames) {
+        std::uint8_t tag;
+        if(reader.Read(&tag) != sizeof(tag)) {
+            TASQuake::Log("Trajectory is truncated\n");
+            return false;
+        }
+
+        switch((TrajectoryEncoding)tag) {
+            case TrajectoryEncoding::Raw:
+                reader.ReadPODVec(raw);
+                return true;
+            case TrajectoryEncoding::Compact:
+                return Read_Compact(reader, points, frames);
+            default:
+                TASQuake::Log("Unknown trajectory encoding %d\n", (int)tag);
+                return false;
+        }
+    }
+}
+
+void TASQuake::Write_Trajectory(TASQuakeIO::BufferWriteInterface& writer, const std::vector<Vector>& points, TrajectoryEncoding encoding) {
+    Write_Impl(writer, points, points, nullptr, encoding);
+}
+
+bool TASQuake::Read_Trajectory(TASQuakeIO::BufferReadInterface& reader, std::vector<Vector>& points) {
+    return Read_Impl(reader, points, points, nullptr);
+}
+
+void TASQuake::Write_Trajectory(TASQuakeIO::BufferWriteInterface& writer, const std::vector<FrameData>& frames, TrajectoryEncoding encoding) {
+    std::vector<Vector> unused;
+    Write_Impl(writer, frames, unused, &frames, encoding);
+}
+
+bool TASQuake::Read_Trajectory(TASQuakeIO::BufferReadInterface& reader, std::vector<FrameData>& frames) {
+    std::vector<Vector> unused;
+    return Read_Impl(reader, frames, unused, &frames);
+}
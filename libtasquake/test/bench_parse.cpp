@@ -0,0 +1,152 @@
+#include "catch_amalgamated.hpp"
+#include "libtasquake/script_parse.hpp"
+#include "libtasquake/utils.hpp"
+#include <regex>
+#include <sstream>
+
+// The regex based line parser the tokenizer replaced, kept as a reference
+namespace RegexParser {
+    std::regex FRAME_NO_REGEX(R"#((\+?)(\d+):)#");
+    std::regex TOGGLE_REGEX(R"#(([\+\-])(\w+))#");
+
+    static bool Is_Convar(const std::string& line, size_t& spaceIndex, size_t& startIndex) {
+        spaceIndex = 0;
+        bool hasSpace = false;
+
+        for(startIndex=0; startIndex < line.size(); ++startIndex) {
+            int num = line[startIndex] - '0';
+            if(hasSpace && (num <= 9 && num >= 0)) {
+                break;
+            } else if(hasSpace && (line[startIndex] == '.' || line[startIndex] == '-')) {
+                break;
+            } else if(!hasSpace && iswspace(line[startIndex])) {
+                hasSpace = true;
+                spaceIndex = startIndex;
+            }
+        }
+
+        if(startIndex == line.size()) {
+            return false;
+        } else {
+            std::string name;
+            name.assign(line.c_str(), spaceIndex);
+            trim(name);
+            return TASQuake::IsConvar((char*)name.c_str());
+        }
+    }
+
+    static std::string Strip(std::string line) {
+        auto comment_pos = line.find("//");
+        if (comment_pos != std::string::npos)
+            line = line.substr(0, comment_pos);
+        trim(line);
+        return line;
+    }
+
+    static void Parse_Line(FrameBlock& block, const std::string& line, int& running_frame) {
+        size_t startIndex, spaceIndex;
+        std::smatch sm;
+        if(std::all_of(line.begin(), line.end(), isspace)) {
+            return;
+        } else if(std::regex_match(line, sm, FRAME_NO_REGEX)) {
+            if (sm[1].str().empty())
+                running_frame = 0;
+            block.frame = std::stoi(sm[2].str()) + running_frame;
+            running_frame = block.frame;
+            block.parsed = true;
+        } else if(Is_Convar(line, spaceIndex, startIndex)) {
+            block.convars[line.substr(0, spaceIndex)] = TASQuake::FloatFromString(line.substr(startIndex).c_str());
+        } else if(std::regex_match(line, sm, TOGGLE_REGEX)) {
+            block.toggles[sm[2].str()] = sm[1].str() == "+";
+        } else {
+            block.Add_Command(line);
+        }
+    }
+}
+
+static const char* LINES[] = {
+    "+1:",
+    "42:",
+    "  +7:  ",
+    "\ttas_strafe 1",
+    "\ttas_strafe_yaw -12.5",
+    "tas_view_pitch \"90\"",
+    "tas_strafe_type .5",
+    "\t+jump",
+    "\t-attack // comment",
+    "+jump2",
+    "+jump-",
+    "-",
+    "echo test",
+    "record demo e1m1",
+    "impulse 7",
+    "skill 3",
+    "   ",
+    "// only a comment",
+    "+:",
+    "+12a:",
+    "tas_strafe",
+};
+
+TEST_CASE("Tokenizer matches regex parser") {
+    for(auto line : LINES) {
+        FrameBlock expected;
+        FrameBlock actual;
+        int expectedFrame = 5;
+        int actualFrame = 5;
+
+        RegexParser::Parse_Line(expected, RegexParser::Strip(line), expectedFrame);
+        actual.Parse_Token(Tokenize_Script_Line(Strip_Script_Line(line)), actualFrame);
+
+        INFO(line);
+        REQUIRE(actualFrame == expectedFrame);
+        REQUIRE(actual.frame == expected.frame);
+        REQUIRE(actual.parsed == expected.parsed);
+        REQUIRE(actual.GetCommand() == expected.GetCommand());
+    }
+}
+
+static std::string GenerateScript(size_t blocks) {
+    std::ostringstream oss;
+
+    for(size_t i=0; i < blocks; ++i) {
+        oss << "+" << (i % 13 + 1) << ":\n";
+        oss << "\ttas_strafe_yaw " << (i * 0.5f) << "\n";
+        oss << "\t" << (i % 2 == 0 ? "+" : "-") << "jump\n";
+        if(i % 5 == 0)
+            oss << "\techo block " << i << " // comment\n";
+    }
+
+    return oss.str();
+}
+
+TEST_CASE("Script parse bench") {
+    std::string text = GenerateScript(10000);
+
+    BENCHMARK("Regex parser 10000 blocks") {
+        std::istringstream iss(text);
+        std::string line;
+        std::vector<FrameBlock> blocks;
+        FrameBlock block;
+        int running_frame = 0;
+
+        while(std::getline(iss, line)) {
+            line = RegexParser::Strip(line);
+            if(std::regex_match(line, RegexParser::FRAME_NO_REGEX) && block.parsed) {
+                blocks.push_back(block);
+                block.Reset();
+            }
+            RegexParser::Parse_Line(block, line, running_frame);
+        }
+        if(block.parsed)
+            blocks.push_back(block);
+
+        return blocks.size();
+    };
+
+    BENCHMARK("Tokenizer 10000 blocks") {
+        TASScript script;
+        script.Load_From_String(text.c_str());
+        return script.blocks.size();
+    };
+}
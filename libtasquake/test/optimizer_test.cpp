@@ -46,7 +46,7 @@ TEST_CASE("OptimizerRun serialization") {
 
     auto reader = TASQuakeIO::BufferReadInterface::Init(writer.m_pBuffer->ptr, writer.m_uFileOffset);
     TASQuake::OptimizerRun loaded;
-    loaded.ReadFromBuffer(reader);
+    REQUIRE(loaded.ReadFromBuffer(reader) == true);
     REQUIRE(run.m_bFinishedLevel == loaded.m_bFinishedLevel);
     REQUIRE(run.m_dEfficacy == loaded.m_dEfficacy);
     REQUIRE(run.m_dLevelTime == loaded.m_dLevelTime);
@@ -303,3 +303,83 @@ TEST_CASE("AutoGoal", "Works")
     run.m_vecData[1].pos.y = -1.0f;
     REQUIRE(TASQuake::AutoGoal(run) == TASQuake::OptimizerGoal::NegY);
 }
+
+TEST_CASE("OptimizerRun resume from checkpoint")
+{
+    TASQuake::OptimizerRun run;
+    std::vector<TASQuake::FrameData> vecData(10);
+    for(size_t i=0; i < vecData.size(); ++i)
+        vecData[i].pos.x = i;
+
+    run.playbackInfo.current_frame = 4;
+    run.m_uKills = 2;
+    run.m_fHP = 50;
+    run.m_bFinishedLevel = true;
+    auto checkpoint = run.GetCheckpoint();
+
+    TASQuake::OptimizerRun resumed;
+    resumed.m_bDied = true;
+    resumed.ResumeIteration(checkpoint, vecData);
+    REQUIRE(resumed.playbackInfo.current_frame == 4);
+    REQUIRE(resumed.m_vecData.size() == 4);
+    REQUIRE(resumed.m_vecData[3].pos.x == 3);
+    REQUIRE(resumed.m_uKills == 2);
+    REQUIRE(resumed.m_fHP == 50);
+    REQUIRE(resumed.m_bFinishedLevel == true);
+    REQUIRE(resumed.m_bDied == false);
+}
+
+TEST_CASE("MultiGameCoordinator reassigns late candidates")
+{
+    TASQuake::MultiGameCoordinator coordinator;
+    auto next_candidate = []() { return TASScript(); };
+    coordinator.Add_Client(1);
+    coordinator.Add_Client(2);
+
+    auto batches = coordinator.Deal(0, 2, 4, next_candidate);
+    REQUIRE(batches.size() == 4);
+    REQUIRE(coordinator.in_flight.size() == 8);
+
+    // Client 2 works through its candidates at one per second, client 1 never answers
+    double now = 0;
+    for(std::uint32_t id=5; id <= 8; ++id)
+        REQUIRE(coordinator.Receive_Result(2, id, ++now));
+    coordinator.Deal(now, 2, 4, next_candidate);
+    for(std::uint32_t id=9; id <= 12; ++id)
+        REQUIRE(coordinator.Receive_Result(2, id, ++now));
+    REQUIRE(!coordinator.Receive_Result(2, 12, now));
+
+    now = 20;
+    batches = coordinator.Deal(now, 2, 4, next_candidate);
+    REQUIRE(coordinator.clients[1].slow);
+    REQUIRE(batches.size() == 2);
+
+    // The late candidates go to client 2 and the slow client gets nothing
+    for(auto& batch : batches) {
+        REQUIRE(batch.first == 2);
+        for(auto id : batch.second)
+            REQUIRE(id <= 4);
+    }
+    for(std::uint32_t id=1; id <= 4; ++id)
+        REQUIRE(coordinator.in_flight[id].connection_id == 2);
+
+    // A client never gets back the candidates it was late with
+    coordinator.in_flight[1].reassigned = true;
+    coordinator.reassign.push_back(1);
+    auto ids = coordinator.Take_Batch(2, 1, now, next_candidate);
+    REQUIRE(ids.size() == 1);
+    REQUIRE(ids[0] != 1);
+    REQUIRE(coordinator.reassign.size() == 1);
+
+    // Candidates of a disconnected client go to the others
+    coordinator.Remove_Client(2);
+    REQUIRE(coordinator.clients.count(2) == 0);
+    REQUIRE(coordinator.Receive_Result(1, ids[0], now));
+    REQUIRE(!coordinator.clients[1].slow);
+    batches = coordinator.Deal(now, 2, 4, next_candidate);
+    REQUIRE(!batches.empty());
+    for(auto& batch : batches)
+        REQUIRE(batch.first == 1);
+    REQUIRE(coordinator.in_flight[1].connection_id == 1);
+    REQUIRE(coordinator.in_flight[4].connection_id == 1);
+}
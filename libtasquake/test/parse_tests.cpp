@@ -88,7 +88,7 @@ TEST_CASE("Parsing id1_er") {
     }
 
     TASScript script;
-    auto readInterface = TASQuakeIO::BufferReadInterface::Init(ptr->ptr, size);
+    auto readInterface = TASQuakeIO::BufferReadInterface::Init(ptr->ptr, size + 4);
     bool result = script.Load_From_Memory(readInterface);
     REQUIRE(result == true);
 
@@ -105,3 +105,63 @@ TEST_CASE("Float parsing") {
     auto string = TASQuake::FloatString(value);
     REQUIRE(strcmp(string.Buffer, "1.001") == 0);
 }
+
+TEST_CASE("Binary script round trip") {
+    const char* str = "+1:\n"
+    "\ttas_strafe 1\n"
+    "\ttas_strafe_yaw 12.345\n"
+    "\t+jump\n"
+    "\techo test\n"
+    "+42:\n"
+    "\ttas_strafe 0\n"
+    "\t-jump\n"
+    "+0:\n"
+    "+5:\n"
+    "\techo test\n";
+
+    TASScript script;
+    REQUIRE(script.Load_From_String(str) == true);
+
+    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    script.Write_To_Binary(writer);
+
+    TASScript binary;
+    REQUIRE(binary.Load_From_Binary(writer.m_pBuffer->ptr, writer.m_uFileOffset) == true);
+    REQUIRE(binary.blocks.size() == script.blocks.size());
+    REQUIRE(binary.ToString() == script.ToString());
+
+    // Truncated input fails instead of reading past the end
+    TASScript truncated;
+    REQUIRE(truncated.Load_From_Binary(writer.m_pBuffer->ptr, writer.m_uFileOffset - 1) == false);
+}
+
+TEST_CASE("Binary script over IPC and from file") {
+    TASScript script;
+    script.AddCvar("tas_strafe", 1, 10);
+    script.AddToggle("attack", true, 20);
+    script.AddCommand("echo test", 30);
+
+    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    script.Write_To_Memory_Binary(writer);
+    script.Write_To_Memory(writer);
+
+    auto reader = TASQuakeIO::BufferReadInterface::Init(writer.m_pBuffer->ptr, writer.m_uFileOffset);
+    TASScript fromBinary;
+    TASScript fromText;
+    REQUIRE(fromBinary.Load_From_Memory(reader) == true);
+    REQUIRE(fromText.Load_From_Memory(reader) == true);
+    REQUIRE(fromBinary.ToString() == script.ToString());
+    REQUIRE(fromText.ToString() == script.ToString());
+
+    // A length prefix past the end of the message is rejected
+    auto shortReader = TASQuakeIO::BufferReadInterface::Init(writer.m_pBuffer->ptr, 12);
+    TASScript fromShort;
+    REQUIRE(fromShort.Load_From_Memory(shortReader) == false);
+
+    script.file_name = "binary_script_test.qtb";
+    script.Write_To_File();
+    TASScript loaded(script.file_name.c_str());
+    REQUIRE(loaded.Load_From_File() == true);
+    REQUIRE(loaded.ToString() == script.ToString());
+    std::remove(script.file_name.c_str());
+}
@@ -1,6 +1,9 @@
 #include "catch_amalgamated.hpp"
 #include "libtasquake/script_parse.hpp"
 #include "libtasquake/utils.hpp"
+#include <algorithm>
+#include <climits>
+#include <random>
 
 TEST_CASE("script addition test") {
     TASScript script;
@@ -58,3 +61,205 @@ TEST_CASE("shot test")
     rval = script.AddShot(2, 3, 21, 9);
     REQUIRE(rval == true);
 }
+
+TEST_CASE("first changed frame")
+{
+    TASScript script;
+    script.AddCvar("tas_strafe", 1, 10);
+    script.AddCvar("tas_strafe_yaw", 90, 50);
+    TASScript copy = script;
+
+    REQUIRE(script.FirstChangedFrame(&copy) == INT_MAX);
+    copy.blocks[1].convars["tas_strafe_yaw"] = 45;
+    REQUIRE(script.FirstChangedFrame(&copy) == 50);
+    copy.ShiftSingleBlock(1, -20);
+    REQUIRE(script.FirstChangedFrame(&copy) == 30);
+    copy = script;
+    copy.AddCommand("echo test", 70);
+    REQUIRE(script.FirstChangedFrame(&copy) == 70);
+    REQUIRE(copy.FirstChangedFrame(&script) == 70);
+}
+
+TEST_CASE("first effective change")
+{
+    TASScript script;
+    script.AddCvar("tas_strafe", 1, 10);
+    script.AddCvar("tas_strafe_yaw", 90, 50);
+    TASScript copy = script;
+
+    REQUIRE(script.FirstEffectiveChange(&copy) == INT_MAX);
+
+    // Setting a value the stack already has and adding empty blocks change nothing
+    copy.AddCvar("tas_strafe", 1, 30);
+    copy.blocks.emplace_back();
+    copy.blocks.back().frame = 60;
+    REQUIRE(script.FirstChangedFrame(&copy) == 30);
+    REQUIRE(script.FirstEffectiveChange(&copy) == INT_MAX);
+    REQUIRE(copy.FirstEffectiveChange(&script) == INT_MAX);
+
+    copy.AddCvar("tas_strafe_yaw", 45, 50);
+    REQUIRE(script.FirstEffectiveChange(&copy) == 50);
+    copy = script;
+    copy.AddCommand("echo test", 70);
+    REQUIRE(script.FirstEffectiveChange(&copy) == 70);
+    copy = script;
+    copy.AddToggle("tas_jump", true, 20);
+    REQUIRE(script.FirstEffectiveChange(&copy) == 20);
+
+    // tas_jump releases jump after the jump, so pressing it again changes the run
+    script.AddCvar("tas_jump", 1, 10);
+    script.AddToggle("jump", true, 20);
+    copy = script;
+    copy.AddToggle("jump", true, 40);
+    REQUIRE(script.FirstChangedFrame(&copy) == 40);
+    REQUIRE(script.FirstEffectiveChange(&copy) == 40);
+    REQUIRE(copy.FirstEffectiveChange(&script) == 40);
+}
+
+static int LinearBlockIndex(const TASScript& script, int frame) {
+    for (int i = 0; i < script.blocks.size(); ++i) {
+        if (script.blocks[i].frame >= frame) {
+            return i;
+        }
+    }
+
+    return script.blocks.size();
+}
+
+static TASScript RandomBlockScript(std::mt19937& rng, int blockCount) {
+    TASScript script;
+    int frame = 0;
+
+    for (int i = 0; i < blockCount; ++i) {
+        // Gaps of 0 produce blocks that share a frame
+        frame += std::uniform_int_distribution<int>(0, 5)(rng);
+        FrameBlock block;
+        block.frame = frame;
+        script.blocks.push_back(block);
+    }
+
+    return script;
+}
+
+TEST_CASE("block index matches linear search") {
+    std::mt19937 rng(1337);
+
+    for (int iteration = 0; iteration < 200; ++iteration) {
+        int blockCount = std::uniform_int_distribution<int>(0, 64)(rng);
+        TASScript script = RandomBlockScript(rng, blockCount);
+        int lastFrame = script.blocks.empty() ? 0 : script.blocks.back().frame;
+        std::uniform_int_distribution<int> frameDist(-2, lastFrame + 2);
+
+        // Sequential access goes through the cursor
+        for (int frame = -2; frame <= lastFrame + 2; ++frame) {
+            REQUIRE(script.GetBlockIndex(frame) == LinearBlockIndex(script, frame));
+        }
+
+        // Random access and stale cursors fall back to the binary search
+        for (int i = 0; i < 100; ++i) {
+            int frame = frameDist(rng);
+            REQUIRE(script.GetBlockIndex(frame) == LinearBlockIndex(script, frame));
+        }
+
+        script.prev_block_number = blockCount + 10;
+        REQUIRE(script.GetBlockIndex(lastFrame) == LinearBlockIndex(script, lastFrame));
+    }
+}
+
+TEST_CASE("block index follows script edits") {
+    std::mt19937 rng(42);
+    TASScript script = RandomBlockScript(rng, 32);
+    int lastFrame = script.blocks.back().frame;
+    std::uniform_int_distribution<int> frameDist(0, lastFrame + 10);
+
+    for (int i = 0; i < 200; ++i) {
+        int frame = frameDist(rng);
+        REQUIRE(script.GetBlockIndex(frame) == LinearBlockIndex(script, frame));
+
+        // Edits move blocks around without resetting the cursor
+        if (i % 3 == 0) {
+            script.AddCommand("echo test", frameDist(rng));
+        } else if (i % 3 == 1) {
+            script.RemoveBlocksAfterFrame(frameDist(rng) + lastFrame / 2);
+        } else {
+            script.AddCvar("tas_strafe", 1, frameDist(rng));
+        }
+
+        REQUIRE(script.GetBlockIndex(frame) == LinearBlockIndex(script, frame));
+        REQUIRE(std::is_sorted(script.blocks.begin(), script.blocks.end(),
+            [](const FrameBlock& a, const FrameBlock& b) { return a.frame < b.frame; }));
+    }
+}
+
+TEST_CASE("script patches reproduce edits") {
+    std::mt19937 rng(2024);
+
+    for (int iteration = 0; iteration < 100; ++iteration) {
+        TASScript baseline = RandomBlockScript(rng, 40);
+        TASScript edited = baseline;
+        int lastFrame = edited.blocks.back().frame;
+        std::uniform_int_distribution<int> frameDist(0, lastFrame + 10);
+
+        if (iteration % 4 == 0) {
+            edited.AddCvar("tas_strafe_yaw", 45, frameDist(rng));
+        } else if (iteration % 4 == 1) {
+            edited.AddCommand("echo test", frameDist(rng));
+        } else if (iteration % 4 == 2) {
+            edited.RemoveBlocksAfterFrame(frameDist(rng));
+        } else {
+            edited.ShiftSingleBlock(edited.blocks.size() / 2, 1);
+        }
+
+        auto writer = TASQuakeIO::BufferWriteInterface::Init();
+        ScriptPatch::Diff(baseline, edited).Write_To_Memory(writer);
+
+        TASScript peer = baseline;
+        int first_changed_frame;
+        auto reader = TASQuakeIO::BufferReadInterface::Init(writer.m_pBuffer->ptr, writer.m_uFileOffset);
+        REQUIRE(ScriptPatch::Apply_Update(peer, reader, first_changed_frame) == true);
+        REQUIRE(peer.ToString() == edited.ToString());
+        REQUIRE(peer.Checksum() == edited.Checksum());
+        REQUIRE(first_changed_frame <= baseline.FirstChangedFrame(&edited));
+    }
+}
+
+TEST_CASE("script patch detects desync") {
+    std::mt19937 rng(7);
+    TASScript baseline = RandomBlockScript(rng, 16);
+    TASScript edited = baseline;
+    edited.AddCommand("echo test", 3);
+
+    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    ScriptPatch::Write_Update(&baseline, edited, writer);
+
+    // The peer has diverged from the baseline, it has to ask for the full script
+    TASScript peer = baseline;
+    peer.AddCvar("tas_strafe", 0, 1);
+    int first_changed_frame;
+    auto reader = TASQuakeIO::BufferReadInterface::Init(writer.m_pBuffer->ptr, writer.m_uFileOffset);
+    REQUIRE(ScriptPatch::Apply_Update(peer, reader, first_changed_frame) == false);
+
+    auto fullWriter = TASQuakeIO::BufferWriteInterface::Init();
+    ScriptPatch::Write_Update(nullptr, edited, fullWriter);
+    auto fullReader = TASQuakeIO::BufferReadInterface::Init(fullWriter.m_pBuffer->ptr, fullWriter.m_uFileOffset);
+    REQUIRE(ScriptPatch::Apply_Update(peer, fullReader, first_changed_frame) == true);
+    REQUIRE(peer.ToString() == edited.ToString());
+}
+
+TEST_CASE("script update reports a repeated toggle") {
+    TASScript baseline;
+    baseline.AddToggle("jump", true, 10);
+    TASScript edited = baseline;
+    edited.AddToggle("jump", true, 20); // The game releases jump by itself, so this presses it again
+
+    for (const TASScript* base : {(const TASScript*)&baseline, (const TASScript*)nullptr}) {
+        auto writer = TASQuakeIO::BufferWriteInterface::Init();
+        ScriptPatch::Write_Update(base, edited, writer);
+
+        TASScript peer = baseline;
+        int first_changed_frame;
+        auto reader = TASQuakeIO::BufferReadInterface::Init(writer.m_pBuffer->ptr, writer.m_uFileOffset);
+        REQUIRE(ScriptPatch::Apply_Update(peer, reader, first_changed_frame) == true);
+        REQUIRE(first_changed_frame == 20);
+    }
+}
@@ -48,7 +48,7 @@ int main(int argc, char* argv[])
           std::cout << "Reply is: ";
           std::cout.write((const char*)msg.address, msg.length);
           std::cout << "\n";
-          free(msg.address);
+          ipc::free_message(msg);
         }
         messages.clear();
     }
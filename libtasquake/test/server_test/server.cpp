@@ -29,7 +29,7 @@ void busy_loop() {
     server_ptr->get_messages(messages);
     for(auto& msg : messages) {
       server_ptr->send_message(msg.connection_id, msg.address, msg.length);
-      free(msg.address);
+      ipc::free_message(msg);
     }
   }
 }
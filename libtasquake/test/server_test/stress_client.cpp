@@ -8,54 +8,82 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include "libtasquake/boost_ipc.hpp"
 
 using boost::asio::ip::tcp;
 
 enum { max_length = 1 << 20 };
 
-void run_test(const char* port)
+struct ThreadStats {
+    size_t bytes = 0;
+    size_t messages = 0;
+    double seconds = 0;
+    std::vector<double> latencies; // Round trip times in milliseconds
+};
+
+std::mutex stats_mutex;
+std::vector<ThreadStats> all_stats;
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if(sorted.empty())
+        return 0;
+    size_t index = std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5));
+    return sorted[index];
+}
+
+static void print_stats(const char* name, ThreadStats stats) {
+    std::sort(stats.latencies.begin(), stats.latencies.end());
+    double mb = stats.bytes / (1024.0 * 1024.0);
+    std::cout << name << ": " << mb / stats.seconds << " MB/s, "
+              << stats.messages / stats.seconds << " msgs/s, latency ms p50 "
+              << percentile(stats.latencies, 0.5) << " p90 "
+              << percentile(stats.latencies, 0.9) << " p99 "
+              << percentile(stats.latencies, 0.99) << " max "
+              << (stats.latencies.empty() ? 0 : stats.latencies.back()) << std::endl;
+}
+
+void run_test(const char* port, size_t iterations, size_t message_size)
 {
     ipc::client client;
     if(!client.connect(port)) {
       abort();
     }
     std::vector<ipc::Message> messages;
-    const size_t ITERATIONS = 10;
+    ThreadStats stats;
+    stats.latencies.reserve(iterations);
     auto start = std::chrono::steady_clock::now();
-    char* request = (char*)malloc(max_length);
+    char* request = (char*)malloc(message_size);
 
-    for(size_t i=0; i < ITERATIONS; ++i) {
+    for(size_t i=0; i < iterations; ++i) {
 
-        for(size_t index=0; index < max_length; ++index) {
-            request[index] = i % 16;
-        }
-        client.send_message(request, max_length);
-        auto start = std::chrono::steady_clock::now();
+        memset(request, i % 16, message_size);
+        auto sent = std::chrono::steady_clock::now();
+        client.send_message(request, message_size);
         client.get_messages(messages, 500);
-        auto end = std::chrono::steady_clock::now();
+        auto received = std::chrono::steady_clock::now();
 
         if(messages.empty()) {
             std::cerr << "No response on iteration " << i << std::endl;
             abort();
         }
 
-        char* buf = (char*)messages[0].address;
-
-        for(size_t index=0; index < max_length; ++index) {
-            char c = buf[index];
-            if(request[index] != c) {
-
-                std::cerr << (int)request[index] << " != " << (int)buf[index] << std::endl;
-                abort();
-            }
+        if(messages[0].length != message_size || memcmp(messages[0].address, request, message_size) != 0) {
+            std::cerr << "Response did not match the request on iteration " << i << std::endl;
+            abort();
         }
 
+        stats.latencies.push_back(std::chrono::duration<double, std::milli>(received - sent).count());
+        // Both directions count towards the throughput
+        stats.bytes += 2 * message_size;
+        stats.messages += 2;
+
         for(auto& msg : messages)
-            free(msg.address);
+            ipc::free_message(msg);
 
         messages.clear();
     }
@@ -63,31 +91,52 @@ void run_test(const char* port)
     free(request);
     client.disconnect();
     auto end = std::chrono::steady_clock::now();
+    stats.seconds = std::chrono::duration<double>(end - start).count();
 
-    double throughput = (ITERATIONS * max_length) / (double)(end - start).count() * 1e3;
-    std::cout << "Throughput for this thread was " << throughput << " MB/s" << std::endl;
+    std::lock_guard<std::mutex> guard(stats_mutex);
+    std::string name = "Thread " + std::to_string(all_stats.size());
+    print_stats(name.c_str(), stats);
+    all_stats.push_back(std::move(stats));
 }
 
 int main(int argc, char* argv[])
 {
   try
   {
-    if (argc != 3)
+    if (argc < 3 || argc > 5)
     {
-      std::cerr << "Usage: client_stress_test <port> <threads>\n";
+      std::cerr << "Usage: client_stress_test <port> <threads> [iterations] [message bytes]\n";
       return 1;
     }
 
     std::vector<std::thread> threads;
     const size_t THREADS = std::stoi(argv[2]);
+    const size_t ITERATIONS = argc > 3 ? std::stoi(argv[3]) : 10;
+    const size_t MESSAGE_SIZE = argc > 4 ? std::stoi(argv[4]) : max_length;
+
+    if(MESSAGE_SIZE > ipc::MAX_MESSAGE_BYTES) {
+      std::cerr << "Message size can be at most " << ipc::MAX_MESSAGE_BYTES << " bytes\n";
+      return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
 
     for(size_t i=0; i < THREADS; ++i) {
-        threads.push_back(std::thread(std::bind(run_test, argv[1])));
+        threads.push_back(std::thread(std::bind(run_test, argv[1], ITERATIONS, MESSAGE_SIZE)));
     }
 
     for(size_t i=0; i < THREADS; ++i) {
         threads[i].join();
     }
+
+    ThreadStats total;
+    for(auto& stats : all_stats) {
+        total.bytes += stats.bytes;
+        total.messages += stats.messages;
+        total.latencies.insert(total.latencies.end(), stats.latencies.begin(), stats.latencies.end());
+    }
+    total.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    print_stats("Total", total);
   }
   catch (std::exception& e)
   {
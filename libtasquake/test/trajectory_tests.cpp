@@ -0,0 +1,156 @@
+#include "catch_amalgamated.hpp"
+#include "libtasquake/optimizer.hpp"
+#include "libtasquake/prediction.hpp"
+#include "libtasquake/trajectory.hpp"
+#include <cmath>
+#include <random>
+
+static std::vector<TASQuake::FrameData> RandomWalk(std::mt19937& rng, size_t frames) {
+    std::uniform_real_distribution<float> step(-20.0f, 20.0f);
+    std::uniform_real_distribution<double> theta(-M_PI, M_PI);
+    std::vector<TASQuake::FrameData> data(frames);
+    TASQuake::Vector pos(std::uniform_real_distribution<float>(-4000.0f, 4000.0f)(rng), 0, 0);
+
+    for (size_t i = 0; i < frames; ++i) {
+        pos = TASQuake::Vector(pos.x + step(rng), pos.y + step(rng), pos.z + step(rng) * 0.1f);
+        data[i].pos = pos;
+        // Some frames don't have a velocity
+        data[i].m_dVelTheta = i % 7 == 0 ? 999.0 : theta(rng);
+    }
+
+    return data;
+}
+
+static TASQuake::OptimizerRun RoundTrip(const TASQuake::OptimizerRun& run, TASQuake::TrajectoryEncoding encoding, uint32_t* bytes = nullptr) {
+    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    run.WriteToBuffer(writer, encoding);
+    if (bytes)
+        *bytes = writer.m_uFileOffset;
+
+    auto reader = TASQuakeIO::BufferReadInterface::Init(writer.m_pBuffer->ptr, writer.m_uFileOffset);
+    TASQuake::OptimizerRun loaded;
+    REQUIRE(loaded.ReadFromBuffer(reader) == true);
+    REQUIRE(reader.m_uFileOffset == writer.m_uFileOffset);
+    return loaded;
+}
+
+TEST_CASE("Compact trajectory stays within the quantization error") {
+    std::mt19937 rng(99);
+    TASQuake::OptimizerRun run;
+    run.m_vecData = RandomWalk(rng, 5000);
+
+    uint32_t rawBytes, compactBytes;
+    RoundTrip(run, TASQuake::TrajectoryEncoding::Raw, &rawBytes);
+    auto loaded = RoundTrip(run, TASQuake::TrajectoryEncoding::Compact, &compactBytes);
+    REQUIRE(compactBytes * 2 < rawBytes);
+    REQUIRE(loaded.m_vecData.size() == run.m_vecData.size());
+
+    for (size_t i = 0; i < run.m_vecData.size(); ++i) {
+        auto& orig = run.m_vecData[i];
+        auto& decoded = loaded.m_vecData[i];
+        for (int axis = 0; axis < 3; ++axis) {
+            REQUIRE(std::abs(orig.pos[axis] - decoded.pos[axis]) <= TASQuake::TRAJECTORY_POSITION_STEP / 2 + 1e-3f);
+        }
+
+        if (orig.m_dVelTheta == 999.0) {
+            REQUIRE(decoded.m_dVelTheta == 999.0);
+        } else {
+            REQUIRE(std::abs(orig.m_dVelTheta - decoded.m_dVelTheta) <= TASQuake::TRAJECTORY_ANGLE_STEP / 2 + 1e-9);
+        }
+    }
+}
+
+TEST_CASE("Compact trajectory keeps run conditions") {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> offset(-120.0f, 120.0f);
+
+    for (int iteration = 0; iteration < 50; ++iteration) {
+        TASQuake::OptimizerRun run;
+        run.m_vecData = RandomWalk(rng, 500);
+        auto loaded = RoundTrip(run, TASQuake::TrajectoryEncoding::Compact);
+
+        // Nodes near the path, some of them too far away to be reached
+        TASQuake::RunConditions conditions;
+        for (size_t i = 0; i < run.m_vecData.size(); i += 50) {
+            auto& pos = run.m_vecData[i].pos;
+            conditions.m_vecNodes.push_back(TASQuake::Vector(pos.x + offset(rng), pos.y + offset(rng), pos.z));
+        }
+
+        REQUIRE(conditions.FulfillsConditions(&run) == conditions.FulfillsConditions(&loaded));
+
+        for (auto& node : conditions.m_vecNodes) {
+            TASQuake::RunConditions single;
+            single.m_vecNodes.push_back(node);
+            REQUIRE(single.FulfillsConditions(&run) == single.FulfillsConditions(&loaded));
+        }
+    }
+}
+
+TEST_CASE("Compact trajectory falls back to raw") {
+    TASQuake::OptimizerRun run;
+    run.m_vecData.resize(3);
+    run.m_vecData[1].pos = TASQuake::Vector(NAN, 1.2345f, 0);
+    auto loaded = RoundTrip(run, TASQuake::TrajectoryEncoding::Compact);
+
+    REQUIRE(loaded.m_vecData.size() == 3);
+    REQUIRE(std::isnan(loaded.m_vecData[1].pos.x));
+    REQUIRE(loaded.m_vecData[1].pos.y == 1.2345f);
+}
+
+TEST_CASE("Compact prediction points") {
+    TASQuake::PredictionData data;
+    data.m_iStartFrame = 10;
+    data.m_iEndFrame = 20;
+    data.m_vecFBdata.push_back({1, 15});
+    for (int i = 0; i < 10; ++i) {
+        data.m_vecPoints.push_back(TASQuake::Vector(i * 10.5f, -i * 3.25f, 24.0f));
+    }
+
+    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    data.Write_To_Memory(writer, TASQuake::TrajectoryEncoding::Compact);
+    auto reader = TASQuakeIO::BufferReadInterface::Init(writer.m_pBuffer->ptr, writer.m_uFileOffset);
+    TASQuake::PredictionData loaded;
+    REQUIRE(loaded.Load_From_Memory(reader) == true);
+
+    REQUIRE(loaded.m_iStartFrame == 10);
+    REQUIRE(loaded.m_iEndFrame == 20);
+    REQUIRE(loaded.m_vecFBdata.size() == 1);
+    REQUIRE(loaded.m_vecFBdata[0].m_uFrame == 15);
+    REQUIRE(loaded.m_vecPoints.size() == data.m_vecPoints.size());
+    for (size_t i = 0; i < data.m_vecPoints.size(); ++i) {
+        // Multiples of the step decode exactly
+        REQUIRE(loaded.m_vecPoints[i].x == data.m_vecPoints[i].x);
+        REQUIRE(loaded.m_vecPoints[i].y == data.m_vecPoints[i].y);
+        REQUIRE(loaded.m_vecPoints[i].z == data.m_vecPoints[i].z);
+    }
+}
+
+TEST_CASE("Unknown trajectory encoding is rejected") {
+    auto writer = TASQuakeIO::BufferWriteInterface::Init();
+    uint8_t tag = 200;
+    writer.Write(&tag);
+    auto reader = TASQuakeIO::BufferReadInterface::Init(writer.m_pBuffer->ptr, writer.m_uFileOffset);
+    std::vector<TASQuake::Vector> points;
+    REQUIRE(TASQuake::Read_Trajectory(reader, points) == false);
+
+    // The failure reaches the readers of whole messages
+    TASQuake::PredictionData data;
+    data.m_vecPoints.push_back(TASQuake::Vector(1, 2, 3));
+    auto predictionWriter = TASQuakeIO::BufferWriteInterface::Init();
+    data.Write_To_Memory(predictionWriter);
+    ((std::uint8_t*)predictionWriter.m_pBuffer->ptr)[sizeof(std::int32_t) * 2 + sizeof(std::uint32_t)] = tag;
+    auto predictionReader = TASQuakeIO::BufferReadInterface::Init(predictionWriter.m_pBuffer->ptr, predictionWriter.m_uFileOffset);
+    TASQuake::PredictionData loadedData;
+    REQUIRE(loadedData.Load_From_Memory(predictionReader) == false);
+
+    TASQuake::OptimizerRun run;
+    auto runWriter = TASQuakeIO::BufferWriteInterface::Init();
+    run.WriteToBuffer(runWriter);
+    auto tailWriter = TASQuakeIO::BufferWriteInterface::Init();
+    TASQuake::Write_Trajectory(tailWriter, run.m_vecData, TASQuake::TrajectoryEncoding::Raw);
+    run.playbackInfo.current_script.Write_To_Memory_Binary(tailWriter);
+    ((std::uint8_t*)runWriter.m_pBuffer->ptr)[runWriter.m_uFileOffset - tailWriter.m_uFileOffset] = tag;
+    auto runReader = TASQuakeIO::BufferReadInterface::Init(runWriter.m_pBuffer->ptr, runWriter.m_uFileOffset);
+    TASQuake::OptimizerRun loadedRun;
+    REQUIRE(loadedRun.ReadFromBuffer(runReader) == false);
+}